@@ -1,4 +1,4 @@
-{ pkgs ? import <nixpkgs> {} }:
+{ pkgs ? import <nixpkgs> {}, withXcb ? false, withThumbnails ? false, withBench ? false }:
 
 pkgs.stdenv.mkDerivation {
   pname = "winleap";
@@ -8,16 +8,35 @@ pkgs.stdenv.mkDerivation {
 
   buildInputs = [
     pkgs.xorg.libX11
+  ] ++ pkgs.lib.optionals withXcb [
+    pkgs.xorg.libxcb
+  ] ++ pkgs.lib.optionals withThumbnails [
+    pkgs.xorg.libXcomposite
+    pkgs.xorg.libXdamage
+    pkgs.xorg.libXfixes
+    pkgs.xorg.libXrender
   ];
 
-  buildPhase = ''
-    $CC -O2 -Wall -Wextra -o winleap winleap.c -lX11
+  buildPhase = let
+    flags = pkgs.lib.optionalString withXcb " -DWINLEAP_XCB"
+      + pkgs.lib.optionalString withThumbnails " -DWINLEAP_THUMBNAILS";
+    libs = pkgs.lib.optionalString withXcb " -lX11-xcb -lxcb"
+      + pkgs.lib.optionalString withThumbnails " -lXcomposite -lXdamage -lXrender";
+  in ''
+    $CC -O2 -Wall -Wextra${flags} -o winleap winleap.c -lX11${libs}
+  '' + pkgs.lib.optionalString withBench ''
+    $CC -O2 -Wall -Wextra -DWINLEAP_BENCH_XVFB='"${pkgs.xorg.xorgserver}/bin/Xvfb"' \
+      -o winleap-bench winleap-bench.c -lX11
+    $CC -O2 -Wall -Wextra -o winleap-microbench winleap-microbench.c -lX11
   '';
 
   installPhase = ''
     mkdir -p $out/bin
     mkdir -p $out/share/doc/winleap
     cp winleap $out/bin/
+    ln -s winleap $out/bin/winleapd
     cp winleap.conf.example $out/share/doc/winleap/
+  '' + pkgs.lib.optionalString withBench ''
+    cp winleap-bench winleap-microbench $out/bin/
   '';
 }
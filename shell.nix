@@ -6,6 +6,7 @@ pkgs.mkShell {
   buildInputs = with pkgs; [
     # X11 libs for winleap
     xorg.libX11
+    xorg.libxcb
     xorg.libXi
     xorg.libXtst
 
@@ -19,6 +20,9 @@ pkgs.mkShell {
     xorg.xinput
     xorg.xprop
     xorg.xwininfo
+
+    # Xvfb for winleap-bench
+    xorg.xorgserver
   ];
 
   shellHook = ''
@@ -27,6 +31,9 @@ pkgs.mkShell {
     echo ""
     echo "To compile winleap:"
     echo "  gcc -O2 -Wall -Wextra -o winleap winleap.c -lX11"
+    echo "  gcc -O2 -Wall -Wextra -DWINLEAP_XCB -o winleap winleap.c -lX11 -lX11-xcb -lxcb"
+    echo "  gcc -O2 -Wall -Wextra -o winleap-bench winleap-bench.c -lX11"
+    echo "  gcc -O2 -Wall -Wextra -o winleap-microbench winleap-microbench.c -lX11"
     echo ""
     echo "To run it:"
     echo "  ./winleap 1"
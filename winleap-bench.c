@@ -0,0 +1,939 @@
+/*
+ * winleap-bench.c - End-to-end jump latency benchmark under Xvfb
+ *
+ * Usage:
+ *   ./winleap-bench [--clients <n>[,<n>...]] [--desktops <m>] [--classes <k>] [--dist uniform|zipf]
+ *                   [--title-words <w>] [--runs <r>] [--daemon] [--seed <s>]
+ *                   [--winleap <path>] [--xvfb <path>] [--display <name>]
+ *
+ * Starts a private Xvfb and manages it with a small built-in EWMH window manager, then opens
+ * N synthetic clients spread over M desktops and drives winleap through mark jumps and
+ * --current-application jumps. Each jump is timed from spawning winleap to the window
+ * manager setting _NET_ACTIVE_WINDOW on the expected window. Every jump runs with
+ * --confirm --trace, so winleap's own confirmed latency and its X round trips are reported
+ * next to the wall-clock numbers.
+ *
+ * Output is one tab-separated row per client count and mode:
+ *   clients desktops mode path runs fail p50_ms p99_ms max_ms confirm_p50_ms confirm_p99_ms rt req
+ * rt and req are medians per jump; with --daemon they count the daemon's work for the jump.
+ */
+
+#define _GNU_SOURCE
+
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef WINLEAP_BENCH_XVFB
+#define WINLEAP_BENCH_XVFB "Xvfb"
+#endif
+
+#define MAX_SWEEP 32
+#define MAX_TARGET_MARKS 9
+#define MAX_APP_INSTANCES 8
+// Filler classes get marks from here on, so the config holds one mark per class
+#define FILLER_MARK_BASE 100
+#define JUMP_TIMEOUT_MS 10000
+#define DAEMON_START_TIMEOUT_MS 5000
+
+extern char **environ;
+
+typedef struct {
+    int sweep[MAX_SWEEP];
+    int sweep_count;
+    int desktops;
+    int classes;  // filler classes; 0: one per ten clients
+    int zipf;
+    int title_words;
+    int runs;
+    int daemon;
+    unsigned long long seed;
+    char winleap[PATH_MAX];
+    const char *xvfb;
+    const char *display;
+} BenchOptions;
+
+typedef struct {
+    double wall_ms;     // spawn to _NET_ACTIVE_WINDOW on the target
+    double confirm_ms;  // winleap's own "confirmed ... latency_ms"
+    long round_trips;
+    long requests;
+    int ok;
+} RunResult;
+
+long long monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// xorshift64*: deterministic for a given --seed, so runs compare across builds
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+unsigned long long rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+double rng_unit(void) {
+    return (double)(rng_next() >> 11) / (double)(1ULL << 53);
+}
+
+// Window manager: one connection with SubstructureRedirect on the root window. It keeps
+// _NET_CLIENT_LIST in map order, shows one desktop at a time and honours _NET_ACTIVE_WINDOW
+// and _NET_CURRENT_DESKTOP client messages.
+static Display *wm_dpy;
+static Window wm_root;
+static Window wm_check;
+static Atom atom_net_supported;
+static Atom atom_net_client_list;
+static Atom atom_net_active_window;
+static Atom atom_net_current_desktop;
+static Atom atom_net_number_of_desktops;
+static Atom atom_net_wm_desktop;
+static Atom atom_net_wm_name;
+static Atom atom_net_supporting_wm_check;
+static Atom atom_utf8_string;
+
+static Window *managed;
+static long *managed_desktops;
+static int managed_count;
+static int managed_cap;
+static long wm_current_desktop;
+static long wm_desktop_count;
+// _NET_CLIENT_LIST is rewritten once per batch of events, not once per mapped client
+static int wm_client_list_dirty;
+
+// The jump being timed: set when the WM activates `awaited`
+static Window awaited;
+static long long awaited_active_ns;
+
+static int wm_redirect_failed;
+
+static int wm_error_handler(Display *dpy, XErrorEvent *event) {
+    (void)dpy;
+    if (event->request_code == 2 /* X_ChangeWindowAttributes */ && event->error_code == BadAccess) {
+        wm_redirect_failed = 1;
+    }
+    // Clients may be gone by the time a request about them arrives
+    return 0;
+}
+
+static void wm_set_cardinals(Window win, Atom atom, Atom type, const long *values, int count) {
+    XChangeProperty(wm_dpy, win, atom, type, 32, PropModeReplace, (const unsigned char *)values, count);
+}
+
+static void wm_publish_client_list(void) {
+    long *ids = malloc(sizeof(long) * (size_t)(managed_count > 0 ? managed_count : 1));
+    if (!ids) return;
+    for (int i = 0; i < managed_count; i++) ids[i] = (long)managed[i];
+    wm_set_cardinals(wm_root, atom_net_client_list, XA_WINDOW, ids, managed_count);
+    free(ids);
+}
+
+static int wm_find(Window win) {
+    for (int i = 0; i < managed_count; i++) {
+        if (managed[i] == win) return i;
+    }
+    return -1;
+}
+
+static void wm_show_desktop(long desktop) {
+    if (desktop < 0 || desktop >= wm_desktop_count) return;
+    if (desktop != wm_current_desktop) {
+        for (int i = 0; i < managed_count; i++) {
+            if (managed_desktops[i] == desktop) XMapWindow(wm_dpy, managed[i]);
+            else if (managed_desktops[i] == wm_current_desktop) XUnmapWindow(wm_dpy, managed[i]);
+        }
+        wm_current_desktop = desktop;
+    }
+    wm_set_cardinals(wm_root, atom_net_current_desktop, XA_CARDINAL, &wm_current_desktop, 1);
+}
+
+static void wm_activate(Window win) {
+    int idx = wm_find(win);
+    if (idx < 0) return;
+    wm_show_desktop(managed_desktops[idx]);
+    XRaiseWindow(wm_dpy, win);
+    XSetInputFocus(wm_dpy, win, RevertToPointerRoot, CurrentTime);
+    long active = (long)win;
+    wm_set_cardinals(wm_root, atom_net_active_window, XA_WINDOW, &active, 1);
+    XFlush(wm_dpy);
+    if (win == awaited && awaited_active_ns == 0) awaited_active_ns = monotonic_ns();
+}
+
+static long wm_requested_desktop(Window win) {
+    Atom type;
+    int format;
+    unsigned long nitems, after;
+    unsigned char *prop = NULL;
+    long desktop = wm_current_desktop;
+    if (XGetWindowProperty(wm_dpy, win, atom_net_wm_desktop, 0, 1, False, XA_CARDINAL, &type, &format,
+                           &nitems, &after, &prop) == Success && prop && nitems == 1 && format == 32) {
+        long requested = *(long *)prop;
+        if (requested >= 0 && requested < wm_desktop_count) desktop = requested;
+    }
+    if (prop) XFree(prop);
+    return desktop;
+}
+
+static void wm_manage(Window win) {
+    if (managed_count == managed_cap) {
+        int cap = managed_cap ? managed_cap * 2 : 256;
+        Window *ids = realloc(managed, sizeof(*ids) * (size_t)cap);
+        if (!ids) return;
+        managed = ids;
+        long *desktops = realloc(managed_desktops, sizeof(*desktops) * (size_t)cap);
+        if (!desktops) return;
+        managed_desktops = desktops;
+        managed_cap = cap;
+    }
+    long desktop = wm_requested_desktop(win);
+    managed[managed_count] = win;
+    managed_desktops[managed_count] = desktop;
+    managed_count++;
+    wm_set_cardinals(win, atom_net_wm_desktop, XA_CARDINAL, &desktop, 1);
+    wm_client_list_dirty = 1;
+    if (desktop == wm_current_desktop) XMapWindow(wm_dpy, win);
+}
+
+static void wm_unmanage(Window win) {
+    int idx = wm_find(win);
+    if (idx < 0) return;
+    managed_count--;
+    memmove(managed + idx, managed + idx + 1, sizeof(*managed) * (size_t)(managed_count - idx));
+    memmove(managed_desktops + idx, managed_desktops + idx + 1,
+            sizeof(*managed_desktops) * (size_t)(managed_count - idx));
+    wm_client_list_dirty = 1;
+}
+
+static void wm_handle(XEvent *event) {
+    switch (event->type) {
+    case MapRequest: {
+        Window win = event->xmaprequest.window;
+        int idx = wm_find(win);
+        if (idx < 0) {
+            wm_manage(win);
+        } else if (managed_desktops[idx] == wm_current_desktop) {
+            XMapWindow(wm_dpy, win);
+        }
+        break;
+    }
+    case ConfigureRequest: {
+        XConfigureRequestEvent *cr = &event->xconfigurerequest;
+        XWindowChanges changes = {
+            .x = cr->x, .y = cr->y, .width = cr->width, .height = cr->height,
+            .border_width = cr->border_width, .sibling = cr->above, .stack_mode = cr->detail,
+        };
+        XConfigureWindow(wm_dpy, cr->window, (unsigned int)cr->value_mask, &changes);
+        break;
+    }
+    case DestroyNotify:
+        wm_unmanage(event->xdestroywindow.window);
+        break;
+    case ClientMessage:
+        if (event->xclient.message_type == atom_net_active_window) {
+            wm_activate(event->xclient.window);
+        } else if (event->xclient.message_type == atom_net_current_desktop) {
+            wm_show_desktop(event->xclient.data.l[0]);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void wm_drain(void) {
+    while (XPending(wm_dpy) > 0) {
+        XEvent event;
+        XNextEvent(wm_dpy, &event);
+        wm_handle(&event);
+    }
+    if (wm_client_list_dirty) {
+        wm_client_list_dirty = 0;
+        wm_publish_client_list();
+    }
+    XFlush(wm_dpy);
+}
+
+// Handles WM events for up to timeout_ms, or until `other_fd` (if any) is readable.
+// Returns poll()'s revents for other_fd.
+static short wm_pump(int other_fd, int timeout_ms) {
+    wm_drain();
+
+    struct pollfd fds[2] = {
+        { .fd = ConnectionNumber(wm_dpy), .events = POLLIN },
+        { .fd = other_fd, .events = POLLIN },
+    };
+    if (poll(fds, other_fd >= 0 ? 2 : 1, timeout_ms) < 0 && errno != EINTR) return POLLERR;
+    wm_drain();
+    return other_fd >= 0 ? fds[1].revents : 0;
+}
+
+int wm_start(const char *display_name, int desktops) {
+    wm_dpy = XOpenDisplay(display_name);
+    if (!wm_dpy) {
+        fprintf(stderr, "Cannot open display %s\n", display_name);
+        return 0;
+    }
+    wm_root = DefaultRootWindow(wm_dpy);
+    XSetErrorHandler(wm_error_handler);
+    XSelectInput(wm_dpy, wm_root, SubstructureRedirectMask | SubstructureNotifyMask);
+    XSync(wm_dpy, False);
+    if (wm_redirect_failed) {
+        fprintf(stderr, "Another window manager is running on %s\n", display_name);
+        return 0;
+    }
+
+    atom_net_supported = XInternAtom(wm_dpy, "_NET_SUPPORTED", False);
+    atom_net_client_list = XInternAtom(wm_dpy, "_NET_CLIENT_LIST", False);
+    atom_net_active_window = XInternAtom(wm_dpy, "_NET_ACTIVE_WINDOW", False);
+    atom_net_current_desktop = XInternAtom(wm_dpy, "_NET_CURRENT_DESKTOP", False);
+    atom_net_number_of_desktops = XInternAtom(wm_dpy, "_NET_NUMBER_OF_DESKTOPS", False);
+    atom_net_wm_desktop = XInternAtom(wm_dpy, "_NET_WM_DESKTOP", False);
+    atom_net_wm_name = XInternAtom(wm_dpy, "_NET_WM_NAME", False);
+    atom_net_supporting_wm_check = XInternAtom(wm_dpy, "_NET_SUPPORTING_WM_CHECK", False);
+    atom_utf8_string = XInternAtom(wm_dpy, "UTF8_STRING", False);
+
+    wm_check = XCreateSimpleWindow(wm_dpy, wm_root, -1, -1, 1, 1, 0, 0, 0);
+    long check = (long)wm_check;
+    wm_set_cardinals(wm_root, atom_net_supporting_wm_check, XA_WINDOW, &check, 1);
+    wm_set_cardinals(wm_check, atom_net_supporting_wm_check, XA_WINDOW, &check, 1);
+    XChangeProperty(wm_dpy, wm_check, atom_net_wm_name, atom_utf8_string, 8, PropModeReplace,
+                    (const unsigned char *)"winleap-bench", 13);
+
+    long supported[] = {
+        (long)atom_net_client_list, (long)atom_net_active_window, (long)atom_net_current_desktop,
+        (long)atom_net_number_of_desktops, (long)atom_net_wm_desktop, (long)atom_net_wm_name,
+    };
+    wm_set_cardinals(wm_root, atom_net_supported, XA_ATOM, supported, (int)(sizeof(supported) / sizeof(supported[0])));
+
+    wm_desktop_count = desktops;
+    wm_set_cardinals(wm_root, atom_net_number_of_desktops, XA_CARDINAL, &wm_desktop_count, 1);
+    wm_current_desktop = 0;
+    wm_show_desktop(0);
+    wm_publish_client_list();
+    XSync(wm_dpy, False);
+    return 1;
+}
+
+// Synthetic clients: one connection owns them all, so closing it destroys every window
+typedef struct {
+    Display *dpy;
+    Window *ids;
+    int count;
+    int target_marks;   // marks 1..target_marks name one window each
+    Window targets[MAX_TARGET_MARKS];
+    int app_instances;  // BenchApp windows, in _NET_CLIENT_LIST order
+    Window apps[MAX_APP_INSTANCES];
+    int filler_classes;
+} ClientSet;
+
+static const char *const title_words[] = {
+    "inbox", "draft", "review", "build", "notes", "budget", "sprint", "kernel",
+    "design", "meeting", "report", "release", "shell", "index", "query", "profile",
+};
+
+static Window open_client(Display *dpy, const char *instance, const char *cls, long desktop, int words) {
+    Window win = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 0, 0, 320, 200, 0, 0, 0);
+    XClassHint hint = { (char *)instance, (char *)cls };
+    XSetClassHint(dpy, win, &hint);
+
+    char title[256];
+    size_t len = 0;
+    for (int w = 0; w < words && len < sizeof(title) - 32; w++) {
+        const char *word = title_words[rng_next() % (sizeof(title_words) / sizeof(title_words[0]))];
+        len += (size_t)snprintf(title + len, sizeof(title) - len, "%s%s", w ? " " : "", word);
+    }
+    snprintf(title + len, sizeof(title) - len, "%s%s", len ? " - " : "", cls);
+    XChangeProperty(dpy, win, atom_net_wm_name, atom_utf8_string, 8, PropModeReplace,
+                    (const unsigned char *)title, (int)strlen(title));
+    XStoreName(dpy, win, title);
+    // A desktop hint set before mapping is where the WM puts the window
+    XChangeProperty(dpy, win, atom_net_wm_desktop, XA_CARDINAL, 32, PropModeReplace,
+                    (const unsigned char *)&desktop, 1);
+    XMapWindow(dpy, win);
+    return win;
+}
+
+static int pick_filler_class(const double *cdf, int classes, int zipf) {
+    if (!zipf) return (int)(rng_next() % (unsigned long long)classes);
+    double u = rng_unit();
+    int lo = 0, hi = classes - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int open_clients(ClientSet *set, const char *display_name, int count, const BenchOptions *opts) {
+    memset(set, 0, sizeof(*set));
+    set->dpy = XOpenDisplay(display_name);
+    if (!set->dpy) return 0;
+    set->ids = calloc((size_t)count, sizeof(*set->ids));
+    if (!set->ids) return 0;
+
+    set->target_marks = count / 3 < MAX_TARGET_MARKS ? count / 3 : MAX_TARGET_MARKS;
+    set->app_instances = count / 3 < MAX_APP_INSTANCES ? count / 3 : MAX_APP_INSTANCES;
+    if (set->target_marks < 1) set->target_marks = 1;
+    if (set->app_instances < 2) set->app_instances = 2;
+    int fillers = count - set->target_marks - set->app_instances;
+    if (fillers < 0) fillers = 0;
+    set->filler_classes = opts->classes > 0 ? opts->classes : (count / 10 > 0 ? count / 10 : 1);
+
+    // Zipf with s=1: class k (0-based) gets weight 1/(k+1)
+    double *cdf = calloc((size_t)set->filler_classes, sizeof(*cdf));
+    if (!cdf) return 0;
+    double total = 0;
+    for (int k = 0; k < set->filler_classes; k++) total += 1.0 / (k + 1);
+    double acc = 0;
+    for (int k = 0; k < set->filler_classes; k++) {
+        acc += 1.0 / (k + 1) / total;
+        cdf[k] = acc;
+    }
+
+    // Targets and app instances are spread over the desktops round robin, fillers at random
+    char instance[64], cls[64];
+    for (int i = 0; i < set->target_marks; i++) {
+        snprintf(instance, sizeof(instance), "benchmark%d", i + 1);
+        snprintf(cls, sizeof(cls), "BenchMark%d", i + 1);
+        set->targets[i] = set->ids[set->count++] =
+            open_client(set->dpy, instance, cls, i % opts->desktops, opts->title_words);
+    }
+    for (int i = 0; i < set->app_instances; i++) {
+        set->apps[i] = set->ids[set->count++] =
+            open_client(set->dpy, "benchapp", "BenchApp", i % opts->desktops, opts->title_words);
+    }
+    for (int i = 0; i < fillers; i++) {
+        int k = pick_filler_class(cdf, set->filler_classes, opts->zipf);
+        snprintf(instance, sizeof(instance), "benchfiller%d", k);
+        snprintf(cls, sizeof(cls), "BenchFiller%d", k);
+        set->ids[set->count++] = open_client(set->dpy, instance, cls, (long)(rng_next() % (unsigned long long)opts->desktops),
+                                             opts->title_words);
+    }
+    free(cdf);
+    XSync(set->dpy, False);
+
+    // Windows map in creation order because the WM handles MapRequests in order
+    long long deadline = monotonic_ns() + (long long)JUMP_TIMEOUT_MS * 1000000;
+    while (managed_count < set->count && monotonic_ns() < deadline) wm_pump(-1, 50);
+    return managed_count == set->count;
+}
+
+void close_clients(ClientSet *set) {
+    if (set->dpy) XCloseDisplay(set->dpy);
+    free(set->ids);
+    long long deadline = monotonic_ns() + (long long)JUMP_TIMEOUT_MS * 1000000;
+    while (managed_count > 0 && monotonic_ns() < deadline) wm_pump(-1, 50);
+    memset(set, 0, sizeof(*set));
+}
+
+int write_config(const char *config_dir, const ClientSet *set) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/winleap", config_dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/winleap/winleap.conf", config_dir);
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+    fprintf(f, "# written by winleap-bench\n");
+    for (int i = 0; i < set->target_marks; i++) fprintf(f, "%d=BenchMark%d\n", i + 1, i + 1);
+    fprintf(f, "%d=BenchApp\n", MAX_TARGET_MARKS + 1);
+    for (int k = 0; k < set->filler_classes; k++) fprintf(f, "%d=BenchFiller%d\n", FILLER_MARK_BASE + k, k);
+    fprintf(f, "activation_timeout_ms=%d\n", JUMP_TIMEOUT_MS);
+    return fclose(f) == 0;
+}
+
+static pid_t spawn_quiet(char *const argv[], int out_fd) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    if (out_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, 1);
+        posix_spawn_file_actions_adddup2(&actions, out_fd, 2);
+    } else {
+        posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    }
+    pid_t pid = -1;
+    int err = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        fprintf(stderr, "Cannot run %s: %s\n", argv[0], strerror(err));
+        return -1;
+    }
+    return pid;
+}
+
+// "trace phase=total" covers a one-shot run. A daemon jump has no total, so its phases are
+// summed, leaving out the per-window spans nested inside discover_windows.
+static void parse_trace(const char *output, RunResult *result) {
+    long total_rt = -1, total_req = -1, sum_rt = 0, sum_req = 0;
+    for (const char *line = output; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+        double latency;
+        unsigned long wid;
+        if (sscanf(line, "confirmed wid=%lu latency_ms=%lf", &wid, &latency) == 2) {
+            result->confirm_ms = latency;
+            continue;
+        }
+        char phase[64];
+        if (sscanf(line, "trace phase=%63s", phase) != 1) continue;
+        const char *rt = strstr(line, " rt=");
+        const char *req = strstr(line, " req=");
+        if (!rt || !req || strchr(line, '\n') < rt) continue;
+        long rt_value = strtol(rt + 4, NULL, 10);
+        long req_value = strtol(req + 5, NULL, 10);
+        if (strcmp(phase, "total") == 0) {
+            total_rt = rt_value;
+            total_req = req_value;
+        } else if (strcmp(phase, "discover_window") != 0 && strncmp(phase, "discover_fetch_", 15) != 0) {
+            sum_rt += rt_value;
+            sum_req += req_value;
+        }
+    }
+    result->round_trips = total_rt >= 0 ? total_rt : sum_rt;
+    result->requests = total_req >= 0 ? total_req : sum_req;
+}
+
+// Runs one winleap jump while serving WM events, and times it against the WM's activation
+int time_jump(const BenchOptions *opts, char *const jump_args[], Window expected, RunResult *result) {
+    memset(result, 0, sizeof(*result));
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0) return 0;
+
+    char *argv[16];
+    int argc = 0;
+    argv[argc++] = (char *)opts->winleap;
+    argv[argc++] = "--confirm";
+    argv[argc++] = "--trace";
+    if (!opts->daemon) argv[argc++] = "--no-daemon";
+    for (int i = 0; jump_args[i] && argc < 15; i++) argv[argc++] = jump_args[i];
+    argv[argc] = NULL;
+
+    awaited = expected;
+    awaited_active_ns = 0;
+    long long start = monotonic_ns();
+    pid_t pid = spawn_quiet(argv, pipe_fds[1]);
+    close(pipe_fds[1]);
+    if (pid < 0) {
+        close(pipe_fds[0]);
+        return 0;
+    }
+
+    char *output = NULL;
+    size_t len = 0, cap = 0;
+    long long deadline = start + (long long)JUMP_TIMEOUT_MS * 1000000;
+    while (monotonic_ns() < deadline) {
+        short revents = wm_pump(pipe_fds[0], 100);
+        if (!(revents & (POLLIN | POLLHUP))) continue;
+        if (cap - len < 4096) {
+            cap = cap ? cap * 2 : 8192;
+            char *grown = realloc(output, cap);
+            if (!grown) break;
+            output = grown;
+        }
+        ssize_t n = read(pipe_fds[0], output + len, cap - len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += (size_t)n;
+    }
+    close(pipe_fds[0]);
+
+    int status = 0;
+    if (monotonic_ns() >= deadline) kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+
+    if (output) {
+        output[len] = '\0';
+        parse_trace(output, result);
+        free(output);
+    }
+    result->ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && awaited_active_ns > 0;
+    result->wall_ms = result->ok ? (double)(awaited_active_ns - start) / 1e6 : 0;
+    return 1;
+}
+
+// The daemon is ready once it answers --stats
+pid_t start_daemon(const BenchOptions *opts) {
+    char *daemon_argv[] = { (char *)opts->winleap, "--daemon", NULL };
+    pid_t pid = spawn_quiet(daemon_argv, -1);
+    if (pid < 0) return -1;
+
+    char *stats_argv[] = { (char *)opts->winleap, "--stats", NULL };
+    long long deadline = monotonic_ns() + (long long)DAEMON_START_TIMEOUT_MS * 1000000;
+    while (monotonic_ns() < deadline) {
+        pid_t probe = spawn_quiet(stats_argv, -1);
+        int status = 1;
+        while (probe > 0 && waitpid(probe, &status, WNOHANG) == 0) wm_pump(-1, 5);
+        if (probe > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) return pid;
+        if (waitpid(pid, &status, WNOHANG) == pid) break;
+        wm_pump(-1, 20);
+    }
+    fprintf(stderr, "winleap --daemon did not come up\n");
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+void stop_daemon(pid_t pid) {
+    if (pid <= 0) return;
+    kill(pid, SIGTERM);
+    int status;
+    while (waitpid(pid, &status, WNOHANG) == 0) wm_pump(-1, 10);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_longs(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank on sorted samples
+static double percentile(const double *sorted, int count, double q) {
+    if (count == 0) return 0;
+    int rank = (int)(q * count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1];
+}
+
+void report(const BenchOptions *opts, int clients, const char *mode, const RunResult *runs, int count) {
+    double *wall = calloc((size_t)count + 1, sizeof(double));
+    double *confirm = calloc((size_t)count + 1, sizeof(double));
+    long *rt = calloc((size_t)count + 1, sizeof(long));
+    long *req = calloc((size_t)count + 1, sizeof(long));
+    if (!wall || !confirm || !rt || !req) return;
+
+    int ok = 0;
+    for (int i = 0; i < count; i++) {
+        if (!runs[i].ok) continue;
+        wall[ok] = runs[i].wall_ms;
+        confirm[ok] = runs[i].confirm_ms;
+        rt[ok] = runs[i].round_trips;
+        req[ok] = runs[i].requests;
+        ok++;
+    }
+    qsort(wall, (size_t)ok, sizeof(*wall), compare_doubles);
+    qsort(confirm, (size_t)ok, sizeof(*confirm), compare_doubles);
+    qsort(rt, (size_t)ok, sizeof(*rt), compare_longs);
+    qsort(req, (size_t)ok, sizeof(*req), compare_longs);
+
+    printf("%d\t%d\t%s\t%s\t%d\t%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%ld\t%ld\n",
+           clients, opts->desktops, mode, opts->daemon ? "daemon" : "oneshot", count, count - ok,
+           percentile(wall, ok, 0.5), percentile(wall, ok, 0.99), ok ? wall[ok - 1] : 0.0,
+           percentile(confirm, ok, 0.5), percentile(confirm, ok, 0.99),
+           ok ? rt[ok / 2] : 0, ok ? req[ok / 2] : 0);
+    fflush(stdout);
+    free(wall);
+    free(confirm);
+    free(rt);
+    free(req);
+}
+
+// Mark jumps cycle through the target marks, so every jump moves focus and most switch
+// desktops. Application jumps start on one BenchApp window and step to the next instance.
+int bench_clients(const BenchOptions *opts, const char *display_name, const char *config_dir, int clients) {
+    ClientSet set;
+    if (!open_clients(&set, display_name, clients, opts)) {
+        fprintf(stderr, "The WM did not manage all %d clients\n", clients);
+        close_clients(&set);
+        return 0;
+    }
+    if (!write_config(config_dir, &set)) {
+        fprintf(stderr, "Cannot write the benchmark config in %s\n", config_dir);
+        close_clients(&set);
+        return 0;
+    }
+
+    pid_t daemon_pid = opts->daemon ? start_daemon(opts) : 0;
+    if (daemon_pid < 0) {
+        close_clients(&set);
+        return 0;
+    }
+
+    RunResult *runs = calloc((size_t)opts->runs, sizeof(*runs));
+    if (!runs) return 0;
+
+    // Start on a window that is not a target, so the first mark jump moves focus too
+    wm_activate(set.apps[0]);
+    for (int r = 0; r < opts->runs; r++) {
+        int mark = r % set.target_marks + 1;
+        if (set.target_marks == 1 && r % 2 == 1) {
+            wm_activate(set.apps[0]);
+        }
+        char number[16];
+        snprintf(number, sizeof(number), "%d", mark);
+        char *args[] = { number, NULL };
+        time_jump(opts, args, set.targets[mark - 1], &runs[r]);
+    }
+    report(opts, clients, "mark", runs, opts->runs);
+
+    wm_activate(set.apps[0]);
+    for (int r = 0; r < opts->runs; r++) {
+        int instance = (r + 1) % set.app_instances;
+        char number[16];
+        snprintf(number, sizeof(number), "%d", instance + 1);
+        char *args[] = { "--current-application", number, NULL };
+        time_jump(opts, args, set.apps[instance], &runs[r]);
+    }
+    report(opts, clients, "application", runs, opts->runs);
+
+    free(runs);
+    stop_daemon(daemon_pid);
+    close_clients(&set);
+    return 1;
+}
+
+// Xvfb picks a free display itself and writes its number to -displayfd
+pid_t start_xvfb(const char *xvfb, char *display_name, size_t size) {
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    char fd_arg[16];
+    snprintf(fd_arg, sizeof(fd_arg), "%d", fds[1]);
+    char *argv[] = { (char *)xvfb, "-displayfd", fd_arg, "-screen", "0", "1920x1080x24", "-nolisten", "tcp",
+                     "-noreset", NULL };
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    pid_t pid = -1;
+    int err = posix_spawnp(&pid, xvfb, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (err != 0) {
+        fprintf(stderr, "Cannot run %s: %s\n", xvfb, strerror(err));
+        close(fds[0]);
+        return -1;
+    }
+
+    char number[16] = {0};
+    size_t len = 0;
+    struct pollfd pfd = { .fd = fds[0], .events = POLLIN };
+    while (len < sizeof(number) - 1 && poll(&pfd, 1, DAEMON_START_TIMEOUT_MS) > 0) {
+        ssize_t n = read(fds[0], number + len, sizeof(number) - 1 - len);
+        if (n <= 0) break;
+        len += (size_t)n;
+        if (memchr(number, '\n', len)) break;
+    }
+    close(fds[0]);
+    if (len == 0) {
+        fprintf(stderr, "%s did not report a display\n", xvfb);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    number[strcspn(number, "\n")] = '\0';
+    snprintf(display_name, size, ":%s", number);
+    return pid;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+// Defaults to the winleap binary next to this one
+static void default_winleap_path(char *out, size_t size) {
+    char self[PATH_MAX - 16];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n <= 0) {
+        snprintf(out, size, "./winleap");
+        return;
+    }
+    self[n] = '\0';
+    char *slash = strrchr(self, '/');
+    if (slash) *slash = '\0';
+    snprintf(out, size, "%s/winleap", self);
+}
+
+int parse_sweep(const char *arg, BenchOptions *opts) {
+    opts->sweep_count = 0;
+    const char *p = arg;
+    while (*p) {
+        char *end = NULL;
+        long n = strtol(p, &end, 10);
+        if (end == p || n < 3 || n > 100000 || opts->sweep_count >= MAX_SWEEP) return 0;
+        opts->sweep[opts->sweep_count++] = (int)n;
+        p = end;
+        if (*p == ',') p++;
+        else if (*p) return 0;
+    }
+    return opts->sweep_count > 0;
+}
+
+void print_usage(const char *prog) {
+    printf("Usage:\n");
+    printf("  %s [--clients <n>[,<n>...]] [--desktops <m>] [--classes <k>] [--dist uniform|zipf]\n", prog);
+    printf("     [--title-words <w>] [--runs <r>] [--daemon] [--seed <s>]\n");
+    printf("     [--winleap <path>] [--xvfb <path>] [--display <name>]\n\n");
+    printf("Options:\n");
+    printf("  --clients <list>     Client counts to sweep (default 10,100,500,1000,2000)\n");
+    printf("  --desktops <m>       Desktops the clients are spread over (default 4)\n");
+    printf("  --classes <k>        Filler WM_CLASS count (default: one per ten clients)\n");
+    printf("  --dist <d>           Filler class distribution: uniform or zipf (default uniform)\n");
+    printf("  --title-words <w>    Words per window title (default 4)\n");
+    printf("  --runs <r>           Jumps per client count and mode (default 100)\n");
+    printf("  --daemon             Jump through a winleap daemon instead of one-shot runs\n");
+    printf("  --seed <s>           Seed for class, desktop and title choices (default 1)\n");
+    printf("  --winleap <path>     winleap binary to benchmark (default: next to this one)\n");
+    printf("  --xvfb <path>        Xvfb binary (default %s)\n", WINLEAP_BENCH_XVFB);
+    printf("  --display <name>     Use this X server instead of starting Xvfb; it must have no WM\n");
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions opts = {
+        .sweep = { 10, 100, 500, 1000, 2000 },
+        .sweep_count = 5,
+        .desktops = 4,
+        .title_words = 4,
+        .runs = 100,
+        .seed = 1,
+        .xvfb = WINLEAP_BENCH_XVFB,
+    };
+    default_winleap_path(opts.winleap, sizeof(opts.winleap));
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        int takes_value = strcmp(arg, "--daemon") != 0 && strcmp(arg, "--help") != 0 && strcmp(arg, "-h") != 0;
+        if (takes_value && !value) {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            return 1;
+        }
+        if (strcmp(arg, "--clients") == 0) {
+            if (!parse_sweep(value, &opts)) {
+                fprintf(stderr, "Invalid --clients list (counts 3-100000): %s\n", value);
+                return 1;
+            }
+        } else if (strcmp(arg, "--desktops") == 0) {
+            opts.desktops = atoi(value);
+        } else if (strcmp(arg, "--classes") == 0) {
+            opts.classes = atoi(value);
+        } else if (strcmp(arg, "--dist") == 0) {
+            if (strcmp(value, "zipf") == 0) {
+                opts.zipf = 1;
+            } else if (strcmp(value, "uniform") != 0) {
+                fprintf(stderr, "Invalid --dist value (uniform or zipf): %s\n", value);
+                return 1;
+            }
+        } else if (strcmp(arg, "--title-words") == 0) {
+            opts.title_words = atoi(value);
+        } else if (strcmp(arg, "--runs") == 0) {
+            opts.runs = atoi(value);
+        } else if (strcmp(arg, "--seed") == 0) {
+            opts.seed = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--winleap") == 0) {
+            snprintf(opts.winleap, sizeof(opts.winleap), "%s", value);
+        } else if (strcmp(arg, "--xvfb") == 0) {
+            opts.xvfb = value;
+        } else if (strcmp(arg, "--display") == 0) {
+            opts.display = value;
+        } else if (strcmp(arg, "--daemon") == 0) {
+            opts.daemon = 1;
+            continue;
+        } else if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return 1;
+        }
+        i++;
+    }
+    if (opts.desktops < 1 || opts.runs < 1 || opts.classes < 0 || opts.title_words < 0) {
+        fprintf(stderr, "--desktops and --runs must be at least 1\n");
+        return 1;
+    }
+    if (access(opts.winleap, X_OK) != 0) {
+        fprintf(stderr, "Cannot run %s; pass --winleap <path>\n", opts.winleap);
+        return 1;
+    }
+    rng_state ^= opts.seed * 0xbf58476d1ce4e5b9ULL;
+    if (rng_state == 0) rng_state = 1;
+
+    char display_name[64];
+    pid_t xvfb_pid = 0;
+    if (opts.display) {
+        snprintf(display_name, sizeof(display_name), "%s", opts.display);
+    } else {
+        xvfb_pid = start_xvfb(opts.xvfb, display_name, sizeof(display_name));
+        if (xvfb_pid < 0) return 2;
+    }
+
+    // winleap runs with a private config, state and runtime dir, so a daemon of the real
+    // session is never reached and the benchmark config cache starts empty
+    char tmp_dir[] = "/tmp/winleap-bench.XXXXXX";
+    if (!mkdtemp(tmp_dir)) {
+        perror("mkdtemp");
+        if (xvfb_pid > 0) kill(xvfb_pid, SIGTERM);
+        return 2;
+    }
+    char config_dir[PATH_MAX], state_dir[PATH_MAX], runtime_dir[PATH_MAX];
+    snprintf(config_dir, sizeof(config_dir), "%s/config", tmp_dir);
+    snprintf(state_dir, sizeof(state_dir), "%s/state", tmp_dir);
+    snprintf(runtime_dir, sizeof(runtime_dir), "%s/run", tmp_dir);
+    mkdir(config_dir, 0755);
+    mkdir(state_dir, 0755);
+    mkdir(runtime_dir, 0700);
+    setenv("DISPLAY", display_name, 1);
+    setenv("XDG_CONFIG_HOME", config_dir, 1);
+    setenv("XDG_STATE_HOME", state_dir, 1);
+    setenv("XDG_RUNTIME_DIR", runtime_dir, 1);
+    unsetenv("WAYLAND_DISPLAY");
+    unsetenv("SWAYSOCK");
+    unsetenv("HYPRLAND_INSTANCE_SIGNATURE");
+    signal(SIGPIPE, SIG_IGN);
+
+    int exit_code = 0;
+    if (!wm_start(display_name, opts.desktops)) {
+        exit_code = 2;
+    } else {
+        printf("# winleap-bench winleap=%s display=%s desktops=%d dist=%s title_words=%d runs=%d seed=%llu\n",
+               opts.winleap, display_name, opts.desktops, opts.zipf ? "zipf" : "uniform", opts.title_words,
+               opts.runs, opts.seed);
+        printf("clients\tdesktops\tmode\tpath\truns\tfail\tp50_ms\tp99_ms\tmax_ms\tconfirm_p50_ms\tconfirm_p99_ms\trt\treq\n");
+        fflush(stdout);
+        for (int i = 0; i < opts.sweep_count; i++) {
+            if (!bench_clients(&opts, display_name, config_dir, opts.sweep[i])) {
+                exit_code = 1;
+                break;
+            }
+        }
+        XCloseDisplay(wm_dpy);
+    }
+
+    if (xvfb_pid > 0) {
+        kill(xvfb_pid, SIGTERM);
+        waitpid(xvfb_pid, NULL, 0);
+    }
+    nftw(tmp_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return exit_code;
+}
@@ -0,0 +1,570 @@
+/*
+ * winleap-microbench.c - In-process benchmark of config parsing and window matching
+ *
+ * Usage:
+ *   ./winleap-microbench [--marks <n>] [--windows <n>] [--classes <k>] [--desktops <m>]
+ *                        [--seed <s>] [--min-time-ms <ms>] [--repeats <r>]
+ *                        [--baseline <file>] [--threshold <pct>]
+ *
+ * Builds winleap.c into the same binary with WINLEAP_NO_MAIN, so the functions run
+ * without a display: read_config_file on a generated config of N marks,
+ * parse_instance_keys, find_mark_slot, rebuild_class_index,
+ * find_windows_by_class_and_scope and find_windows_by_mark over a synthetic window table.
+ *
+ * Before timing, every lookup is checked against a brute-force scan of the same data; a
+ * mismatch exits 2. Each benchmark then runs until it takes --min-time-ms, --repeats times,
+ * and reports the median and its noise: the median absolute deviation, in percent of the
+ * median. Output is one tab-separated row per benchmark:
+ *   name ns_per_op noise_pct
+ * Saved output works as a --baseline for a later build. A benchmark regresses when its median
+ * got slower by more than --threshold percent plus three times the noise of both runs, and
+ * still does when measured again. The exit code is then 1.
+ */
+
+#define WINLEAP_NO_MAIN
+#include "winleap.c"
+
+#define MAX_BENCH_RESULTS 32
+#define MAX_BENCH_NAME 64
+#define MAX_REPEATS 101
+// A flagged benchmark is measured this many more times; only a slowdown seen in all counts
+#define REGRESSION_RECHECKS 2
+// Allowed slowdown on top of --threshold, in multiples of the runs' combined noise
+#define NOISE_FACTOR 3.0
+// Just over the window count, so lookups never stop at max_indices
+#define MAX_MATCHES (options.windows + 1)
+
+typedef struct {
+    int marks;
+    int windows;
+    int classes;  // 0: one per ten windows
+    int desktops;
+    unsigned long long seed;
+    int min_time_ms;
+    int repeats;
+    const char *baseline;
+    double threshold_pct;
+} BenchOptions;
+
+typedef struct {
+    char name[MAX_BENCH_NAME];
+    void (*body)(long);
+    long iterations;
+    double ns_per_op;  // median of the repeats
+    double noise_pct;  // median absolute deviation, percent of the median
+} BenchResult;
+
+// Every benchmark body adds into this, so the compiler cannot drop the calls
+static volatile long bench_sink;
+
+static BenchOptions options;
+static char config_path[MAX_PATH_LEN];
+static Config bench_config;
+static int *lookup_numbers;  // mark numbers to look up: hits and misses interleaved
+static int *matches;
+static char (*class_names)[MAX_BENCH_NAME];  // "BenchClass<k>", built before timing
+static BenchResult results[MAX_BENCH_RESULTS];
+static int num_results;
+
+// xorshift64*: deterministic for a given --seed, so runs compare across builds
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long long rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static int rng_below(int n) {
+    return (int)(rng_next() % (unsigned long long)n);
+}
+
+static int class_count(void) {
+    if (options.classes > 0) return options.classes;
+    return options.windows / 10 > 0 ? options.windows / 10 : 1;
+}
+
+// Mark number of the i-th mark; numbers are spread out so every other lookup misses
+static int mark_number(int i) {
+    return 2 * i + 1;
+}
+
+// Mostly plain class marks, as in real configs, plus literal instance rules and title regexes.
+// Rule marks past MAX_CACHED_RULES run without the per-window cache, like in winleap.
+static void format_mark(int i, char *out, size_t size) {
+    // Each run of ten marks shares a class, so every kind covers all classes in turn
+    int cls = (i / 10) % class_count();
+    switch (i % 10) {
+    case 7:
+    case 8:
+        snprintf(out, size, "%d=class:BenchClass%d instance:benchclass%d", mark_number(i), cls, cls);
+        break;
+    case 9:
+        snprintf(out, size, "%d=title:/doc%d[0-9]* - benchclass%d$/i", mark_number(i), i % 5, cls);
+        break;
+    default:
+        snprintf(out, size, "%d=BenchClass%d", mark_number(i), cls);
+        break;
+    }
+}
+
+static int write_bench_config(void) {
+    const char *tmp = getenv("TMPDIR");
+    snprintf(config_path, sizeof(config_path), "%s/winleap-microbench-XXXXXX", tmp && tmp[0] ? tmp : "/tmp");
+    int fd = mkstemp(config_path);
+    if (fd < 0) return 0;
+    FILE *f = fdopen(fd, "w");
+    if (!f) {
+        close(fd);
+        return 0;
+    }
+
+    fprintf(f, "# generated by winleap-microbench: %d marks over %d classes\n", options.marks, class_count());
+    fprintf(f, "instance_keys=%s\n", DEFAULT_INSTANCE_KEYS);
+    fprintf(f, "picker_order=recent\n");
+    char line[MAX_LINE_LEN];
+    for (int i = 0; i < options.marks; i++) {
+        format_mark(i, line, sizeof(line));
+        fprintf(f, "%s\n", line);
+    }
+    return fclose(f) == 0;
+}
+
+// Classes are zipf-distributed over the windows, which gives a few huge classes, as with
+// browsers and terminals, and a long tail of single windows
+static int fill_window_table(void) {
+    int classes = class_count();
+    double *cdf = calloc((size_t)classes, sizeof(*cdf));
+    if (!cdf) return 0;
+    double total = 0;
+    for (int k = 0; k < classes; k++) total += 1.0 / (k + 1);
+    double acc = 0;
+    for (int k = 0; k < classes; k++) {
+        acc += 1.0 / (k + 1) / total;
+        cdf[k] = acc;
+    }
+
+    table_clear(&windows);
+    for (int i = 0; i < options.windows; i++) {
+        double u = (double)(rng_next() >> 11) / (double)(1ULL << 53);
+        int cls = 0;
+        while (cls < classes - 1 && cdf[cls] < u) cls++;
+
+        WindowInfo info;
+        memset(&info, 0, sizeof(info));
+        info.id = (Window)(0x1000000 + i);
+        snprintf(info.wm_class, sizeof(info.wm_class), "BenchClass%d", cls);
+        snprintf(info.instance, sizeof(info.instance), "benchclass%d", cls);
+        snprintf(info.title, sizeof(info.title), "Doc%d - BenchClass%d", rng_below(100), cls);
+        info.desktop = rng_below(options.desktops);
+        info.loaded = FETCH_ALL;
+        if (table_append_info(&windows, &info) < 0) {
+            free(cdf);
+            return 0;
+        }
+    }
+    free(cdf);
+    return rebuild_class_index();
+}
+
+// Stress checks: the indexed lookups must agree with a plain scan before they are timed
+
+static int check_failed(const char *what, int number, int got, int want) {
+    fprintf(stderr, "Mismatch in %s for %d: got %d, want %d\n", what, number, got, want);
+    return 0;
+}
+
+static int check_marks(void) {
+    if (bench_config.num_marks != options.marks) {
+        return check_failed("read_config_file mark count", options.marks, bench_config.num_marks, options.marks);
+    }
+    for (int i = 0; i < options.marks; i++) {
+        int slot = find_mark_slot(&bench_config, mark_number(i));
+        if (slot < 0 || bench_config.marks[slot].number != mark_number(i)) {
+            return check_failed("find_mark_slot", mark_number(i), slot, i);
+        }
+        if (find_mark_slot(&bench_config, mark_number(i) + 1) >= 0) {
+            return check_failed("find_mark_slot miss", mark_number(i) + 1, 0, -1);
+        }
+    }
+    return 1;
+}
+
+static int scan_class(const char *wm_class, int current_workspace_only, long current_desktop, int *out) {
+    int count = 0;
+    for (int i = 0; i < windows.count; i++) {
+        if (strcasecmp(window_class(i), wm_class) != 0) continue;
+        if (current_workspace_only && windows.desktops[i] != current_desktop) continue;
+        out[count++] = i;
+    }
+    return count;
+}
+
+static int scan_mark(int slot, int *out) {
+    const MarkMatcher *m = &bench_config.matchers[slot];
+    int count = 0;
+    for (int i = 0; i < windows.count; i++) {
+        if (rule_matches(m, window_class(i), window_instance(i), window_title(i))) out[count++] = i;
+    }
+    return count;
+}
+
+static int same_indices(const int *a, int a_count, const int *b, int b_count) {
+    return a_count == b_count && memcmp(a, b, sizeof(*a) * (size_t)a_count) == 0;
+}
+
+static int check_matching(void) {
+    int *expected = calloc((size_t)MAX_MATCHES, sizeof(*expected));
+    if (!expected) return 0;
+
+    int ok = 1;
+    char wm_class[MAX_CLASS_LEN];
+    for (int cls = 0; cls < class_count() && ok; cls++) {
+        snprintf(wm_class, sizeof(wm_class), "benchclass%d", cls);
+        for (int scoped = 0; scoped < 2 && ok; scoped++) {
+            int want = scan_class(wm_class, scoped, 0, expected);
+            int got = find_windows_by_class_and_scope(wm_class, scoped, 0, matches, MAX_MATCHES);
+            if (!same_indices(matches, got, expected, want)) {
+                ok = check_failed(scoped ? "find_windows_by_class_and_scope (workspace)"
+                                         : "find_windows_by_class_and_scope",
+                                  cls, got, want);
+            }
+        }
+    }
+    for (int slot = 0; slot < bench_config.num_marks && ok; slot++) {
+        int want = scan_mark(slot, expected);
+        // Twice: the second run answers cached rules from the per-window bits
+        for (int pass = 0; pass < 2 && ok; pass++) {
+            int got = find_windows_by_mark(&bench_config, slot, 0, -1, matches, MAX_MATCHES);
+            if (!same_indices(matches, got, expected, want)) {
+                ok = check_failed("find_windows_by_mark", bench_config.marks[slot].number, got, want);
+            }
+        }
+    }
+    free(expected);
+    return ok;
+}
+
+// Benchmark bodies: each runs `iterations` operations
+
+static void bench_read_config(long iterations) {
+    for (long n = 0; n < iterations; n++) {
+        Config config;
+        if (!read_config_file(config_path, &config)) exit(2);
+        bench_sink += config.num_marks;
+        free_config(&config);
+    }
+}
+
+static void bench_parse_instance_keys(long iterations) {
+    static const char *inputs[] = {
+        DEFAULT_INSTANCE_KEYS,
+        "a s d f  j k l ;",
+        "Q W E R T Y U I O P   A S D F G H J K L   Z X C V B N M   1 2 3 4 5 6 7 8 9 0",
+    };
+    char out[MAX_INSTANCE_KEYS];
+    for (long n = 0; n < iterations; n++) {
+        bench_sink += parse_instance_keys(inputs[n % 3], out, sizeof(out));
+    }
+}
+
+static void bench_find_mark_slot(long iterations) {
+    int count = 2 * options.marks;
+    for (long n = 0; n < iterations; n++) {
+        bench_sink += find_mark_slot(&bench_config, lookup_numbers[n % count]);
+    }
+}
+
+static void bench_rebuild_class_index(long iterations) {
+    for (long n = 0; n < iterations; n++) {
+        class_index_dirty = 1;
+        bench_sink += rebuild_class_index();
+    }
+}
+
+static void bench_class_scope(long iterations, int current_workspace_only) {
+    int classes = class_count();
+    for (long n = 0; n < iterations; n++) {
+        bench_sink += find_windows_by_class_and_scope(class_names[n % classes], current_workspace_only,
+                                                      n % options.desktops, matches, MAX_MATCHES);
+    }
+}
+
+static void bench_class_all(long iterations) {
+    bench_class_scope(iterations, 0);
+}
+
+static void bench_class_workspace(long iterations) {
+    bench_class_scope(iterations, 1);
+}
+
+// Mark kinds repeat with period 10 in format_mark; `first` picks plain, literal rule or regex rule.
+// A cold run forgets every cached rule result first, as a config reload does.
+static void bench_mark_kind(long iterations, int first, int cold) {
+    int stride = 10;
+    int per_kind = (options.marks - first + stride - 1) / stride;
+    for (long n = 0; n < iterations; n++) {
+        int slot = first + (int)(n % per_kind) * stride;
+        if (cold) forget_rule_matches();
+        bench_sink += find_windows_by_mark(&bench_config, slot, 0, -1, matches, MAX_MATCHES);
+    }
+}
+
+static void bench_mark_plain(long iterations) {
+    bench_mark_kind(iterations, 0, 0);
+}
+
+static void bench_mark_literal_rule(long iterations) {
+    bench_mark_kind(iterations, 7, 0);
+}
+
+static void bench_mark_regex_rule(long iterations) {
+    bench_mark_kind(iterations, 9, 0);
+}
+
+static void bench_mark_regex_rule_cold(long iterations) {
+    bench_mark_kind(iterations, 9, 1);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double median_of(double *values, int count) {
+    qsort(values, (size_t)count, sizeof(*values), compare_doubles);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// Runs --repeats timed runs at the calibrated iteration count. The median and its absolute
+// deviation shrug off the odd run a busy machine slows down, unlike a mean or a minimum.
+static void measure(BenchResult *result) {
+    double samples[MAX_REPEATS];
+    for (int r = 0; r < options.repeats; r++) {
+        long long start = monotonic_ns();
+        result->body(result->iterations);
+        samples[r] = (double)(monotonic_ns() - start) / (double)result->iterations;
+    }
+    double median = median_of(samples, options.repeats);
+    for (int r = 0; r < options.repeats; r++) {
+        samples[r] = samples[r] > median ? samples[r] - median : median - samples[r];
+    }
+    double deviation = median_of(samples, options.repeats);
+
+    result->ns_per_op = median;
+    result->noise_pct = median > 0 ? deviation / median * 100.0 : 0;
+}
+
+// Doubles the iteration count until one run takes --min-time-ms, then measures at that count
+static void run_bench(const char *name, void (*body)(long)) {
+    if (num_results >= MAX_BENCH_RESULTS) return;
+    BenchResult *result = &results[num_results++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->body = body;
+
+    long long min_ns = (long long)options.min_time_ms * 1000000;
+    result->iterations = 1;
+    while (1) {
+        long long start = monotonic_ns();
+        body(result->iterations);
+        if (monotonic_ns() - start >= min_ns || result->iterations > LONG_MAX / 2) break;
+        result->iterations *= 2;
+    }
+    measure(result);
+}
+
+// Reads rows of a previous run; '#' lines and unknown names are ignored
+static int load_baseline(const char *path, BenchResult *baseline, int max) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open baseline %s\n", path);
+        return -1;
+    }
+    char line[MAX_LINE_LEN];
+    int count = 0;
+    while (count < max && fgets(line, sizeof(line), f)) {
+        if (line[0] == '#') continue;
+        char name[MAX_BENCH_NAME];
+        double ns;
+        double noise = 0;
+        if (sscanf(line, "%63s %lf %lf", name, &ns, &noise) < 2) continue;
+        snprintf(baseline[count].name, sizeof(baseline[count].name), "%s", name);
+        baseline[count].ns_per_op = ns;
+        baseline[count].noise_pct = noise;
+        count++;
+    }
+    fclose(f);
+    return count;
+}
+
+static int report(void) {
+    BenchResult baseline[MAX_BENCH_RESULTS];
+    int baseline_count = 0;
+    if (options.baseline) {
+        baseline_count = load_baseline(options.baseline, baseline, MAX_BENCH_RESULTS);
+        if (baseline_count < 0) return 2;
+    }
+
+    printf("# winleap-microbench marks=%d windows=%d classes=%d desktops=%d seed=%llu\n", options.marks,
+           options.windows, class_count(), options.desktops, options.seed);
+    printf(options.baseline ? "# name\tns_per_op\tnoise_pct\tbaseline_ns\tchange_pct\tallowed_pct\n"
+                            : "# name\tns_per_op\tnoise_pct\n");
+
+    int regressions = 0;
+    for (int i = 0; i < num_results; i++) {
+        BenchResult *result = &results[i];
+        const BenchResult *base = NULL;
+        for (int b = 0; b < baseline_count; b++) {
+            if (strcmp(baseline[b].name, result->name) == 0) base = &baseline[b];
+        }
+        if (!options.baseline) {
+            printf("%s\t%.1f\t%.1f\n", result->name, result->ns_per_op, result->noise_pct);
+            continue;
+        }
+        if (!base || base->ns_per_op <= 0) {
+            printf("%s\t%.1f\t%.1f\t-\t-\t-\n", result->name, result->ns_per_op, result->noise_pct);
+            continue;
+        }
+
+        // A slowdown has to clear the threshold plus both runs' noise, and survive re-measuring
+        double change = 0, allowed = 0;
+        int regressed = 1;
+        for (int attempt = 0; attempt <= REGRESSION_RECHECKS && regressed; attempt++) {
+            if (attempt > 0) measure(result);
+            change = (result->ns_per_op / base->ns_per_op - 1.0) * 100.0;
+            allowed = options.threshold_pct + NOISE_FACTOR * (result->noise_pct + base->noise_pct);
+            regressed = change > allowed;
+        }
+        regressions += regressed;
+        printf("%s\t%.1f\t%.1f\t%.1f\t%+.1f\t%.1f%s\n", result->name, result->ns_per_op, result->noise_pct,
+               base->ns_per_op, change, allowed, regressed ? "\tREGRESSION" : "");
+    }
+    if (regressions) {
+        fprintf(stderr, "%d benchmark(s) slower than the baseline beyond threshold and noise\n", regressions);
+        return 1;
+    }
+    return 0;
+}
+
+static void print_bench_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  --marks <n>         Marks in the generated config (default 10000)\n");
+    printf("  --windows <n>       Windows in the synthetic table (default 5000)\n");
+    printf("  --classes <k>       Window classes (default: one per ten windows)\n");
+    printf("  --desktops <m>      Desktops the windows are spread over (default 8)\n");
+    printf("  --seed <s>          Seed for the generated windows (default 1)\n");
+    printf("  --min-time-ms <ms>  Shortest timed run of one benchmark (default 50)\n");
+    printf("  --repeats <r>       Timed runs per benchmark; the median counts (default 7)\n");
+    printf("  --baseline <file>   Compare with the output of an earlier run\n");
+    printf("  --threshold <pct>   Allowed slowdown against the baseline, on top of noise (default 5)\n");
+}
+
+static int parse_positive(const char *text, int *out) {
+    char *end = NULL;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value <= 0 || value > INT_MAX / 4) return 0;
+    *out = (int)value;
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    options = (BenchOptions){
+        .marks = 10000,
+        .windows = 5000,
+        .desktops = 8,
+        .seed = 1,
+        .min_time_ms = 50,
+        .repeats = 7,
+        .threshold_pct = 5.0,
+    };
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        int ok = 1;
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            print_bench_usage(argv[0]);
+            return 0;
+        } else if (!value) {
+            ok = 0;
+        } else if (strcmp(arg, "--marks") == 0) {
+            ok = parse_positive(value, &options.marks);
+        } else if (strcmp(arg, "--windows") == 0) {
+            ok = parse_positive(value, &options.windows);
+        } else if (strcmp(arg, "--classes") == 0) {
+            ok = parse_positive(value, &options.classes);
+        } else if (strcmp(arg, "--desktops") == 0) {
+            ok = parse_positive(value, &options.desktops);
+        } else if (strcmp(arg, "--seed") == 0) {
+            options.seed = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--min-time-ms") == 0) {
+            ok = parse_positive(value, &options.min_time_ms);
+        } else if (strcmp(arg, "--repeats") == 0) {
+            ok = parse_positive(value, &options.repeats) && options.repeats <= MAX_REPEATS;
+        } else if (strcmp(arg, "--baseline") == 0) {
+            options.baseline = value;
+        } else if (strcmp(arg, "--threshold") == 0) {
+            char *end = NULL;
+            options.threshold_pct = strtod(value, &end);
+            ok = end != value && *end == '\0' && options.threshold_pct >= 0;
+        } else {
+            ok = 0;
+        }
+        if (!ok) {
+            print_bench_usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+    if (options.marks < 10) {
+        fprintf(stderr, "--marks must be at least 10, one of each rule kind\n");
+        return 2;
+    }
+    rng_state ^= options.seed * 0x9e3779b97f4a7c15ULL;
+
+    // Config errors from winleap land on stderr, next to the benchmark's own
+    out_stream = stdout;
+    err_stream = stderr;
+
+    if (!write_bench_config()) {
+        fprintf(stderr, "Cannot write the benchmark config\n");
+        return 2;
+    }
+    int loaded = read_config_file(config_path, &bench_config);
+    matches = calloc((size_t)MAX_MATCHES, sizeof(*matches));
+    lookup_numbers = calloc((size_t)options.marks * 2, sizeof(*lookup_numbers));
+    class_names = calloc((size_t)class_count(), sizeof(*class_names));
+    if (!loaded || !matches || !lookup_numbers || !class_names || !fill_window_table()) {
+        fprintf(stderr, "Cannot set up the benchmark\n");
+        unlink(config_path);
+        return 2;
+    }
+    for (int i = 0; i < options.marks * 2; i++) {
+        lookup_numbers[i] = mark_number(rng_below(options.marks)) + (i & 1);
+    }
+    for (int k = 0; k < class_count(); k++) {
+        snprintf(class_names[k], sizeof(class_names[k]), "BenchClass%d", k);
+    }
+
+    if (!check_marks() || !check_matching()) {
+        unlink(config_path);
+        return 2;
+    }
+
+    run_bench("read_config_file", bench_read_config);
+    run_bench("parse_instance_keys", bench_parse_instance_keys);
+    run_bench("find_mark_slot", bench_find_mark_slot);
+    run_bench("rebuild_class_index", bench_rebuild_class_index);
+    run_bench("find_windows_by_class_and_scope", bench_class_all);
+    run_bench("find_windows_by_class_and_scope.workspace", bench_class_workspace);
+    run_bench("find_windows_by_mark.plain", bench_mark_plain);
+    run_bench("find_windows_by_mark.literal_rule", bench_mark_literal_rule);
+    run_bench("find_windows_by_mark.regex_rule", bench_mark_regex_rule);
+    run_bench("find_windows_by_mark.regex_rule_cold", bench_mark_regex_rule_cold);
+
+    unlink(config_path);
+    free_config(&bench_config);
+    return report();
+}
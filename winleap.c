@@ -2,97 +2,970 @@
  * winleap.c - Mark-based window jump with explicit instance selection
  *
  * Usage:
- *   ./winleap [--config <path>] [--current-workspace] [--current-application] [--debug] <number>
+ *   ./winleap [--config <path>] [--current-workspace] [--current-application] [--recent] [--debug] [--no-daemon] <number>
+ *   ./winleap --back [--current-workspace]
+ *   ./winleap --search [--current-workspace]
+ *   ./winleap --list [--current-workspace] [--no-daemon]
+ *   ./winleap --stats
+ *   ./winleap --daemon [--config <path>] [--debug]
+ *   ./winleap --batch [--config <path>] [--confirm] [--trace] [--debug] < commands
  *   ./winleap --help
  *   ./winleap --open-debug
  *
+ * Daemon mode (--daemon, or running the binary as "winleapd") keeps the display,
+ * config and atoms alive and serves jump requests over a Unix domain socket.
+ * Plain invocations try the daemon first and fall back to doing the work locally.
+ *
  * Config supports:
  *   <number>=<wm_class>
+ *   <number>=[class:<pattern>] [instance:<pattern>] [title:<pattern>]  (pattern: literal or /regex/[i])
  *   instance_keys=<ordered selector chars>
  *   debug=<true|false|1|0|yes|no>
+ *   desktop_switch_timeout_ms=<0-10000>
+ *   confirm_activation=<true|false|1|0|yes|no>
+ *   activation_timeout_ms=<0-10000>
+ *   trace=<true|false|1|0|yes|no>
+ *   picker_order=<recent|list>
+ *   backend=<auto|x11|sway|hyprland>
+ *   metrics_textfile=<path>  (daemon only)
+ *   picker_hints=<true|false|1|0|yes|no>
+ *   picker_thumbnails=<true|false|1|0|yes|no>  (daemon, WINLEAP_THUMBNAILS builds)
+ *   hotkey[.workspace|.application|.recent].<number>=<modifiers+keysym>  (daemon only)
+ *   hotkey.back=<modifiers+keysym>  (daemon only)
+ *   hotkey[.workspace].search=<modifiers+keysym>  (daemon only)
+ *   exec.<number>=<command>
+ *   launch_timeout_ms=<0-10000>
  */
 
+#define _GNU_SOURCE
+
+#include <X11/XKBlib.h>
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
+#include <X11/Xproto.h>
 #include <X11/Xutil.h>
 #include <X11/keysym.h>
+#ifdef WINLEAP_XCB
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+#endif
+#ifdef WINLEAP_THUMBNAILS
+#include <X11/extensions/Xcomposite.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xrender.h>
+#endif
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
+#include <regex.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
-#define MAX_WINDOWS 256
 #define MAX_CLASS_LEN 256
 #define MAX_TITLE_LEN 512
+// First-read sizes in 32-bit units: instance + class usually fit, titles are cut at MAX_TITLE_LEN
+#define WM_CLASS_FETCH_LONGS (2 * MAX_CLASS_LEN / 4)
+#define TITLE_FETCH_LONGS (MAX_TITLE_LEN / 4)
+#define CLIENT_LIST_FETCH_LONGS 1024
 #define MAX_LINE_LEN 512
-#define MAX_MARKS 100
+#define MAX_RULE_TEXT_LEN (2 * MAX_CLASS_LEN + MAX_TITLE_LEN + 32)
 #define MAX_INSTANCE_KEYS 128
+#define MAX_HOTKEYS 64
+#define MAX_HOTKEY_SPEC_LEN 64
+#define MAX_LAUNCH_COMMANDS 32
 #define MAX_PATH_LEN 1024
+#define MAX_REQUEST_LEN 512
+#define MAX_QUEUED_REQUESTS 32
+// A connection that has not sent its request line by then is dropped
+#define REQUEST_READ_TIMEOUT_MS 1000
+// Rule marks past this many are matched without the per-window result cache
+#define MAX_CACHED_RULES 64
+#define GRAB_WAIT_MS 1000
+#define GRAB_RETRY_INITIAL_MS 10
+// Presses of a held key closer together than this are auto-repeat, even if a release was missed
+#define KEY_REPEAT_WINDOW_MS 1000
+#define MAX_LOG_LINE_LEN 2048
+
+#define LOG_BUFFER_SIZE (64 * 1024)
+#define DEBUG_LOG_MAX_BYTES (1024 * 1024)
 
 #define DEFAULT_INSTANCE_KEYS "qwertyuiopasdfghjklzxcvbnm1234567890"
+#define DEFAULT_DESKTOP_SWITCH_TIMEOUT_MS 200
+#define DEFAULT_ACTIVATION_TIMEOUT_MS 500
+#define DEFAULT_LAUNCH_TIMEOUT_MS 5000
+#define MAX_TIMEOUT_MS 10000
 
-// Debug logging
-static FILE *logfile = NULL;
+// Exit code when --confirm is set and focus did not reach the target in time, or when a
+// launched command opened no matching window within launch_timeout_ms
+#define EXIT_ACTIVATION_TIMEOUT 3
+
+// Debug logging: lines collect in memory and reach debug.log in large writes
+static int log_fd = -1;
 static int debug_enabled = 0;
+static char log_path[MAX_PATH_LEN];
+static char log_buffer[LOG_BUFFER_SIZE];
+static size_t log_used = 0;
+static off_t log_file_size = 0;
+static time_t log_stamp_second = -1;
+static char log_stamp[32];
+
+// User-facing output; the daemon points these at per-request buffers
+static FILE *out_stream = NULL;
+static FILE *err_stream = NULL;
+
+// Keep one previous generation as debug.log.1 once the cap is reached
+void log_rotate(void) {
+    if (log_fd < 0) return;
+
+    char old_path[MAX_PATH_LEN + 2];
+    snprintf(old_path, sizeof(old_path), "%s.1", log_path);
+    close(log_fd);
+    rename(log_path, old_path);
+    log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    log_file_size = 0;
+}
+
+void log_flush(void) {
+    if (log_fd < 0 || log_used == 0) return;
+
+    size_t off = 0;
+    while (off < log_used) {
+        ssize_t n = write(log_fd, log_buffer + off, log_used - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        off += (size_t)n;
+    }
+    log_file_size += (off_t)off;
+    log_used = 0;
+
+    if (log_file_size >= DEBUG_LOG_MAX_BYTES) log_rotate();
+}
+
+void log_close(void) {
+    log_flush();
+    if (log_fd >= 0) close(log_fd);
+    log_fd = -1;
+}
+
+static void log_append(const char *data, size_t len) {
+    if (log_used + len > sizeof(log_buffer)) log_flush();
+    if (len > sizeof(log_buffer)) len = sizeof(log_buffer);
+    memcpy(log_buffer + log_used, data, len);
+    log_used += len;
+}
+
+// localtime_r() only runs when the wall-clock second changes
+static const char *log_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    if (ts.tv_sec != log_stamp_second) {
+        struct tm t;
+        localtime_r(&ts.tv_sec, &t);
+        strftime(log_stamp, sizeof(log_stamp), "[%Y-%m-%d %H:%M:%S] ", &t);
+        log_stamp_second = ts.tv_sec;
+    }
+    return log_stamp;
+}
 
 void log_msg(const char *fmt, ...) {
-    if (!debug_enabled || !logfile) return;
+    if (!debug_enabled || log_fd < 0) return;
 
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    fprintf(logfile, "[%04d-%02d-%02d %02d:%02d:%02d] ",
-            t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-            t->tm_hour, t->tm_min, t->tm_sec);
+    char line[MAX_LOG_LINE_LEN];
+    int len = snprintf(line, sizeof(line), "%s", log_timestamp());
 
     va_list args;
     va_start(args, fmt);
-    vfprintf(logfile, fmt, args);
+    int n = vsnprintf(line + len, sizeof(line) - (size_t)len - 1, fmt, args);
     va_end(args);
 
-    fprintf(logfile, "\n");
-    fflush(logfile);
+    if (n < 0) n = 0;
+    len += n;
+    if ((size_t)len > sizeof(line) - 2) len = (int)sizeof(line) - 2;
+    line[len++] = '\n';
+    log_append(line, (size_t)len);
 }
 
 void log_section(const char *title) {
-    if (!debug_enabled || !logfile) return;
-    fprintf(logfile, "\n========================================\n");
-    fprintf(logfile, "%s\n", title);
-    fprintf(logfile, "========================================\n");
-    fflush(logfile);
+    if (!debug_enabled || log_fd < 0) return;
+
+    char line[MAX_LOG_LINE_LEN];
+    int len = snprintf(line, sizeof(line),
+                       "\n========================================\n"
+                       "%s\n"
+                       "========================================\n", title);
+    if (len < 0) return;
+    if ((size_t)len >= sizeof(line)) len = (int)sizeof(line) - 1;
+    log_append(line, (size_t)len);
 }
 
+// Optional window properties; WM_CLASS is always fetched since matching needs it
+#define FETCH_DESKTOP (1u << 0)
+#define FETCH_TITLE (1u << 1)
+#define FETCH_ALL (FETCH_DESKTOP | FETCH_TITLE)
+
+// Staging record for property fetches; the window table itself stores the strings in an arena
 typedef struct {
     Window id;
     char wm_class[MAX_CLASS_LEN];
+    char instance[MAX_CLASS_LEN];
     char title[MAX_TITLE_LEN];
     long desktop;
+    unsigned loaded;  // FETCH_* bits actually read for this window
 } WindowInfo;
 
+// A mark is a rule over WM_CLASS (class and instance halves) and the title. Each field holds
+// its pattern source, "" for any: a literal compares equal ignoring case, /re/ or /re/i is a
+// POSIX extended regex. A plain "3=obsidian" line only sets the class.
 typedef struct {
     int number;
+    int line;  // config line, for duplicate reports
     char wm_class[MAX_CLASS_LEN];
+    char instance[MAX_CLASS_LEN];
+    char title[MAX_TITLE_LEN];
 } MarkMapping;
 
+enum { MATCH_ANY, MATCH_EXACT, MATCH_PREFIX, MATCH_SUBSTRING, MATCH_REGEX };
+
+// Compiled form of one pattern: regexes that are just a literal, or ^ and a literal,
+// become string compares instead of regexec()
+typedef struct {
+    int kind;
+    int icase;
+    char *needle;  // EXACT/PREFIX/SUBSTRING text
+    size_t len;
+    regex_t regex;
+} FieldMatcher;
+
+typedef struct {
+    FieldMatcher class_match;
+    FieldMatcher instance_match;
+    FieldMatcher title_match;
+    int cache_bit;  // bit in the per-window match cache, -1 when results are not cached
+} MarkMatcher;
+
+// hotkey[.workspace|.application|.recent].<number>=<modifiers+key>, hotkey.back=<...> and
+// hotkey[.workspace].search=<...>, grabbed by the daemon
+typedef struct {
+    int number;
+    int current_workspace_only;
+    int current_application_mode;
+    int most_recent;
+    int back;
+    int search;
+    unsigned int modifiers;
+    KeySym keysym;
+    char spec[MAX_HOTKEY_SPEC_LEN];
+} Hotkey;
+
+// exec.<number>=<command>: run through /bin/sh when the mark has no window
+typedef struct {
+    int number;
+    int line;
+    char command[MAX_LINE_LEN];
+} LaunchCommand;
+
+// backend=: auto picks sway or Hyprland from their environment variables, X11 otherwise
+enum { BACKEND_AUTO, BACKEND_X11, BACKEND_SWAY, BACKEND_HYPRLAND };
+
 typedef struct {
-    MarkMapping marks[MAX_MARKS];
+    MarkMapping *marks;  // file order, grown on demand
     int num_marks;
+    int marks_capacity;
+    int *mark_index;  // open-addressing hash: mark number -> marks[] slot, -1 when empty
+    unsigned mark_index_mask;
+    void *cache_map;  // when loaded from the config cache, marks and mark_index point into it
+    size_t cache_map_size;
+    MarkMatcher *matchers;  // parallel to marks; compiled after every load, never cached
+
+    Hotkey hotkeys[MAX_HOTKEYS];
+    int num_hotkeys;
+    LaunchCommand launches[MAX_LAUNCH_COMMANDS];
+    int num_launches;
+    int launch_timeout_ms;  // how long a launched command has to map a matching window
     char instance_keys[MAX_INSTANCE_KEYS];
     int debug;
+    int desktop_switch_timeout_ms;
+    int confirm_activation;
+    int activation_timeout_ms;
+    int trace;
+    int picker_recent_first;  // picker_order=recent: most recently focused window gets the first key
+    int picker_hints;         // draw each candidate's selector key over it while the picker runs
+    int picker_thumbnails;    // daemon: list off-screen candidates with a cached thumbnail
+    int backend;              // BACKEND_*
+    char metrics_textfile[MAX_PATH_LEN];  // daemon: Prometheus textfile kept current, empty for none
 } Config;
 
+typedef struct {
+    int number;
+    int current_workspace_only;
+    int current_application_mode;
+    int most_recent;  // several matches: take the most recently focused one, no picker
+    int back;         // no mark: return to the previously focused window
+    int search;       // no mark: pick any window by typing part of its class or title
+    int debug;
+    int confirm;
+    int trace;
+    long long start_ns;  // CLOCK_MONOTONIC when the invoking process started
+} JumpRequest;
+
 // Global state
 static Display *display;
 static Window root;
-static WindowInfo windows[MAX_WINDOWS];
-static int num_windows = 0;
+
+// Window table, structure-of-arrays: the fields matching and activation read sit in tight
+// parallel arrays, while class and title text lives in a per-table string arena. Strings are
+// stored NUL-terminated with some slack, so most title changes are rewritten in place.
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+    uint32_t cap;
+} ArenaString;
+
+typedef struct {
+    int count;
+    int capacity;
+    Window *ids;
+    long *desktops;
+    unsigned *loaded;     // FETCH_* bits actually read for each window
+    int *class_ids;       // interned class, assigned by rebuild_class_index()
+    int *bucket_next;     // next window in the same (desktop, class) bucket, -1 at the end
+    uint64_t *focus_seq;  // focus_clock when the window was last active, 0 if never seen active
+    uint64_t *rule_known;  // per-window rule cache: bit b set once MarkMatcher cache_bit b ran
+    uint64_t *rule_hits;   // ... and its result; cleared when the window's class or title changes
+    ArenaString *class_refs;
+    ArenaString *instance_refs;
+    ArenaString *title_refs;
+    char *arena;
+    size_t arena_used;
+    size_t arena_capacity;
+    size_t arena_garbage;  // bytes left behind by strings that outgrew their slot
+} WindowTable;
+
+static WindowTable windows;
+
+#define INITIAL_WINDOW_CAPACITY 64
+
+int table_reserve(WindowTable *t, int needed) {
+    if (needed <= t->capacity) return 1;
+
+    int capacity = t->capacity ? t->capacity : INITIAL_WINDOW_CAPACITY;
+    while (capacity < needed) capacity *= 2;
+
+#define GROW(field)                                                                    \
+    do {                                                                               \
+        void *grown = realloc(t->field, sizeof(*t->field) * (size_t)capacity);         \
+        if (!grown) return 0;                                                          \
+        t->field = grown;                                                              \
+    } while (0)
+    GROW(ids);
+    GROW(desktops);
+    GROW(loaded);
+    GROW(class_ids);
+    GROW(bucket_next);
+    GROW(focus_seq);
+    GROW(rule_known);
+    GROW(rule_hits);
+    GROW(class_refs);
+    GROW(instance_refs);
+    GROW(title_refs);
+#undef GROW
+
+    t->capacity = capacity;
+    return 1;
+}
+
+void table_clear(WindowTable *t) {
+    t->count = 0;
+    t->arena_used = 0;
+    t->arena_garbage = 0;
+}
+
+static int table_store_string(WindowTable *t, ArenaString *ref, const char *s, size_t len) {
+    if (len + 1 > ref->cap) {
+        // Slack for the next, slightly longer title; strings are 8-byte aligned
+        size_t cap = (len + 1 + 16 + 7) & ~(size_t)7;
+        if (t->arena_used + cap > t->arena_capacity) {
+            size_t arena_capacity = t->arena_capacity ? t->arena_capacity : 16384;
+            while (arena_capacity < t->arena_used + cap) arena_capacity *= 2;
+            char *arena = realloc(t->arena, arena_capacity);
+            if (!arena) return 0;
+            t->arena = arena;
+            t->arena_capacity = arena_capacity;
+        }
+        t->arena_garbage += ref->cap;
+        ref->offset = (uint32_t)t->arena_used;
+        ref->cap = (uint32_t)cap;
+        t->arena_used += cap;
+    }
+    memcpy(t->arena + ref->offset, s, len);
+    t->arena[ref->offset + len] = '\0';
+    ref->len = (uint32_t)len;
+    return 1;
+}
+
+// Both pointers stay valid until the next string store into the same table
+static inline const char *table_class(const WindowTable *t, int i) {
+    return t->class_refs[i].cap ? t->arena + t->class_refs[i].offset : "";
+}
+
+static inline const char *table_instance(const WindowTable *t, int i) {
+    return t->instance_refs[i].cap ? t->arena + t->instance_refs[i].offset : "";
+}
+
+static inline const char *table_title(const WindowTable *t, int i) {
+    return t->title_refs[i].cap ? t->arena + t->title_refs[i].offset : "";
+}
+
+static inline const char *window_class(int i) {
+    return table_class(&windows, i);
+}
+
+static inline const char *window_instance(int i) {
+    return table_instance(&windows, i);
+}
+
+static inline const char *window_title(int i) {
+    return table_title(&windows, i);
+}
+
+// Rule results depend on these strings, so storing any of them forgets the cached matches
+int table_set_class(WindowTable *t, int i, const char *wm_class) {
+    t->rule_known[i] = 0;
+    return table_store_string(t, &t->class_refs[i], wm_class, strlen(wm_class));
+}
+
+int table_set_instance(WindowTable *t, int i, const char *instance) {
+    t->rule_known[i] = 0;
+    return table_store_string(t, &t->instance_refs[i], instance, strlen(instance));
+}
+
+int table_set_title(WindowTable *t, int i, const char *title) {
+    t->rule_known[i] = 0;
+    return table_store_string(t, &t->title_refs[i], title, strlen(title));
+}
+
+// Appends an empty row for `id` and returns its index, or -1 when out of memory
+int table_append(WindowTable *t, Window id) {
+    if (!table_reserve(t, t->count + 1)) return -1;
+    int i = t->count++;
+    t->ids[i] = id;
+    t->desktops[i] = -1;
+    t->loaded[i] = 0;
+    t->class_ids[i] = -1;
+    t->bucket_next[i] = -1;
+    t->focus_seq[i] = 0;
+    t->rule_known[i] = 0;
+    t->rule_hits[i] = 0;
+    t->class_refs[i] = (ArenaString){0, 0, 0};
+    t->instance_refs[i] = (ArenaString){0, 0, 0};
+    t->title_refs[i] = (ArenaString){0, 0, 0};
+    return i;
+}
+
+int table_set_info(WindowTable *t, int i, const WindowInfo *info) {
+    t->ids[i] = info->id;
+    t->desktops[i] = info->desktop;
+    t->loaded[i] = info->loaded;
+    return table_set_class(t, i, info->wm_class) && table_set_instance(t, i, info->instance) &&
+           table_set_title(t, i, info->title);
+}
+
+int table_append_info(WindowTable *t, const WindowInfo *info) {
+    int i = table_append(t, info->id);
+    return i >= 0 && table_set_info(t, i, info) ? i : -1;
+}
+
+int table_append_row(WindowTable *t, const WindowTable *src, int j) {
+    int i = table_append(t, src->ids[j]);
+    if (i < 0) return -1;
+    t->desktops[i] = src->desktops[j];
+    t->loaded[i] = src->loaded[j];
+    t->focus_seq[i] = src->focus_seq[j];
+    if (!table_set_class(t, i, table_class(src, j)) || !table_set_instance(t, i, table_instance(src, j)) ||
+        !table_set_title(t, i, table_title(src, j))) {
+        return -1;
+    }
+    t->rule_known[i] = src->rule_known[j];
+    t->rule_hits[i] = src->rule_hits[j];
+    return i;
+}
+
+void table_swap(WindowTable *a, WindowTable *b) {
+    WindowTable tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+// Class index over the window table: classes are interned case-insensitively, and each class
+// keeps its windows in table order, so matching a mark is one hash lookup instead of a scan
+typedef struct {
+    uint32_t hash;
+    int representative;  // window whose wm_class names the class
+    int first;           // offset of this class's run in class_windows
+    int count;
+} ClassEntry;
+
+static ClassEntry *classes = NULL;
+static int num_classes = 0;
+static int *class_slots = NULL;
+static unsigned class_slot_mask = 0;
+static int *class_windows = NULL;
+static int *class_fill = NULL;
+static int class_index_capacity = 0;
+static int class_index_dirty = 1;
+
+// (desktop, class) buckets for --current-workspace: each holds its windows as a list in table
+// order. Rebuilt with the class index, and patched in place when a window changes desktop.
+typedef struct {
+    long desktop;
+    int class_id;  // -1 marks an unused slot
+    int head;
+} DesktopBucket;
+
+static DesktopBucket *desktop_buckets = NULL;
+static unsigned desktop_bucket_mask = 0;
+static int desktop_buckets_used = 0;
+
+static uint32_t class_hash(const char *name) {
+    uint32_t hash = 2166136261u;  // FNV-1a over the lowercased name
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        hash ^= (uint32_t)tolower(*p);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Sizes every index array for `count` windows; hash tables stay at most half full
+static int reserve_class_index(int count) {
+    if (count <= class_index_capacity && class_slots) return 1;
+
+    int capacity = class_index_capacity ? class_index_capacity : INITIAL_WINDOW_CAPACITY;
+    while (capacity < count) capacity *= 2;
+    size_t slots = (size_t)capacity * 2;
+
+    ClassEntry *new_classes = realloc(classes, sizeof(*classes) * (size_t)capacity);
+    if (new_classes) classes = new_classes;
+    int *new_windows = realloc(class_windows, sizeof(*class_windows) * (size_t)capacity);
+    if (new_windows) class_windows = new_windows;
+    int *new_fill = realloc(class_fill, sizeof(*class_fill) * (size_t)capacity);
+    if (new_fill) class_fill = new_fill;
+    int *new_slots = realloc(class_slots, sizeof(*class_slots) * slots);
+    if (new_slots) class_slots = new_slots;
+    DesktopBucket *new_buckets = realloc(desktop_buckets, sizeof(*desktop_buckets) * slots);
+    if (new_buckets) desktop_buckets = new_buckets;
+    if (!new_classes || !new_windows || !new_fill || !new_slots || !new_buckets) return 0;
+
+    class_index_capacity = capacity;
+    class_slot_mask = (unsigned)(slots - 1);
+    desktop_bucket_mask = (unsigned)(slots - 1);
+    return 1;
+}
+
+// Returns the slot holding the class, or the empty slot where it would go
+static int class_slot_for(const char *name, uint32_t hash) {
+    unsigned slot = hash & class_slot_mask;
+    while (class_slots[slot] >= 0) {
+        const ClassEntry *entry = &classes[class_slots[slot]];
+        if (entry->hash == hash && strcasecmp(window_class(entry->representative), name) == 0) {
+            break;
+        }
+        slot = (slot + 1) & class_slot_mask;
+    }
+    return (int)slot;
+}
+
+// Returns the bucket slot, creating it when asked; -1 when absent or the table is too full
+static int desktop_bucket_slot(long desktop, int class_id, int create) {
+    if (!desktop_buckets) return -1;
+
+    uint32_t hash = ((uint32_t)desktop * 31u + (uint32_t)class_id) * 2654435761u;
+    unsigned slot = hash & desktop_bucket_mask;
+    while (desktop_buckets[slot].class_id >= 0) {
+        if (desktop_buckets[slot].class_id == class_id && desktop_buckets[slot].desktop == desktop) {
+            return (int)slot;
+        }
+        slot = (slot + 1) & desktop_bucket_mask;
+    }
+    if (!create || (unsigned)desktop_buckets_used >= (desktop_bucket_mask + 1) * 3 / 4) return -1;
+
+    desktop_buckets[slot] = (DesktopBucket){desktop, class_id, -1};
+    desktop_buckets_used++;
+    return (int)slot;
+}
+
+static void clear_desktop_buckets(void) {
+    for (unsigned i = 0; i <= desktop_bucket_mask; i++) desktop_buckets[i].class_id = -1;
+    desktop_buckets_used = 0;
+}
+
+int rebuild_class_index(void) {
+    if (!reserve_class_index(windows.count)) return 0;
+
+    memset(class_slots, 0xff, sizeof(*class_slots) * ((size_t)class_slot_mask + 1));
+    num_classes = 0;
+
+    for (int i = 0; i < windows.count; i++) {
+        windows.class_ids[i] = -1;
+        const char *wm_class = window_class(i);
+        if (wm_class[0] == '\0') continue;
+
+        uint32_t hash = class_hash(wm_class);
+        int slot = class_slot_for(wm_class, hash);
+        if (class_slots[slot] < 0) {
+            classes[num_classes] = (ClassEntry){hash, i, 0, 0};
+            class_slots[slot] = num_classes++;
+        }
+        windows.class_ids[i] = class_slots[slot];
+        classes[windows.class_ids[i]].count++;
+    }
+
+    int offset = 0;
+    for (int c = 0; c < num_classes; c++) {
+        classes[c].first = offset;
+        class_fill[c] = offset;
+        offset += classes[c].count;
+    }
+    for (int i = 0; i < windows.count; i++) {
+        if (windows.class_ids[i] >= 0) {
+            class_windows[class_fill[windows.class_ids[i]]++] = i;
+        }
+    }
+
+    // Pushing from the back leaves every bucket list in ascending table order
+    clear_desktop_buckets();
+    for (int i = windows.count - 1; i >= 0; i--) {
+        windows.bucket_next[i] = -1;
+        if (windows.class_ids[i] < 0) continue;
+        int slot = desktop_bucket_slot(windows.desktops[i], windows.class_ids[i], 1);
+        if (slot < 0) continue;  // cannot happen: slots outnumber windows
+        windows.bucket_next[i] = desktop_buckets[slot].head;
+        desktop_buckets[slot].head = i;
+    }
+    class_index_dirty = 0;
+    return 1;
+}
+
+// Emptied buckets stay allocated until the next rebuild, which keeps removal probe-safe
+void move_desktop_bucket(int idx, long old_desktop) {
+    int class_id = windows.class_ids[idx];
+    if (class_index_dirty || class_id < 0) return;
+
+    int slot = desktop_bucket_slot(old_desktop, class_id, 0);
+    if (slot >= 0) {
+        int *link = &desktop_buckets[slot].head;
+        while (*link >= 0 && *link != idx) link = &windows.bucket_next[*link];
+        if (*link == idx) *link = windows.bucket_next[idx];
+    }
+
+    slot = desktop_bucket_slot(windows.desktops[idx], class_id, 1);
+    if (slot < 0) {
+        class_index_dirty = 1;
+        return;
+    }
+    int *link = &desktop_buckets[slot].head;
+    while (*link >= 0 && *link < idx) link = &windows.bucket_next[*link];
+    windows.bucket_next[idx] = *link;
+    *link = idx;
+}
+
+int find_class_id(const char *name) {
+    if (class_index_dirty && !rebuild_class_index()) return -1;
+    int slot = class_slot_for(name, class_hash(name));
+    return class_slots[slot];
+}
+
+// Phase tracing (--trace / trace=true): spans are always recorded, printed only when enabled
+#define MAX_TRACE_SPANS 1024
+
+typedef struct {
+    const char *phase;
+    unsigned long wid;
+    long long start_ns;
+    long long duration_ns;
+    unsigned long round_trips;
+    unsigned long requests;
+} TraceSpan;
+
+typedef struct {
+    long long start_ns;
+    unsigned long round_trips;
+    unsigned long requests;
+} TraceMark;
+
+static TraceSpan trace_spans[MAX_TRACE_SPANS];
+static int trace_span_count = 0;
+static int trace_spans_dropped = 0;
+static unsigned long trace_round_trips = 0;
+
+long long monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static unsigned long trace_request_count(void) {
+    return display ? XNextRequest(display) : 0;
+}
+
+TraceMark trace_begin(void) {
+    TraceMark mark = {monotonic_ns(), trace_round_trips, trace_request_count()};
+    return mark;
+}
+
+void trace_end(const TraceMark *mark, const char *phase, unsigned long wid) {
+    if (trace_span_count >= MAX_TRACE_SPANS) {
+        trace_spans_dropped++;
+        return;
+    }
+    TraceSpan *span = &trace_spans[trace_span_count++];
+    span->phase = phase;
+    span->wid = wid;
+    span->start_ns = mark->start_ns;
+    span->duration_ns = monotonic_ns() - mark->start_ns;
+    span->round_trips = trace_round_trips - mark->round_trips;
+    // XNextRequest is meaningless across XOpenDisplay/XCloseDisplay
+    unsigned long requests = trace_request_count();
+    span->requests = requests >= mark->requests ? requests - mark->requests : 0;
+}
+
+void trace_reset(void) {
+    trace_span_count = 0;
+    trace_spans_dropped = 0;
+}
+
+// One line per span: trace phase=<name> [wid=<id>] at_us=<offset> us=<duration> rt=<round trips> req=<requests>
+void trace_emit(FILE *out, long long origin_ns) {
+    for (int i = 0; i < trace_span_count; i++) {
+        const TraceSpan *span = &trace_spans[i];
+        fprintf(out, "trace phase=%s", span->phase);
+        if (span->wid) fprintf(out, " wid=%lu", span->wid);
+        fprintf(out, " at_us=%.1f us=%.1f rt=%lu req=%lu\n",
+                (double)(span->start_ns - origin_ns) / 1e3,
+                (double)span->duration_ns / 1e3,
+                span->round_trips,
+                span->requests);
+    }
+    if (trace_spans_dropped > 0) {
+        fprintf(out, "trace dropped=%d\n", trace_spans_dropped);
+    }
+}
+
+// Daemon metrics (winleap --stats, metrics_textfile=). Only the daemon's single thread
+// touches them, so they are plain counters: no locks, no atomics.
+//
+// Latency histograms are log-linear like HdrHistogram: every microsecond below 32 us has its
+// own bucket and each power of two above is split into 16, so a bucket is at most 1/16 wide.
+// 528 fixed buckets reach about 19 hours.
+#define HIST_SUB_BUCKETS 16
+#define HIST_BUCKETS (HIST_SUB_BUCKETS * 33)
+#define METRICS_WRITE_INTERVAL_MS 1000
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum_us;
+} LatencyHistogram;
+
+enum { JUMP_MARK, JUMP_RECENT, JUMP_APPLICATION, JUMP_BACK, JUMP_SEARCH, JUMP_MODES };
+static const char *const jump_mode_labels[JUMP_MODES] = { "mark", "recent", "application", "back", "search" };
+// Indexed by exit code
+static const char *const jump_result_labels[] = { "ok", "failed", "error", "timeout" };
+
+typedef struct {
+    long long start_ns;
+    uint64_t jumps[JUMP_MODES];
+    uint64_t results[4];
+    uint64_t hotkey_jumps;
+    uint64_t coalesced_requests;
+    uint64_t invalid_requests;
+    uint64_t picker_shown;
+    uint64_t picker_cancelled;  // Escape
+    uint64_t picker_superseded;
+    uint64_t keyboard_grab_failures;
+    uint64_t hotkey_grab_failures;
+    uint64_t launches;
+    uint64_t config_reloads;
+    uint64_t events;  // window table updates: PropertyNotify or compositor events
+    // Jumps that opened no picker and launched nothing, so no human or program is timed
+    LatencyHistogram jump_latency;     // invocation to reply
+    LatencyHistogram confirm_latency;  // invocation to confirmed focus
+} Metrics;
+
+static Metrics metrics;
+static int metrics_dirty = 1;
+// Set when the request being served waits on a picker or a launched command
+static int metrics_request_waited = 0;
+
+static int hist_bucket(uint64_t us) {
+    if (us < 2 * HIST_SUB_BUCKETS) return (int)us;
+    int shift = 63 - __builtin_clzll(us) - 4;
+    int idx = (shift + 1) * HIST_SUB_BUCKETS + (int)(us >> shift) - HIST_SUB_BUCKETS;
+    return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+// Highest value that lands in the bucket
+static uint64_t hist_bucket_max(int idx) {
+    if (idx < 2 * HIST_SUB_BUCKETS) return (uint64_t)idx;
+    int shift = idx / HIST_SUB_BUCKETS - 1;
+    uint64_t low = (uint64_t)(HIST_SUB_BUCKETS + idx % HIST_SUB_BUCKETS) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+void hist_record(LatencyHistogram *h, long long ns) {
+    uint64_t us = ns > 0 ? (uint64_t)(ns / 1000) : 0;
+    h->counts[hist_bucket(us)]++;
+    h->total++;
+    h->sum_us += us;
+}
+
+static int jump_mode_metric(const JumpRequest *req) {
+    if (req->back) return JUMP_BACK;
+    if (req->search) return JUMP_SEARCH;
+    if (req->current_application_mode) return JUMP_APPLICATION;
+    return req->most_recent ? JUMP_RECENT : JUMP_MARK;
+}
+
+void metrics_record_jump(const JumpRequest *req, int exit_code) {
+    metrics.jumps[jump_mode_metric(req)]++;
+    if (exit_code >= 0 && exit_code < 4) metrics.results[exit_code]++;
+    if (exit_code == 0 && !metrics_request_waited) {
+        hist_record(&metrics.jump_latency, monotonic_ns() - req->start_ns);
+    }
+    metrics_dirty = 1;
+}
+
+static void print_counter(FILE *out, const char *name, const char *help, uint64_t value) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name,
+            (unsigned long long)value);
+}
+
+// Exported as a cumulative Prometheus histogram, so rate() over any window gives recent
+// quantiles. The log-linear buckets are collapsed onto fixed bounds: a bucket counts towards
+// the first bound at or above its highest value, so a bucket straddling a bound only shows up
+// one bound later and histogram_quantile() errs high, never low.
+static void print_latency(FILE *out, const char *name, const char *help, const LatencyHistogram *h) {
+    static const uint64_t bounds_us[] = {
+        100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+        1000000, 2500000, 5000000, 10000000,
+    };
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    uint64_t cumulative = 0;
+    int bucket = 0;
+    for (size_t b = 0; b < sizeof(bounds_us) / sizeof(bounds_us[0]); b++) {
+        while (bucket < HIST_BUCKETS && hist_bucket_max(bucket) <= bounds_us[b]) cumulative += h->counts[bucket++];
+        fprintf(out, "%s_bucket{le=\"%g\"} %llu\n", name, (double)bounds_us[b] / 1e6,
+                (unsigned long long)cumulative);
+    }
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)h->total);
+    fprintf(out, "%s_sum %.6f\n%s_count %llu\n", name, (double)h->sum_us / 1e6, name,
+            (unsigned long long)h->total);
+}
+
+// Prometheus text exposition format, for --stats and the node_exporter textfile alike
+void print_metrics(FILE *out) {
+    fprintf(out, "# HELP winleap_jumps_total Jumps served, by mode\n# TYPE winleap_jumps_total counter\n");
+    for (int i = 0; i < JUMP_MODES; i++) {
+        fprintf(out, "winleap_jumps_total{mode=\"%s\"} %llu\n", jump_mode_labels[i],
+                (unsigned long long)metrics.jumps[i]);
+    }
+    fprintf(out, "# HELP winleap_jump_results_total Jumps served, by outcome (exit code 0-3)\n"
+                 "# TYPE winleap_jump_results_total counter\n");
+    for (int i = 0; i < 4; i++) {
+        fprintf(out, "winleap_jump_results_total{result=\"%s\"} %llu\n", jump_result_labels[i],
+                (unsigned long long)metrics.results[i]);
+    }
+    print_counter(out, "winleap_hotkey_jumps_total", "Jumps started by a grabbed hotkey", metrics.hotkey_jumps);
+    print_counter(out, "winleap_coalesced_requests_total", "Requests answered with an identical request's reply",
+                  metrics.coalesced_requests);
+    print_counter(out, "winleap_invalid_requests_total", "Requests the daemon could not parse", metrics.invalid_requests);
+    print_counter(out, "winleap_picker_invocations_total", "Instance and search pickers opened", metrics.picker_shown);
+    print_counter(out, "winleap_picker_cancellations_total", "Pickers closed with Escape", metrics.picker_cancelled);
+    print_counter(out, "winleap_picker_superseded_total", "Pickers closed by a newer request", metrics.picker_superseded);
+    print_counter(out, "winleap_keyboard_grab_failures_total", "Pickers that could not grab the keyboard",
+                  metrics.keyboard_grab_failures);
+    print_counter(out, "winleap_hotkey_grab_failures_total", "Hotkeys already grabbed by another client",
+                  metrics.hotkey_grab_failures);
+    print_counter(out, "winleap_launches_total", "exec.<mark> commands started", metrics.launches);
+    print_counter(out, "winleap_config_reloads_total", "Config reloads after the file changed", metrics.config_reloads);
+    print_counter(out, "winleap_window_events_total", "Window table updates from X or compositor events",
+                  metrics.events);
+    fprintf(out, "# HELP winleap_windows Windows in the daemon's table\n# TYPE winleap_windows gauge\n"
+                 "winleap_windows %d\n", windows.count);
+    fprintf(out, "# HELP winleap_uptime_seconds Time since the daemon started\n# TYPE winleap_uptime_seconds gauge\n"
+                 "winleap_uptime_seconds %.3f\n", (double)(monotonic_ns() - metrics.start_ns) / 1e9);
+    print_latency(out, "winleap_jump_latency_seconds", "Invocation to reply, jumps without picker or launch",
+                  &metrics.jump_latency);
+    print_latency(out, "winleap_confirm_latency_seconds", "Invocation to confirmed focus, same jumps with --confirm",
+                  &metrics.confirm_latency);
+}
+
+// Written to a temporary file and renamed, so node_exporter never reads half a file
+int write_metrics_textfile(const char *path) {
+    char tmp_path[MAX_PATH_LEN + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return 0;
+    FILE *out = fdopen(fd, "w");
+    if (!out) {
+        close(fd);
+        unlink(tmp_path);
+        return 0;
+    }
+    print_metrics(out);
+    if (fclose(out) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Every synchronous property read goes through here so round trips can be counted
+int get_window_property(Window win, Atom property, long long_length, Atom req_type,
+                        Atom *actual_type, int *actual_format,
+                        unsigned long *nitems, unsigned long *bytes_after, unsigned char **prop) {
+    trace_round_trips++;
+    return XGetWindowProperty(display, win, property, 0, long_length, False, req_type,
+                              actual_type, actual_format, nitems, bytes_after, prop);
+}
+
+// Reads a whole property: `initial_length` 32-bit units first and, only when the server
+// reports bytes_after, one more request sized from it. No loop: a property that grows in
+// between is used as far as the second reply goes.
+int get_full_window_property(Window win, Atom property, long initial_length, Atom req_type,
+                             Atom *actual_type, int *actual_format,
+                             unsigned long *nitems, unsigned char **prop) {
+    unsigned long bytes_after = 0;
+    *prop = NULL;
+    if (get_window_property(win, property, initial_length, req_type, actual_type, actual_format,
+                            nitems, &bytes_after, prop) != Success || !*prop) {
+        return 0;
+    }
+    if (bytes_after == 0) return 1;
+
+    long total = (long)((*nitems * (unsigned long)(*actual_format / 8) + bytes_after + 3) / 4);
+    XFree(*prop);
+    *prop = NULL;
+    return get_window_property(win, property, total, req_type, actual_type, actual_format,
+                               nitems, &bytes_after, prop) == Success && *prop;
+}
 
 // X11 atoms
 static Atom atom_wm_class;
@@ -103,14 +976,50 @@ static Atom atom_net_active_window;
 static Atom atom_net_wm_desktop;
 static Atom atom_net_current_desktop;
 
+// Every atom winleap uses; new ones only need a row here to join the batch
+static const struct {
+    const char *name;
+    Atom *atom;
+} atom_table[] = {
+    { "WM_CLASS", &atom_wm_class },
+    { "_NET_WM_NAME", &atom_net_wm_name },
+    { "UTF8_STRING", &atom_utf8_string },
+    { "_NET_CLIENT_LIST", &atom_net_client_list },
+    { "_NET_ACTIVE_WINDOW", &atom_net_active_window },
+    { "_NET_WM_DESKTOP", &atom_net_wm_desktop },
+    { "_NET_CURRENT_DESKTOP", &atom_net_current_desktop },
+};
+#define NUM_ATOMS (sizeof(atom_table) / sizeof(atom_table[0]))
+
+// Interned once per connection: XInternAtoms sends all requests before reading any
+// reply, so the whole table costs one round trip. The daemon keeps its display open,
+// so it pays this only at startup.
 void init_atoms(void) {
-    atom_wm_class = XInternAtom(display, "WM_CLASS", False);
-    atom_net_wm_name = XInternAtom(display, "_NET_WM_NAME", False);
-    atom_utf8_string = XInternAtom(display, "UTF8_STRING", False);
-    atom_net_client_list = XInternAtom(display, "_NET_CLIENT_LIST", False);
-    atom_net_active_window = XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
-    atom_net_wm_desktop = XInternAtom(display, "_NET_WM_DESKTOP", False);
-    atom_net_current_desktop = XInternAtom(display, "_NET_CURRENT_DESKTOP", False);
+    static Display *atoms_display;
+    if (atoms_display == display) return;
+
+    char *names[NUM_ATOMS];
+    Atom atoms[NUM_ATOMS];
+    for (size_t i = 0; i < NUM_ATOMS; i++) names[i] = (char *)atom_table[i].name;
+
+    trace_round_trips++;
+    XInternAtoms(display, names, (int)NUM_ATOMS, False, atoms);
+    for (size_t i = 0; i < NUM_ATOMS; i++) *atom_table[i].atom = atoms[i];
+    atoms_display = display;
+}
+
+static long root_event_mask = NoEventMask;
+
+void select_root_events(long mask) {
+    if ((root_event_mask & mask) == mask) return;
+    root_event_mask |= mask;
+    XSelectInput(display, root, root_event_mask);
+}
+
+void release_root_events(long mask) {
+    if (!(root_event_mask & mask)) return;
+    root_event_mask &= ~mask;
+    XSelectInput(display, root, root_event_mask);
 }
 
 static char *trim(char *s) {
@@ -138,6 +1047,15 @@ int parse_bool(const char *value, int *out) {
     return 0;
 }
 
+int parse_timeout_ms(const char *value, int *out) {
+    if (!value || !out) return 0;
+    char *endptr = NULL;
+    long ms = strtol(value, &endptr, 10);
+    if (endptr == value || *endptr != '\0' || ms < 0 || ms > MAX_TIMEOUT_MS) return 0;
+    *out = (int)ms;
+    return 1;
+}
+
 int parse_instance_keys(const char *raw_value, char *out, size_t out_size) {
     if (!raw_value || !out || out_size < 2) return 0;
 
@@ -175,83 +1093,640 @@ int parse_instance_keys(const char *raw_value, char *out, size_t out_size) {
     return 1;
 }
 
-int read_config_file(const char *filepath, Config *config) {
-    if (!config) return 0;
-
-    memset(config, 0, sizeof(*config));
-    config->debug = 0;
-    strncpy(config->instance_keys, DEFAULT_INSTANCE_KEYS, sizeof(config->instance_keys) - 1);
-    config->instance_keys[sizeof(config->instance_keys) - 1] = '\0';
-
-    FILE *f = fopen(filepath, "r");
-    if (!f) {
-        fprintf(stderr, "Failed to open config: %s\n", filepath);
-        return 0;
-    }
-
-    char line[MAX_LINE_LEN];
-    while (fgets(line, sizeof(line), f) && config->num_marks < MAX_MARKS) {
-        line[strcspn(line, "\n")] = '\0';
-
-        char *p = trim(line);
-        if (*p == '\0' || *p == '#') continue;
-
-        char *eq = strchr(p, '=');
-        if (!eq) continue;
-
-        *eq = '\0';
-        char *key = trim(p);
-        char *value = trim(eq + 1);
-
-        if (*key == '\0') continue;
-
-        if (strcasecmp(key, "instance_keys") == 0) {
-            if (!parse_instance_keys(value, config->instance_keys, sizeof(config->instance_keys))) {
-                fclose(f);
-                return 0;
+static const struct {
+    const char *name;
+    unsigned int mask;
+} hotkey_modifiers[] = {
+    {"shift", ShiftMask},
+    {"ctrl", ControlMask},
+    {"control", ControlMask},
+    {"alt", Mod1Mask},
+    {"mod1", Mod1Mask},
+    {"mod3", Mod3Mask},
+    {"super", Mod4Mask},
+    {"win", Mod4Mask},
+    {"mod4", Mod4Mask},
+    {"mod5", Mod5Mask},
+};
+
+// "super+shift+1": modifiers first, the last token is a keysym name
+int parse_hotkey_spec(const char *value, unsigned int *modifiers, KeySym *keysym) {
+    if (!value || !modifiers || !keysym) return 0;
+
+    char buf[MAX_HOTKEY_SPEC_LEN];
+    if (strlen(value) >= sizeof(buf)) return 0;
+    snprintf(buf, sizeof(buf), "%s", value);
+
+    *modifiers = 0;
+    *keysym = NoSymbol;
+
+    char *save = NULL;
+    char *token = strtok_r(buf, "+", &save);
+    while (token) {
+        token = trim(token);
+        char *next = strtok_r(NULL, "+", &save);
+
+        if (!next) {
+            KeySym sym = XStringToKeysym(token);
+            if (sym == NoSymbol && strlen(token) == 1) {
+                char lower[2] = {(char)tolower((unsigned char)token[0]), '\0'};
+                sym = XStringToKeysym(lower);
             }
-            continue;
+            if (sym == NoSymbol) return 0;
+            *keysym = sym;
+            return 1;
         }
 
-        if (strcasecmp(key, "debug") == 0) {
-            int parsed_debug = 0;
-            if (!parse_bool(value, &parsed_debug)) {
-                fprintf(stderr, "Invalid debug value: %s\n", value);
-                fclose(f);
-                return 0;
-            }
-            config->debug = parsed_debug;
-            continue;
+        size_t i;
+        size_t n = sizeof(hotkey_modifiers) / sizeof(hotkey_modifiers[0]);
+        for (i = 0; i < n; i++) {
+            if (strcasecmp(token, hotkey_modifiers[i].name) == 0) break;
         }
+        if (i == n) return 0;
+        *modifiers |= hotkey_modifiers[i].mask;
 
-        // Default format: number=wmclass
-        char *endptr = NULL;
-        long num = strtol(key, &endptr, 10);
-        if (endptr == key || *endptr != '\0' || num <= 0 || num > INT_MAX) {
-            continue;
-        }
-        if (*value == '\0') {
-            continue;
-        }
+        token = next;
+    }
+    return 0;
+}
 
-        config->marks[config->num_marks].number = (int)num;
-        strncpy(config->marks[config->num_marks].wm_class, value, MAX_CLASS_LEN - 1);
-        config->marks[config->num_marks].wm_class[MAX_CLASS_LEN - 1] = '\0';
-        config->num_marks++;
+int parse_hotkey(const char *key, const char *value, Hotkey *out) {
+    memset(out, 0, sizeof(*out));
+
+    const char *rest = key + strlen("hotkey.");
+    if (strncasecmp(rest, "workspace.", 10) == 0) {
+        out->current_workspace_only = 1;
+        rest += 10;
+    } else if (strncasecmp(rest, "application.", 12) == 0) {
+        out->current_application_mode = 1;
+        rest += 12;
+    } else if (strncasecmp(rest, "recent.", 7) == 0) {
+        out->most_recent = 1;
+        rest += 7;
+    } else if (strcasecmp(rest, "back") == 0) {
+        out->back = 1;
+        rest += 4;
+    }
+    if (!out->back && !out->current_application_mode && !out->most_recent && strcasecmp(rest, "search") == 0) {
+        out->search = 1;
     }
 
-    fclose(f);
+    char *endptr = NULL;
+    long num = strtol(rest, &endptr, 10);
+    if (out->back || out->search) {
+        num = 0;
+    } else if (endptr == rest || *endptr != '\0' || num <= 0 || num > INT_MAX) {
+        fprintf(stderr, "Invalid hotkey key: %s\n", key);
+        return 0;
+    }
+    out->number = (int)num;
+
+    if (!parse_hotkey_spec(value, &out->modifiers, &out->keysym)) {
+        fprintf(stderr, "Invalid hotkey value for %s: %s\n", key, value);
+        return 0;
+    }
+    snprintf(out->spec, sizeof(out->spec), "%s", value);
     return 1;
 }
 
-const char *find_wmclass_for_mark(const Config *config, int mark_num) {
-    if (!config) return NULL;
-    for (int i = 0; i < config->num_marks; i++) {
-        if (config->marks[i].number == mark_num) {
-            return config->marks[i].wm_class;
-        }
-    }
-    return NULL;
+void free_field_matcher(FieldMatcher *m) {
+    if (m->kind == MATCH_REGEX) regfree(&m->regex);
+    free(m->needle);
+    memset(m, 0, sizeof(*m));
+}
+
+void free_config(Config *config) {
+    if (config->matchers) {
+        for (int i = 0; i < config->num_marks; i++) {
+            free_field_matcher(&config->matchers[i].class_match);
+            free_field_matcher(&config->matchers[i].instance_match);
+            free_field_matcher(&config->matchers[i].title_match);
+        }
+        free(config->matchers);
+        config->matchers = NULL;
+    }
+    if (config->cache_map) {
+        munmap(config->cache_map, config->cache_map_size);
+        config->cache_map = NULL;
+    } else {
+        free(config->marks);
+        free(config->mark_index);
+    }
+    config->marks = NULL;
+    config->mark_index = NULL;
+    config->num_marks = 0;
+    config->marks_capacity = 0;
+    config->mark_index_mask = 0;
+}
+
+static unsigned mark_hash(int number) {
+    return (unsigned)number * 2654435761u;
+}
+
+int find_mark_slot(const Config *config, int number) {
+    if (!config->mark_index) return -1;
+    for (unsigned i = mark_hash(number) & config->mark_index_mask;; i = (i + 1) & config->mark_index_mask) {
+        int slot = config->mark_index[i];
+        if (slot < 0 || config->marks[slot].number == number) return slot;
+    }
+}
+
+// Sized to at most half full so probes stay short
+int rebuild_mark_index(Config *config) {
+    size_t size = 16;
+    while (size < (size_t)config->num_marks * 2) size *= 2;
+
+    int *index = malloc(size * sizeof(*index));
+    if (!index) return 0;
+    memset(index, 0xff, size * sizeof(*index));
+
+    free(config->mark_index);
+    config->mark_index = index;
+    config->mark_index_mask = (unsigned)(size - 1);
+
+    for (int slot = 0; slot < config->num_marks; slot++) {
+        unsigned i = mark_hash(config->marks[slot].number) & config->mark_index_mask;
+        while (index[i] >= 0) i = (i + 1) & config->mark_index_mask;
+        index[i] = slot;
+    }
+    return 1;
+}
+
+// "class:a instance:b title:/c d/" fills the mark's pattern fields. A regex runs to its closing
+// slash, so it may contain spaces. A value without any field prefix is a class, as before.
+int parse_mark_rule(const char *value, MarkMapping *mark) {
+    mark->wm_class[0] = '\0';
+    mark->instance[0] = '\0';
+    mark->title[0] = '\0';
+
+    if (strncasecmp(value, "class:", 6) != 0 && strncasecmp(value, "instance:", 9) != 0 &&
+        strncasecmp(value, "title:", 6) != 0) {
+        snprintf(mark->wm_class, sizeof(mark->wm_class), "%s", value);
+        return 1;
+    }
+
+    const char *p = value;
+    while (*(p += strspn(p, " \t"))) {
+        char *field;
+        size_t size;
+        if (strncasecmp(p, "class:", 6) == 0) {
+            field = mark->wm_class;
+            size = sizeof(mark->wm_class);
+            p += 6;
+        } else if (strncasecmp(p, "instance:", 9) == 0) {
+            field = mark->instance;
+            size = sizeof(mark->instance);
+            p += 9;
+        } else if (strncasecmp(p, "title:", 6) == 0) {
+            field = mark->title;
+            size = sizeof(mark->title);
+            p += 6;
+        } else {
+            return 0;
+        }
+
+        const char *end = p;
+        if (*p == '/') {
+            end++;
+            while (*end && *end != '/') end += end[0] == '\\' && end[1] ? 2 : 1;
+            if (*end != '/') return 0;
+            end++;
+            if (*end == 'i') end++;
+            if (*end && *end != ' ' && *end != '\t') return 0;
+        } else {
+            end += strcspn(p, " \t");
+        }
+
+        size_t len = (size_t)(end - p);
+        if (len == 0 || len >= size || field[0]) return 0;
+        memcpy(field, p, len);
+        field[len] = '\0';
+        p = end;
+    }
+    return 1;
+}
+
+// Builds "class:x title:/y/" back from a mark, or just the class for a plain mark
+void format_mark_rule(const MarkMapping *mark, char *buf, size_t size) {
+    if (!mark->instance[0] && !mark->title[0] && mark->wm_class[0] != '/') {
+        snprintf(buf, size, "%s", mark->wm_class);
+        return;
+    }
+    snprintf(buf, size, "%s%s%s%s%s%s",
+             mark->wm_class[0] ? "class:" : "", mark->wm_class,
+             mark->instance[0] ? " instance:" : "", mark->instance,
+             mark->title[0] ? " title:" : "", mark->title);
+    if (buf[0] == ' ') memmove(buf, buf + 1, strlen(buf));
+}
+
+static int is_plain_literal(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (strchr(".[]()*+?{}|\\^$", s[i])) return 0;
+    }
+    return 1;
+}
+
+int compile_field_matcher(const char *pattern, FieldMatcher *m, char *err, size_t err_size) {
+    memset(m, 0, sizeof(*m));
+    size_t len = strlen(pattern);
+    if (len == 0) return 1;
+
+    if (pattern[0] != '/') {
+        m->kind = MATCH_EXACT;
+        m->icase = 1;
+        m->needle = strdup(pattern);
+        m->len = len;
+        return m->needle != NULL;
+    }
+
+    // "/body/" or "/body/i", as checked by parse_mark_rule()
+    m->icase = pattern[len - 1] == 'i';
+    const char *body = pattern + 1;
+    size_t body_len = len - 2 - (size_t)m->icase;
+
+    if (body_len > 0 && body[0] == '^' && is_plain_literal(body + 1, body_len - 1)) {
+        m->kind = MATCH_PREFIX;
+        m->needle = strndup(body + 1, body_len - 1);
+        m->len = body_len - 1;
+        return m->needle != NULL;
+    }
+    if (is_plain_literal(body, body_len)) {
+        m->kind = MATCH_SUBSTRING;
+        m->needle = strndup(body, body_len);
+        m->len = body_len;
+        return m->needle != NULL;
+    }
+
+    char *source = strndup(body, body_len);
+    if (!source) return 0;
+    int rc = regcomp(&m->regex, source, REG_EXTENDED | REG_NOSUB | (m->icase ? REG_ICASE : 0));
+    free(source);
+    if (rc != 0) {
+        regerror(rc, &m->regex, err, err_size);
+        return 0;
+    }
+    m->kind = MATCH_REGEX;
+    return 1;
+}
+
+static inline int field_matches(const FieldMatcher *m, const char *s) {
+    switch (m->kind) {
+    case MATCH_EXACT:
+        return m->icase ? strcasecmp(s, m->needle) == 0 : strcmp(s, m->needle) == 0;
+    case MATCH_PREFIX:
+        return (m->icase ? strncasecmp(s, m->needle, m->len) : strncmp(s, m->needle, m->len)) == 0;
+    case MATCH_SUBSTRING:
+        return (m->icase ? strcasestr(s, m->needle) : strstr(s, m->needle)) != NULL;
+    case MATCH_REGEX:
+        return regexec(&m->regex, s, 0, NULL, 0) == 0;
+    default:
+        return 1;
+    }
+}
+
+// A plain class mark is answered by the class index alone
+static inline int mark_is_simple(const MarkMatcher *m) {
+    return m->class_match.kind == MATCH_EXACT && m->instance_match.kind == MATCH_ANY &&
+           m->title_match.kind == MATCH_ANY;
+}
+
+// Runs after every load, text or cache, since compiled regexes cannot be stored on disk
+int compile_mark_rules(Config *config) {
+    config->matchers = calloc((size_t)(config->num_marks > 0 ? config->num_marks : 1), sizeof(*config->matchers));
+    if (!config->matchers) {
+        fprintf(stderr, "Out of memory reading config\n");
+        return 0;
+    }
+
+    int next_bit = 0;
+    for (int i = 0; i < config->num_marks; i++) {
+        const MarkMapping *mark = &config->marks[i];
+        MarkMatcher *m = &config->matchers[i];
+        char err[128] = "out of memory";
+        if (!compile_field_matcher(mark->wm_class, &m->class_match, err, sizeof(err)) ||
+            !compile_field_matcher(mark->instance, &m->instance_match, err, sizeof(err)) ||
+            !compile_field_matcher(mark->title, &m->title_match, err, sizeof(err))) {
+            fprintf(stderr, "Invalid pattern for mark %d on line %d: %s\n", mark->number, mark->line, err);
+            return 0;
+        }
+        m->cache_bit = !mark_is_simple(m) && next_bit < MAX_CACHED_RULES ? next_bit++ : -1;
+    }
+    return 1;
+}
+
+int add_mark(Config *config, const MarkMapping *source) {
+    if (config->num_marks == config->marks_capacity) {
+        int capacity = config->marks_capacity ? config->marks_capacity * 2 : 16;
+        MarkMapping *marks = realloc(config->marks, sizeof(*marks) * (size_t)capacity);
+        if (!marks) return 0;
+        config->marks = marks;
+        config->marks_capacity = capacity;
+    }
+
+    int number = source->number;
+    config->marks[config->num_marks++] = *source;
+
+    if ((size_t)config->num_marks * 2 > (size_t)config->mark_index_mask + 1 || !config->mark_index) {
+        return rebuild_mark_index(config);
+    }
+    unsigned i = mark_hash(number) & config->mark_index_mask;
+    while (config->mark_index[i] >= 0) i = (i + 1) & config->mark_index_mask;
+    config->mark_index[i] = config->num_marks - 1;
+    return 1;
+}
+
+int parse_launch_command(Config *config, const char *number_text, const char *value, int line_no) {
+    char *endptr = NULL;
+    long num = strtol(number_text, &endptr, 10);
+    if (endptr == number_text || *endptr != '\0' || num <= 0 || num > INT_MAX) {
+        fprintf(stderr, "Invalid exec mark on line %d: exec.%s\n", line_no, number_text);
+        return 0;
+    }
+    if (*value == '\0') {
+        fprintf(stderr, "Empty exec.%ld command on line %d\n", num, line_no);
+        return 0;
+    }
+    for (int i = 0; i < config->num_launches; i++) {
+        if (config->launches[i].number == (int)num) {
+            fprintf(stderr, "Duplicate exec.%ld on line %d (already set on line %d)\n",
+                    num, line_no, config->launches[i].line);
+            return 0;
+        }
+    }
+    if (config->num_launches >= MAX_LAUNCH_COMMANDS) {
+        fprintf(stderr, "Too many exec commands (max %d)\n", MAX_LAUNCH_COMMANDS);
+        return 0;
+    }
+
+    LaunchCommand *launch = &config->launches[config->num_launches++];
+    launch->number = (int)num;
+    launch->line = line_no;
+    snprintf(launch->command, sizeof(launch->command), "%s", value);
+    return 1;
+}
+
+const char *find_launch_command(const Config *config, int number) {
+    for (int i = 0; i < config->num_launches; i++) {
+        if (config->launches[i].number == number) return config->launches[i].command;
+    }
+    return NULL;
+}
+
+int read_config_file(const char *filepath, Config *config) {
+    if (!config) return 0;
+
+    memset(config, 0, sizeof(*config));
+    config->debug = 0;
+    config->desktop_switch_timeout_ms = DEFAULT_DESKTOP_SWITCH_TIMEOUT_MS;
+    config->activation_timeout_ms = DEFAULT_ACTIVATION_TIMEOUT_MS;
+    config->launch_timeout_ms = DEFAULT_LAUNCH_TIMEOUT_MS;
+    config->picker_recent_first = 1;
+    config->picker_hints = 1;
+    strncpy(config->instance_keys, DEFAULT_INSTANCE_KEYS, sizeof(config->instance_keys) - 1);
+    config->instance_keys[sizeof(config->instance_keys) - 1] = '\0';
+
+    FILE *f = fopen(filepath, "r");
+    if (!f) {
+        fprintf(stderr, "Failed to open config: %s\n", filepath);
+        return 0;
+    }
+
+    char line[MAX_LINE_LEN];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+        line[strcspn(line, "\n")] = '\0';
+
+        char *p = trim(line);
+        if (*p == '\0' || *p == '#') continue;
+
+        char *eq = strchr(p, '=');
+        if (!eq) continue;
+
+        *eq = '\0';
+        char *key = trim(p);
+        char *value = trim(eq + 1);
+
+        if (*key == '\0') continue;
+
+        if (strcasecmp(key, "instance_keys") == 0) {
+            if (!parse_instance_keys(value, config->instance_keys, sizeof(config->instance_keys))) {
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            continue;
+        }
+
+        if (strncasecmp(key, "hotkey.", 7) == 0) {
+            if (config->num_hotkeys >= MAX_HOTKEYS) {
+                fprintf(stderr, "Too many hotkeys (max %d)\n", MAX_HOTKEYS);
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            if (!parse_hotkey(key, value, &config->hotkeys[config->num_hotkeys])) {
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            config->num_hotkeys++;
+            continue;
+        }
+
+        if (strncasecmp(key, "exec.", 5) == 0) {
+            if (!parse_launch_command(config, key + 5, value, line_no)) {
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            continue;
+        }
+
+        if (strcasecmp(key, "debug") == 0) {
+            int parsed_debug = 0;
+            if (!parse_bool(value, &parsed_debug)) {
+                fprintf(stderr, "Invalid debug value: %s\n", value);
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            config->debug = parsed_debug;
+            continue;
+        }
+
+        if (strcasecmp(key, "trace") == 0) {
+            if (!parse_bool(value, &config->trace)) {
+                fprintf(stderr, "Invalid trace value: %s\n", value);
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            continue;
+        }
+
+        if (strcasecmp(key, "backend") == 0) {
+            if (strcasecmp(value, "auto") == 0) {
+                config->backend = BACKEND_AUTO;
+            } else if (strcasecmp(value, "x11") == 0) {
+                config->backend = BACKEND_X11;
+            } else if (strcasecmp(value, "sway") == 0) {
+                config->backend = BACKEND_SWAY;
+            } else if (strcasecmp(value, "hyprland") == 0) {
+                config->backend = BACKEND_HYPRLAND;
+            } else {
+                fprintf(stderr, "Invalid backend value (auto, x11, sway or hyprland): %s\n", value);
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            continue;
+        }
+
+        if (strcasecmp(key, "metrics_textfile") == 0) {
+            if (strlen(value) >= sizeof(config->metrics_textfile)) {
+                fprintf(stderr, "metrics_textfile path is too long: %s\n", value);
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            snprintf(config->metrics_textfile, sizeof(config->metrics_textfile), "%s", value);
+            continue;
+        }
+
+        if (strcasecmp(key, "picker_order") == 0) {
+            if (strcasecmp(value, "recent") == 0) {
+                config->picker_recent_first = 1;
+            } else if (strcasecmp(value, "list") == 0) {
+                config->picker_recent_first = 0;
+            } else {
+                fprintf(stderr, "Invalid picker_order value (recent or list): %s\n", value);
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            continue;
+        }
+
+        if (strcasecmp(key, "picker_hints") == 0) {
+            if (!parse_bool(value, &config->picker_hints)) {
+                fprintf(stderr, "Invalid picker_hints value: %s\n", value);
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            continue;
+        }
+
+        if (strcasecmp(key, "picker_thumbnails") == 0) {
+            if (!parse_bool(value, &config->picker_thumbnails)) {
+                fprintf(stderr, "Invalid picker_thumbnails value: %s\n", value);
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            continue;
+        }
+
+        if (strcasecmp(key, "confirm_activation") == 0) {
+            if (!parse_bool(value, &config->confirm_activation)) {
+                fprintf(stderr, "Invalid confirm_activation value: %s\n", value);
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            continue;
+        }
+
+        if (strcasecmp(key, "activation_timeout_ms") == 0) {
+            if (!parse_timeout_ms(value, &config->activation_timeout_ms)) {
+                fprintf(stderr, "Invalid activation_timeout_ms value (0-%d): %s\n", MAX_TIMEOUT_MS, value);
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            continue;
+        }
+
+        if (strcasecmp(key, "launch_timeout_ms") == 0) {
+            if (!parse_timeout_ms(value, &config->launch_timeout_ms)) {
+                fprintf(stderr, "Invalid launch_timeout_ms value (0-%d): %s\n", MAX_TIMEOUT_MS, value);
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            continue;
+        }
+
+        if (strcasecmp(key, "desktop_switch_timeout_ms") == 0) {
+            if (!parse_timeout_ms(value, &config->desktop_switch_timeout_ms)) {
+                fprintf(stderr, "Invalid desktop_switch_timeout_ms value (0-%d): %s\n", MAX_TIMEOUT_MS, value);
+                fclose(f);
+                free_config(config);
+                return 0;
+            }
+            continue;
+        }
+
+        // Default format: number=wmclass
+        char *endptr = NULL;
+        long num = strtol(key, &endptr, 10);
+        if (endptr == key || *endptr != '\0' || num <= 0 || num > INT_MAX) {
+            continue;
+        }
+        if (*value == '\0') {
+            continue;
+        }
+
+        int existing = find_mark_slot(config, (int)num);
+        if (existing >= 0) {
+            char rule[MAX_RULE_TEXT_LEN];
+            format_mark_rule(&config->marks[existing], rule, sizeof(rule));
+            fprintf(stderr, "Duplicate mark %ld on line %d (already mapped to %s on line %d)\n",
+                    num, line_no, rule, config->marks[existing].line);
+            fclose(f);
+            free_config(config);
+            return 0;
+        }
+
+        MarkMapping mark;
+        mark.number = (int)num;
+        mark.line = line_no;
+        if (!parse_mark_rule(value, &mark)) {
+            fprintf(stderr, "Invalid mark rule on line %d: %s\n", line_no, value);
+            fclose(f);
+            free_config(config);
+            return 0;
+        }
+        if (!add_mark(config, &mark)) {
+            fprintf(stderr, "Out of memory reading config\n");
+            fclose(f);
+            free_config(config);
+            return 0;
+        }
+    }
+
+    fclose(f);
+    // exec lines may come before their mark, so they are checked once the whole file is read
+    for (int i = 0; i < config->num_launches; i++) {
+        if (find_mark_slot(config, config->launches[i].number) < 0) {
+            fprintf(stderr, "exec.%d on line %d has no mark %d\n", config->launches[i].number,
+                    config->launches[i].line, config->launches[i].number);
+            free_config(config);
+            return 0;
+        }
+    }
+    // An empty index keeps lookups and the cache layout uniform for configs without marks
+    if (!config->mark_index && !rebuild_mark_index(config)) {
+        fprintf(stderr, "Out of memory reading config\n");
+        free_config(config);
+        return 0;
+    }
+    if (!compile_mark_rules(config)) {
+        free_config(config);
+        return 0;
+    }
+    return 1;
 }
 
 int file_exists_readable(const char *path) {
@@ -332,29 +1807,77 @@ void resolve_config_path(char *out, size_t out_size, const char *argv0, const ch
     }
 }
 
-void resolve_debug_log_path(char *out, size_t out_size) {
-    char base[MAX_PATH_LEN];
-
+void resolve_state_dir(char *out, size_t out_size) {
     const char *xdg_state_home = getenv("XDG_STATE_HOME");
     if (xdg_state_home && xdg_state_home[0]) {
-        path_join(base, sizeof(base), xdg_state_home, "winleap");
+        path_join(out, out_size, xdg_state_home, "winleap");
     } else {
         const char *home = getenv("HOME");
         if (home && home[0]) {
-            path_join(base, sizeof(base), home, ".local/state/winleap");
+            path_join(out, out_size, home, ".local/state/winleap");
         } else {
-            snprintf(base, sizeof(base), ".");
+            snprintf(out, out_size, ".");
         }
     }
+}
 
+void resolve_debug_log_path(char *out, size_t out_size) {
+    char base[MAX_PATH_LEN];
+    resolve_state_dir(base, sizeof(base));
     path_join(out, out_size, base, "debug.log");
 }
 
-int mkdir_p(const char *dir) {
-    if (!dir || !dir[0]) return 0;
+// One cache file per config path, so --config files do not evict the default one
+void resolve_config_cache_path(char *out, size_t out_size, const char *config_path) {
+    uint64_t hash = 14695981039346656037ull;  // FNV-1a
+    for (const char *p = config_path; *p; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211ull;
+    }
 
-    char tmp[MAX_PATH_LEN];
-    size_t len = strlen(dir);
+    char base[MAX_PATH_LEN];
+    char name[40];
+    resolve_state_dir(base, sizeof(base));
+    snprintf(name, sizeof(name), "config-%016llx.cache", (unsigned long long)hash);
+    path_join(out, out_size, base, name);
+}
+
+void resolve_runtime_dir(char *out, size_t out_size) {
+    const char *xdg_runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (xdg_runtime_dir && xdg_runtime_dir[0]) {
+        path_join(out, out_size, xdg_runtime_dir, "winleap");
+    } else {
+        snprintf(out, out_size, "/tmp/winleap-%u", (unsigned)getuid());
+    }
+}
+
+// Runtime files are per display: $XDG_RUNTIME_DIR/winleap/<display><suffix>, where a Wayland
+// session without Xwayland goes by $WAYLAND_DISPLAY
+void resolve_runtime_path(char *out, size_t out_size, const char *suffix) {
+    char base[MAX_PATH_LEN];
+    resolve_runtime_dir(base, sizeof(base));
+
+    const char *display_name = getenv("DISPLAY");
+    if (!display_name || !display_name[0]) display_name = getenv("WAYLAND_DISPLAY");
+    if (!display_name || !display_name[0]) display_name = "default";
+    if (display_name[0] == ':') display_name++;
+
+    char name[128];
+    size_t j = 0;
+    for (size_t i = 0; display_name[i] != '\0' && j < 64; i++) {
+        unsigned char ch = (unsigned char)display_name[i];
+        name[j++] = (isalnum(ch) || ch == '.' || ch == '-') ? (char)ch : '_';
+    }
+    snprintf(name + j, sizeof(name) - j, "%s", suffix ? suffix : "");
+
+    path_join(out, out_size, base, name);
+}
+
+int mkdir_p(const char *dir) {
+    if (!dir || !dir[0]) return 0;
+
+    char tmp[MAX_PATH_LEN];
+    size_t len = strlen(dir);
     if (len >= sizeof(tmp)) return 0;
 
     snprintf(tmp, sizeof(tmp), "%s", dir);
@@ -388,6 +1911,31 @@ int ensure_parent_dir(const char *path) {
     return mkdir_p(parent);
 }
 
+void open_debug_log(const char *debug_path) {
+    if (log_fd >= 0) return;
+
+    if (!ensure_parent_dir(debug_path)) {
+        fprintf(stderr, "Warning: cannot create debug log directory for: %s\n", debug_path);
+    }
+    snprintf(log_path, sizeof(log_path), "%s", debug_path);
+    log_fd = open(debug_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0) {
+        fprintf(stderr, "Warning: cannot open debug log file: %s\n", debug_path);
+        return;
+    }
+
+    struct stat st;
+    log_file_size = fstat(log_fd, &st) == 0 ? st.st_size : 0;
+    if (log_file_size >= DEBUG_LOG_MAX_BYTES) log_rotate();
+
+    // Buffered lines must still reach the file when exit() is called elsewhere
+    static int registered = 0;
+    if (!registered) {
+        atexit(log_close);
+        registered = 1;
+    }
+}
+
 int print_debug_log(const char *debug_path) {
     if (!debug_path || !debug_path[0]) return 1;
 
@@ -415,32 +1963,199 @@ int print_debug_log(const char *debug_path) {
     return 0;
 }
 
-int get_wm_class(Window win, char *buf, size_t bufsize) {
-    Atom actual_type;
-    int actual_format;
-    unsigned long nitems, bytes_after;
-    unsigned char *prop = NULL;
+// Compiled config cache: a header identifying the source file, the parsed Config (pointer fields
+// are meaningless on disk), the marks array and the mark index. The file stays mapped so a
+// lookup only faults in the pages it touches. Bump CONFIG_CACHE_VERSION whenever Config changes
+// meaning without changing size.
+#define CONFIG_CACHE_MAGIC 0x43434c57u  // "WLCC"
+#define CONFIG_CACHE_VERSION 9
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t config_size;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    char source[MAX_PATH_LEN];
+} ConfigCacheHeader;
+
+static void fill_config_cache_header(ConfigCacheHeader *header, const char *config_path, const struct stat *st) {
+    memset(header, 0, sizeof(*header));
+    header->magic = CONFIG_CACHE_MAGIC;
+    header->version = CONFIG_CACHE_VERSION;
+    header->config_size = sizeof(Config);
+    header->dev = (uint64_t)st->st_dev;
+    header->ino = (uint64_t)st->st_ino;
+    header->size = (int64_t)st->st_size;
+    header->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    header->mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+    snprintf(header->source, sizeof(header->source), "%s", config_path);
+}
 
-    if (XGetWindowProperty(display, win, atom_wm_class, 0, 1024, False,
-                           XA_STRING, &actual_type, &actual_format,
-                           &nitems, &bytes_after, &prop) != Success || !prop) {
+// A cache whose header matches can still be damaged: the index must be a probe-safe hash
+// over exactly the marks it was built from, or find_mark_slot() reads out of bounds or never
+// stops. Counts and strings copied with the Config are checked the same way.
+static int config_cache_valid(const Config *config) {
+    unsigned size = config->mark_index_mask + 1;
+    if (size < 16 || (size & config->mark_index_mask) != 0 || (size_t)config->num_marks * 2 > size) return 0;
+    if (config->num_hotkeys < 0 || config->num_hotkeys > MAX_HOTKEYS) return 0;
+    if (config->num_launches < 0 || config->num_launches > MAX_LAUNCH_COMMANDS) return 0;
+    for (int i = 0; i < config->num_launches; i++) {
+        if (!memchr(config->launches[i].command, '\0', sizeof(config->launches[i].command))) return 0;
+    }
+    if (!memchr(config->instance_keys, '\0', sizeof(config->instance_keys)) ||
+        !memchr(config->metrics_textfile, '\0', sizeof(config->metrics_textfile))) {
         return 0;
     }
 
-    // WM_CLASS format: "instance\0class\0"
-    const char *instance = (const char *)prop;
-    const char *class_name = instance + strlen(instance) + 1;
+    int used = 0;
+    for (unsigned i = 0; i < size; i++) {
+        int slot = config->mark_index[i];
+        if (slot < -1 || slot >= config->num_marks) return 0;
+        used += slot >= 0;
+    }
+    if (used != config->num_marks) return 0;
 
-    if (class_name < (const char *)prop + nitems) {
-        strncpy(buf, class_name, bufsize - 1);
-        buf[bufsize - 1] = '\0';
-    } else {
-        strncpy(buf, instance, bufsize - 1);
-        buf[bufsize - 1] = '\0';
+    for (int slot = 0; slot < config->num_marks; slot++) {
+        const MarkMapping *mark = &config->marks[slot];
+        if (!memchr(mark->wm_class, '\0', sizeof(mark->wm_class)) ||
+            !memchr(mark->instance, '\0', sizeof(mark->instance)) ||
+            !memchr(mark->title, '\0', sizeof(mark->title))) {
+            return 0;
+        }
+        // Every mark reachable from its own number also rules out duplicate slots
+        if (find_mark_slot(config, mark->number) != slot) return 0;
+    }
+    return 1;
+}
+
+int load_config_cache(const char *cache_path, const ConfigCacheHeader *expected, Config *config) {
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+
+    size_t fixed = sizeof(ConfigCacheHeader) + sizeof(Config);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < fixed) {
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    const unsigned char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    if (memcmp(map, expected, sizeof(*expected)) == 0) {
+        memcpy(config, map + sizeof(ConfigCacheHeader), sizeof(*config));
+        size_t marks_bytes = sizeof(MarkMapping) * (size_t)config->num_marks;
+        size_t index_bytes = sizeof(int) * ((size_t)config->mark_index_mask + 1);
+
+        // The pointers copied with Config are the writer's; only the mapped ones are usable
+        int sized = config->num_marks >= 0 && size == fixed + marks_bytes + index_bytes;
+        config->marks = sized ? (MarkMapping *)(map + fixed) : NULL;
+        config->mark_index = sized ? (int *)(map + fixed + marks_bytes) : NULL;
+        if (sized && config_cache_valid(config)) {
+            config->marks_capacity = config->num_marks;
+            config->cache_map = (void *)map;
+            config->cache_map_size = size;
+            config->matchers = NULL;
+            if (compile_mark_rules(config)) return 1;
+            free_config(config);
+            return 0;
+        }
+    }
+    munmap((void *)map, size);
+    return 0;
+}
+
+void store_config_cache(const char *cache_path, const ConfigCacheHeader *header, const Config *config) {
+    char tmp_path[MAX_PATH_LEN + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", cache_path, (int)getpid());
+    if (!ensure_parent_dir(cache_path)) return;
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+    ssize_t marks_bytes = (ssize_t)(sizeof(MarkMapping) * (size_t)config->num_marks);
+    ssize_t index_bytes = (ssize_t)(sizeof(int) * ((size_t)config->mark_index_mask + 1));
+    int ok = write(fd, header, sizeof(*header)) == (ssize_t)sizeof(*header) &&
+             write(fd, config, sizeof(*config)) == (ssize_t)sizeof(*config) &&
+             (marks_bytes == 0 || write(fd, config->marks, (size_t)marks_bytes) == marks_bytes) &&
+             write(fd, config->mark_index, (size_t)index_bytes) == index_bytes;
+    close(fd);
+    if (!ok || rename(tmp_path, cache_path) != 0) unlink(tmp_path);
+}
+
+// read_config_file() behind the cache; the text parse only runs when the source changed
+int load_config(const char *config_path, Config *config) {
+    struct stat st;
+    if (stat(config_path, &st) != 0) {
+        return read_config_file(config_path, config);
+    }
+
+    char cache_path[MAX_PATH_LEN];
+    ConfigCacheHeader header;
+    resolve_config_cache_path(cache_path, sizeof(cache_path), config_path);
+    fill_config_cache_header(&header, config_path, &st);
+
+    if (load_config_cache(cache_path, &header, config)) return 1;
+    if (!read_config_file(config_path, config)) return 0;
+
+    // Like git's racy-clean check: a file written within the last second could change again
+    // without a visible mtime change, so it is not cached until it has settled
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (now.tv_sec - st.st_mtim.tv_sec > 1) {
+        store_config_cache(cache_path, &header, config);
+    }
+    return 1;
+}
+
+static void copy_truncated(char *buf, size_t bufsize, const char *src, size_t len) {
+    if (len > bufsize - 1) len = bufsize - 1;
+    memcpy(buf, src, len);
+    buf[len] = '\0';
+}
+
+// WM_CLASS format: "instance\0class\0"; keeps the class half (or the instance if that is all
+// there is), and the instance half too when `instance_buf` is given
+int copy_wm_class(const char *data, size_t len, char *buf, size_t bufsize,
+                  char *instance_buf, size_t instance_size) {
+    const char *instance = data;
+    size_t instance_len = strnlen(instance, len);
+    const char *class_name = instance + instance_len + 1;
+    const char *src = instance;
+    size_t src_len = instance_len;
+
+    if (instance_len + 1 < len) {
+        src = class_name;
+        src_len = strnlen(class_name, len - instance_len - 1);
+    }
+    copy_truncated(buf, bufsize, src, src_len);
+    if (instance_buf) copy_truncated(instance_buf, instance_size, instance, instance_len);
+    return src_len > 0;
+}
+
+int get_wm_class_parts(Window win, char *buf, size_t bufsize, char *instance_buf, size_t instance_size) {
+    Atom actual_type;
+    int actual_format;
+    unsigned long nitems;
+    unsigned char *prop = NULL;
+
+    // The class follows the instance, so a long instance name needs the sized second read
+    if (!get_full_window_property(win, atom_wm_class, WM_CLASS_FETCH_LONGS,
+                                  XA_STRING, &actual_type, &actual_format, &nitems, &prop)) {
+        return 0;
     }
 
+    int ok = copy_wm_class((const char *)prop, nitems, buf, bufsize, instance_buf, instance_size);
     XFree(prop);
-    return strlen(buf) > 0;
+    return ok;
+}
+
+int get_wm_class(Window win, char *buf, size_t bufsize) {
+    return get_wm_class_parts(win, buf, bufsize, NULL, 0);
 }
 
 int get_window_title(Window win, char *buf, size_t bufsize) {
@@ -449,10 +2164,10 @@ int get_window_title(Window win, char *buf, size_t bufsize) {
     unsigned long nitems, bytes_after;
     unsigned char *prop = NULL;
 
-    // Try _NET_WM_NAME first (UTF-8)
-    if (XGetWindowProperty(display, win, atom_net_wm_name, 0, 1024, False,
-                           atom_utf8_string, &actual_type, &actual_format,
-                           &nitems, &bytes_after, &prop) == Success && prop) {
+    // Try _NET_WM_NAME first (UTF-8); only as much as the buffer keeps is requested
+    if (get_window_property(win, atom_net_wm_name, (long)(bufsize + 3) / 4,
+                            atom_utf8_string, &actual_type, &actual_format,
+                            &nitems, &bytes_after, &prop) == Success && prop) {
         strncpy(buf, (char *)prop, bufsize - 1);
         buf[bufsize - 1] = '\0';
         XFree(prop);
@@ -461,6 +2176,7 @@ int get_window_title(Window win, char *buf, size_t bufsize) {
 
     // Fall back to WM_NAME
     char *name = NULL;
+    trace_round_trips++;
     if (XFetchName(display, win, &name) && name) {
         strncpy(buf, name, bufsize - 1);
         buf[bufsize - 1] = '\0';
@@ -478,9 +2194,9 @@ long get_window_desktop(Window win) {
     unsigned long nitems, bytes_after;
     unsigned char *prop = NULL;
 
-    if (XGetWindowProperty(display, win, atom_net_wm_desktop, 0, 1, False,
-                           XA_CARDINAL, &actual_type, &actual_format,
-                           &nitems, &bytes_after, &prop) == Success && prop) {
+    if (get_window_property(win, atom_net_wm_desktop, 1,
+                            XA_CARDINAL, &actual_type, &actual_format,
+                            &nitems, &bytes_after, &prop) == Success && prop) {
         long desktop = *(long *)prop;
         XFree(prop);
         return desktop;
@@ -495,9 +2211,9 @@ long get_current_desktop(void) {
     unsigned long nitems, bytes_after;
     unsigned char *prop = NULL;
 
-    if (XGetWindowProperty(display, root, atom_net_current_desktop, 0, 1, False,
-                           XA_CARDINAL, &actual_type, &actual_format,
-                           &nitems, &bytes_after, &prop) == Success && prop) {
+    if (get_window_property(root, atom_net_current_desktop, 1,
+                            XA_CARDINAL, &actual_type, &actual_format,
+                            &nitems, &bytes_after, &prop) == Success && prop) {
         long desktop = *(long *)prop;
         XFree(prop);
         return desktop;
@@ -514,9 +2230,9 @@ int get_active_window(Window *out_window) {
     unsigned long nitems, bytes_after;
     unsigned char *prop = NULL;
 
-    if (XGetWindowProperty(display, root, atom_net_active_window, 0, 1, False,
-                           XA_WINDOW, &actual_type, &actual_format,
-                           &nitems, &bytes_after, &prop) != Success || !prop) {
+    if (get_window_property(root, atom_net_active_window, 1,
+                            XA_WINDOW, &actual_type, &actual_format,
+                            &nitems, &bytes_after, &prop) != Success || !prop) {
         return 0;
     }
 
@@ -530,231 +2246,4482 @@ int get_active_window(Window *out_window) {
     return 1;
 }
 
-int discover_windows(void) {
-    log_section("DISCOVERING WINDOWS");
+void reset_window_info(WindowInfo *info, Window win) {
+    info->id = win;
+    info->wm_class[0] = '\0';
+    info->instance[0] = '\0';
+    info->title[0] = '\0';
+    info->desktop = -1;
+    info->loaded = 0;
+}
+
+int in_scope(long desktop, int current_workspace_only, long current_desktop) {
+    if (!current_workspace_only) return 1;
+    return current_desktop >= 0 && desktop == current_desktop;
+}
+
+// Cheapest order first: desktop (when scoped, it filters), then class, then title.
+// Returns 1 when the window has a class and is in scope.
+int load_window_properties(Window win, WindowInfo *info, unsigned fetch,
+                           int current_workspace_only, long current_desktop) {
+    reset_window_info(info, win);
+
+    if ((fetch & FETCH_DESKTOP) || current_workspace_only) {
+        info->desktop = get_window_desktop(win);
+        info->loaded |= FETCH_DESKTOP;
+        if (!in_scope(info->desktop, current_workspace_only, current_desktop)) {
+            return 0;
+        }
+    }
+
+    if (!get_wm_class_parts(win, info->wm_class, MAX_CLASS_LEN, info->instance, MAX_CLASS_LEN)) {
+        info->wm_class[0] = '\0';
+        return 0;
+    }
+
+    if (fetch & FETCH_TITLE) {
+        get_window_title(win, info->title, MAX_TITLE_LEN);
+        info->loaded |= FETCH_TITLE;
+    }
+    return 1;
+}
+
+int load_window_info(Window win, WindowInfo *info, unsigned fetch,
+                     int current_workspace_only, long current_desktop) {
+    TraceMark mark = trace_begin();
+    int keep = load_window_properties(win, info, fetch, current_workspace_only, current_desktop);
+    trace_end(&mark, "discover_window", (unsigned long)win);
+    return keep;
+}
+
+#ifdef WINLEAP_XCB
+static xcb_get_property_reply_t *xcb_property_reply(xcb_connection_t *conn, xcb_get_property_cookie_t cookie) {
+    return xcb_get_property_reply(conn, cookie, NULL);
+}
+
+static long xcb_reply_cardinal(xcb_get_property_reply_t *reply) {
+    if (reply && reply->format == 32 && xcb_get_property_value_length(reply) >= 4) {
+        return (long)*(int32_t *)xcb_get_property_value(reply);
+    }
+    return -1;
+}
+
+// Pipelined: every request of a phase goes out before the first reply is read,
+// so each phase costs about one round trip regardless of the window count.
+// Scoped queries read desktops first and only fetch the rest for windows in scope.
+void fetch_window_infos(const Window *wins, int count, WindowInfo *infos, int *keep,
+                        unsigned fetch, int current_workspace_only, long current_desktop) {
+    enum { PROP_CLASS, PROP_NET_NAME, PROP_NAME, PROP_DESKTOP, PROPS_PER_WINDOW };
+
+    if (count <= 0) return;
+
+    xcb_connection_t *conn = XGetXCBConnection(display);
+    xcb_get_property_cookie_t *cookies = malloc(sizeof(*cookies) * (size_t)count * PROPS_PER_WINDOW);
+    if (!cookies) {
+        for (int i = 0; i < count; i++) {
+            keep[i] = load_window_info(wins[i], &infos[i], fetch, current_workspace_only, current_desktop);
+        }
+        return;
+    }
+
+    int want_desktop = (fetch & FETCH_DESKTOP) || current_workspace_only;
+    for (int i = 0; i < count; i++) {
+        reset_window_info(&infos[i], wins[i]);
+        keep[i] = 1;
+    }
+
+    if (current_workspace_only) {
+        TraceMark mark = trace_begin();
+        trace_round_trips++;
+        for (int i = 0; i < count; i++) {
+            cookies[i * PROPS_PER_WINDOW + PROP_DESKTOP] =
+                xcb_get_property(conn, 0, (xcb_window_t)wins[i], (xcb_atom_t)atom_net_wm_desktop,
+                                 XCB_ATOM_CARDINAL, 0, 1);
+        }
+        for (int i = 0; i < count; i++) {
+            xcb_get_property_reply_t *reply = xcb_property_reply(conn, cookies[i * PROPS_PER_WINDOW + PROP_DESKTOP]);
+            infos[i].desktop = xcb_reply_cardinal(reply);
+            infos[i].loaded |= FETCH_DESKTOP;
+            keep[i] = in_scope(infos[i].desktop, current_workspace_only, current_desktop);
+            free(reply);
+        }
+        trace_end(&mark, "discover_fetch_desktops", 0);
+    }
+
+    TraceMark mark = trace_begin();
+    trace_round_trips++;
+
+    for (int i = 0; i < count; i++) {
+        if (!keep[i]) continue;
+        xcb_get_property_cookie_t *c = &cookies[i * PROPS_PER_WINDOW];
+        xcb_window_t win = (xcb_window_t)wins[i];
+        c[PROP_CLASS] = xcb_get_property(conn, 0, win, (xcb_atom_t)atom_wm_class, XCB_ATOM_STRING,
+                                         0, WM_CLASS_FETCH_LONGS);
+        if (fetch & FETCH_TITLE) {
+            c[PROP_NET_NAME] = xcb_get_property(conn, 0, win, (xcb_atom_t)atom_net_wm_name,
+                                                (xcb_atom_t)atom_utf8_string, 0, TITLE_FETCH_LONGS);
+            c[PROP_NAME] = xcb_get_property(conn, 0, win, XCB_ATOM_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY,
+                                            0, TITLE_FETCH_LONGS);
+        }
+        if (want_desktop && !current_workspace_only) {
+            c[PROP_DESKTOP] = xcb_get_property(conn, 0, win, (xcb_atom_t)atom_net_wm_desktop,
+                                               XCB_ATOM_CARDINAL, 0, 1);
+        }
+    }
+
+    // Sizes for WM_CLASS values longer than the first read, refetched in one extra phase
+    uint32_t *class_longs = NULL;
+    int class_refetches = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (!keep[i]) continue;
+        xcb_get_property_cookie_t *c = &cookies[i * PROPS_PER_WINDOW];
+        WindowInfo *info = &infos[i];
+
+        xcb_get_property_reply_t *reply = xcb_property_reply(conn, c[PROP_CLASS]);
+        keep[i] = 0;
+        if (reply && reply->type != XCB_NONE && reply->format == 8) {
+            if (reply->bytes_after > 0 &&
+                (class_longs || (class_longs = calloc((size_t)count, sizeof(*class_longs))))) {
+                class_longs[i] = (reply->value_len + reply->bytes_after + 3) / 4;
+                class_refetches++;
+            } else {
+                keep[i] = copy_wm_class(xcb_get_property_value(reply),
+                                        (size_t)xcb_get_property_value_length(reply),
+                                        info->wm_class, MAX_CLASS_LEN, info->instance, MAX_CLASS_LEN);
+            }
+        }
+        free(reply);
+
+        if (fetch & FETCH_TITLE) {
+            // Same precedence as get_window_title(): _NET_WM_NAME, then WM_NAME
+            xcb_get_property_reply_t *net_name = xcb_property_reply(conn, c[PROP_NET_NAME]);
+            xcb_get_property_reply_t *name = xcb_property_reply(conn, c[PROP_NAME]);
+            xcb_get_property_reply_t *title = NULL;
+            if (net_name && net_name->type != XCB_NONE) {
+                title = net_name;
+            } else if (name && name->type == XCB_ATOM_STRING && name->format == 8) {
+                title = name;
+            }
+            if (title) {
+                size_t len = (size_t)xcb_get_property_value_length(title);
+                if (len > MAX_TITLE_LEN - 1) len = MAX_TITLE_LEN - 1;
+                memcpy(info->title, xcb_get_property_value(title), len);
+                info->title[len] = '\0';
+            } else {
+                strcpy(info->title, "(untitled)");
+            }
+            info->loaded |= FETCH_TITLE;
+            free(net_name);
+            free(name);
+        }
+
+        if (want_desktop && !current_workspace_only) {
+            reply = xcb_property_reply(conn, c[PROP_DESKTOP]);
+            info->desktop = xcb_reply_cardinal(reply);
+            info->loaded |= FETCH_DESKTOP;
+            free(reply);
+        }
+    }
+    trace_end(&mark, "discover_fetch_properties", 0);
+
+    if (class_refetches > 0) {
+        mark = trace_begin();
+        trace_round_trips++;
+        for (int i = 0; i < count; i++) {
+            if (!class_longs[i]) continue;
+            cookies[i * PROPS_PER_WINDOW + PROP_CLASS] =
+                xcb_get_property(conn, 0, (xcb_window_t)wins[i], (xcb_atom_t)atom_wm_class,
+                                 XCB_ATOM_STRING, 0, class_longs[i]);
+        }
+        for (int i = 0; i < count; i++) {
+            if (!class_longs[i]) continue;
+            xcb_get_property_reply_t *reply = xcb_property_reply(conn, cookies[i * PROPS_PER_WINDOW + PROP_CLASS]);
+            if (reply && reply->type != XCB_NONE && reply->format == 8) {
+                keep[i] = copy_wm_class(xcb_get_property_value(reply),
+                                        (size_t)xcb_get_property_value_length(reply),
+                                        infos[i].wm_class, MAX_CLASS_LEN, infos[i].instance, MAX_CLASS_LEN);
+            }
+            free(reply);
+        }
+        trace_end(&mark, "discover_fetch_long_classes", 0);
+    }
+
+    free(class_longs);
+    free(cookies);
+}
+#else
+void fetch_window_infos(const Window *wins, int count, WindowInfo *infos, int *keep,
+                        unsigned fetch, int current_workspace_only, long current_desktop) {
+    for (int i = 0; i < count; i++) {
+        keep[i] = load_window_info(wins[i], &infos[i], fetch, current_workspace_only, current_desktop);
+    }
+}
+#endif
+
+// Reads only what the current mode needs; the scope filter runs before class and title fetches
+int discover_windows(unsigned fetch, int current_workspace_only, long current_desktop) {
+    log_section("DISCOVERING WINDOWS");
+    log_msg("Fetching: class%s%s%s",
+            (fetch & FETCH_DESKTOP) ? " desktop" : "",
+            (fetch & FETCH_TITLE) ? " title" : "",
+            current_workspace_only ? " (desktop filter first)" : "");
+
+    Atom actual_type;
+    int actual_format;
+    unsigned long nitems;
+    unsigned char *prop = NULL;
+
+    if (!get_full_window_property(root, atom_net_client_list, CLIENT_LIST_FETCH_LONGS,
+                                  XA_WINDOW, &actual_type, &actual_format, &nitems, &prop)) {
+        log_msg("ERROR: Cannot get _NET_CLIENT_LIST");
+        return 0;
+    }
+
+    Window *client_list = (Window *)prop;
+    int count = (int)nitems;
+    WindowInfo *infos = malloc(sizeof(*infos) * (size_t)(count > 0 ? count : 1));
+    int *keep = malloc(sizeof(*keep) * (size_t)(count > 0 ? count : 1));
+    if (!infos || !keep || !table_reserve(&windows, count)) {
+        log_msg("ERROR: Out of memory for %d windows", count);
+        free(infos);
+        free(keep);
+        XFree(prop);
+        return 0;
+    }
+
+    fetch_window_infos(client_list, count, infos, keep, fetch, current_workspace_only, current_desktop);
+
+    table_clear(&windows);
+    for (int i = 0; i < count; i++) {
+        if (!keep[i]) {
+            continue;
+        }
+        if (table_append_info(&windows, &infos[i]) < 0) break;
+
+        log_msg("  Found: [%lu] desktop=%ld %s - %s",
+                (unsigned long)infos[i].id,
+                infos[i].desktop,
+                infos[i].wm_class,
+                infos[i].title);
+    }
+
+    free(infos);
+    free(keep);
+    XFree(prop);
+    class_index_dirty = 1;
+    log_msg("Total windows: %d (of %d listed)", windows.count, count);
+    // Out-of-scope windows were never classified, so a scoped miss is not a discovery failure
+    return current_workspace_only ? count > 0 : windows.count > 0;
+}
+
+// Live window table (daemon mode): kept current from PropertyNotify events
+static int window_table_live = 0;
+static int client_list_dirty = 0;
+static long cached_current_desktop = -1;
+static Window cached_active_window = 0;
+static int window_table_changed = 0;
+
+// Hotkey presses seen while draining events; the daemon loop dispatches them
+static XKeyEvent pending_key_event;
+static int key_event_pending = 0;
+static int keyboard_mapping_changed = 0;
+
+// Last hotkey pressed and not yet released, so auto-repeat of a held key fires only once
+static unsigned int held_keycode = 0;
+static Time held_key_time = 0;
+
+// Returns 1 for a KeyPress that should be acted on. Releases and auto-repeat presses return 0.
+// With XKB detectable auto-repeat a held key sends only presses; without it the server sends
+// a release and a press with the same timestamp for every repeat.
+int is_fresh_key_press(const XEvent *event) {
+    if (event->type == KeyRelease) {
+        if (event->xkey.keycode != held_keycode) return 0;
+        if (XEventsQueued(display, QueuedAfterReading) > 0) {
+            XEvent next;
+            XPeekEvent(display, &next);
+            if (next.type == KeyPress && next.xkey.keycode == event->xkey.keycode &&
+                next.xkey.time == event->xkey.time) {
+                return 0;
+            }
+        }
+        held_keycode = 0;
+        return 0;
+    }
+    if (event->type != KeyPress) return 0;
+
+    int repeat = event->xkey.keycode == held_keycode &&
+                 event->xkey.time - held_key_time < KEY_REPEAT_WINDOW_MS;
+    held_keycode = event->xkey.keycode;
+    held_key_time = event->xkey.time;
+    return !repeat;
+}
+
+// Set while the daemon serves a request, so a waiting picker can notice newer requests and a
+// client that gave up. Both stay -1 in one-shot runs.
+static volatile sig_atomic_t daemon_stop_requested = 0;
+static int daemon_listen_fd = -1;
+static int serving_client_fd = -1;
+
+// Requests accepted from the socket and not yet answered, oldest first
+typedef struct {
+    int fd;
+    int valid;
+    JumpRequest req;
+} QueuedRequest;
+
+static QueuedRequest request_queue[MAX_QUEUED_REQUESTS];
+static int queued_requests = 0;
+
+// Connections whose request line is still arriving. Their sockets are non-blocking and are
+// read only when poll() reports data, so a slow or silent client never stalls the daemon.
+typedef struct {
+    int fd;
+    size_t len;
+    long long deadline_ns;
+    char line[MAX_REQUEST_LEN];
+} PendingRead;
+
+static PendingRead pending_reads[MAX_QUEUED_REQUESTS];
+static int num_pending_reads = 0;
+// Queue entries from here on arrived after the request being served
+static int picker_queue_start = 0;
+
+// Requests that would do the same thing; repeats of one are answered together
+int same_jump(const JumpRequest *a, const JumpRequest *b) {
+    return a->number == b->number &&
+           a->current_workspace_only == b->current_workspace_only &&
+           a->current_application_mode == b->current_application_mode &&
+           a->most_recent == b->most_recent &&
+           a->back == b->back &&
+           a->search == b->search &&
+           a->confirm == b->confirm;
+}
+
+// Accepts and parses whatever is waiting on the daemon socket; defined with the socket code
+int accept_pending_requests(void);
+int add_pending_read_fds(struct pollfd *fds, int nfds);
+int pending_read_timeout(int timeout_ms);
+// Hotkeys pressed while a request waits on X; defined with the hotkey code
+int handle_waiting_key_event(const Config *config, const JumpRequest *req, XEvent *event);
+
+// A newer, different request in the queue supersedes the one being served
+int request_superseded(const JumpRequest *current) {
+    for (int i = picker_queue_start; i < queued_requests; i++) {
+        if (!request_queue[i].valid || !same_jump(&request_queue[i].req, current)) return 1;
+    }
+    return 0;
+}
+
+// A scan over the packed id array; 8 bytes per window
+int find_window_index(Window win) {
+    for (int i = 0; i < windows.count; i++) {
+        if (windows.ids[i] == win) return i;
+    }
+    return -1;
+}
+
+// Focus history: every _NET_ACTIVE_WINDOW change stamps the window with the next
+// focus_clock value, so ordering a class's windows by focus_seq gives its MRU list.
+static uint64_t focus_clock = 0;
+static Window focus_stamped_window = 0;
+
+// Also called after a sync: a new window is often activated before it is listed
+void note_active_window(void) {
+    if (cached_active_window == 0 || cached_active_window == focus_stamped_window) return;
+    int idx = find_window_index(cached_active_window);
+    if (idx < 0) return;
+    windows.focus_seq[idx] = ++focus_clock;
+    focus_stamped_window = cached_active_window;
+}
+
+#ifdef WINLEAP_THUMBNAILS
+// Thumbnail cache (daemon only). Every tracked window gets a Damage object; a DamageNotify
+// only marks its thumbnail stale. Composite only keeps a pixmap for a window while it is
+// viewable, and the picker lists windows that are not, so stale thumbnails are re-scaled from
+// the daemon's idle loop while the window is still on screen: Composite names the backing
+// pixmap and Render scales it into a cached pixmap, entirely server side. The picker then only
+// shows what is already rendered and makes no round trips for it.
+#define THUMBNAIL_WIDTH 240
+#define THUMBNAIL_MAX_HEIGHT 180
+#define THUMBNAIL_REFRESH_MS 1000  // per window: a busy window is re-scaled at most this often
+
+typedef struct {
+    Window id;
+    Damage damage;
+    int win_w, win_h;  // of the frame
+    Pixmap thumb;
+    Picture thumb_picture;
+    int thumb_w, thumb_h;
+    int stale;
+    int rendered;  // thumb holds an image of the window
+    long long refreshed_ns;
+    int keep;  // sync_thumbnails() mark
+} Thumbnail;
+
+static Thumbnail *thumbnails;  // sorted by id
+static int thumbnail_count;
+static int thumbnails_active;
+static int damage_event_base;
+static XRenderPictFormat *thumbnail_format;
+
+static int compare_thumbnails(const void *a, const void *b) {
+    Window x = ((const Thumbnail *)a)->id;
+    Window y = ((const Thumbnail *)b)->id;
+    return x < y ? -1 : x > y;
+}
+
+static Thumbnail *find_thumbnail(Window win) {
+    Thumbnail key = { .id = win };
+    return bsearch(&key, thumbnails, (size_t)thumbnail_count, sizeof(Thumbnail), compare_thumbnails);
+}
+
+static void drop_thumbnail_pixmap(Thumbnail *t) {
+    if (t->thumb_picture) XRenderFreePicture(display, t->thumb_picture);
+    if (t->thumb) XFreePixmap(display, t->thumb);
+    t->thumb_picture = 0;
+    t->thumb = 0;
+    t->rendered = 0;
+}
+
+// New table windows get a Damage object, windows that left the table lose theirs
+void sync_thumbnails(void) {
+    if (!thumbnails_active) return;
+
+    Thumbnail *next = malloc(sizeof(*next) * (size_t)(windows.count > 0 ? windows.count : 1));
+    if (!next) return;
+    for (int i = 0; i < thumbnail_count; i++) thumbnails[i].keep = 0;
+
+    int count = 0;
+    for (int i = 0; i < windows.count; i++) {
+        Thumbnail *t = find_thumbnail(windows.ids[i]);
+        if (t) {
+            t->keep = 1;
+            next[count++] = *t;
+            continue;
+        }
+        next[count] = (Thumbnail){ .id = windows.ids[i], .stale = 1 };
+        next[count].damage = XDamageCreate(display, windows.ids[i], XDamageReportNonEmpty);
+        count++;
+    }
+    for (int i = 0; i < thumbnail_count; i++) {
+        if (thumbnails[i].keep) continue;
+        drop_thumbnail_pixmap(&thumbnails[i]);
+        // Destroyed windows take their Damage with them; the resulting BadDamage is only logged
+        XDamageDestroy(display, thumbnails[i].damage);
+    }
+
+    qsort(next, (size_t)count, sizeof(*next), compare_thumbnails);
+    free(thumbnails);
+    thumbnails = next;
+    thumbnail_count = count;
+}
+
+int init_thumbnails(void) {
+    if (thumbnails_active) return 1;
+
+    int major = 0, minor = 2, error_base = 0, render_event_base = 0;
+    if (!XCompositeQueryExtension(display, &render_event_base, &error_base) ||
+        !XCompositeQueryVersion(display, &major, &minor) || (major == 0 && minor < 2) ||
+        !XDamageQueryExtension(display, &damage_event_base, &error_base) ||
+        !XRenderQueryExtension(display, &render_event_base, &error_base)) {
+        log_msg("WARNING: Composite 0.2, Damage and Render are needed for thumbnails");
+        return 0;
+    }
+    thumbnail_format = XRenderFindVisualFormat(display, DefaultVisual(display, DefaultScreen(display)));
+    if (!thumbnail_format) return 0;
+
+    // Automatic redirection gives every top-level window a backing pixmap, which the server
+    // then copies to the screen itself; see the README for what that costs
+    XCompositeRedirectSubwindows(display, root, CompositeRedirectAutomatic);
+    thumbnails_active = 1;
+    sync_thumbnails();
+    log_msg("Thumbnails: tracking %d windows", thumbnail_count);
+    return 1;
+}
+
+static int handle_thumbnail_event(const XEvent *event) {
+    if (!thumbnails_active || event->type != damage_event_base + XDamageNotify) return 0;
+
+    const XDamageNotifyEvent *de = (const XDamageNotifyEvent *)event;
+    Thumbnail *t = find_thumbnail(de->drawable);
+    if (t) t->stale = 1;
+    return 1;
+}
+
+// Only root's children are redirected, so under a reparenting WM that is the frame
+static Window toplevel_ancestor(Window win) {
+    while (1) {
+        Window root_return, parent, *children = NULL;
+        unsigned int n = 0;
+        if (!XQueryTree(display, win, &root_return, &parent, &children, &n)) return 0;
+        if (children) XFree(children);
+        if (parent == root_return || parent == None) return win;
+        win = parent;
+    }
+}
+
+// Re-scales a stale thumbnail while its window is viewable. The damage is only subtracted
+// here, so a window that keeps redrawing (video, a busy terminal) sends one DamageNotify per
+// refresh, not per frame. A window that is not viewable keeps its last image.
+static void refresh_thumbnail(Thumbnail *t, long long now) {
+    t->stale = 0;
+    t->refreshed_ns = now;
+    XDamageSubtract(display, t->damage, None, None);
+
+    // Looked up each time: the WM may reparent a window after it first drew
+    Window frame = toplevel_ancestor(t->id);
+    XWindowAttributes attrs;
+    if (!frame || !XGetWindowAttributes(display, frame, &attrs)) return;
+    if (attrs.map_state != IsViewable || attrs.width <= 0 || attrs.height <= 0) return;
+    XRenderPictFormat *format = XRenderFindVisualFormat(display, attrs.visual);
+    if (!format) return;
+
+    if (attrs.width != t->win_w || attrs.height != t->win_h) {
+        t->win_w = attrs.width;
+        t->win_h = attrs.height;
+        drop_thumbnail_pixmap(t);
+    }
+    double scale = (double)THUMBNAIL_WIDTH / t->win_w;
+    if (t->win_h * scale > THUMBNAIL_MAX_HEIGHT) scale = (double)THUMBNAIL_MAX_HEIGHT / t->win_h;
+    if (scale > 1.0) scale = 1.0;
+
+    if (!t->thumb) {
+        t->thumb_w = (int)(t->win_w * scale + 0.5);
+        t->thumb_h = (int)(t->win_h * scale + 0.5);
+        if (t->thumb_w < 1) t->thumb_w = 1;
+        if (t->thumb_h < 1) t->thumb_h = 1;
+        t->thumb = XCreatePixmap(display, root, (unsigned)t->thumb_w, (unsigned)t->thumb_h,
+                                 (unsigned)DefaultDepth(display, DefaultScreen(display)));
+        t->thumb_picture = XRenderCreatePicture(display, t->thumb, thumbnail_format, 0, NULL);
+    }
+
+    // The backing pixmap changes on every map and resize, so it is named afresh each time. A
+    // window unmapped since the check above makes this fail with BadMatch, which is only logged.
+    Pixmap source_pixmap = XCompositeNameWindowPixmap(display, frame);
+    Picture source = XRenderCreatePicture(display, source_pixmap, format, 0, NULL);
+    XTransform transform = {{
+        { XDoubleToFixed(1.0 / scale), 0, 0 },
+        { 0, XDoubleToFixed(1.0 / scale), 0 },
+        { 0, 0, XDoubleToFixed(1.0) },
+    }};
+    XRenderSetPictureTransform(display, source, &transform);
+    XRenderSetPictureFilter(display, source, FilterBilinear, NULL, 0);
+    XRenderComposite(display, PictOpSrc, source, None, t->thumb_picture, 0, 0, 0, 0, 0, 0,
+                     (unsigned)t->thumb_w, (unsigned)t->thumb_h);
+    XRenderFreePicture(display, source);
+    XFreePixmap(display, source_pixmap);
+    t->rendered = 1;
+}
+
+// Runs from the daemon's idle loop, so its round trips stay off the jump path. Returns the
+// poll() timeout that brings the daemon back for a refresh held off, or -1.
+int refresh_stale_thumbnails(void) {
+    if (!thumbnails_active) return -1;
+    long long now = monotonic_ns();
+    long long interval = (long long)THUMBNAIL_REFRESH_MS * 1000000;
+    long long next_due = -1;
+    int refreshed = 0;
+    for (int i = 0; i < thumbnail_count; i++) {
+        Thumbnail *t = &thumbnails[i];
+        if (!t->stale) continue;
+        long long due = t->refreshed_ns + interval;
+        if (now >= due) {
+            refresh_thumbnail(t, now);
+            refreshed++;
+        } else if (next_due < 0 || due < next_due) {
+            next_due = due;
+        }
+    }
+    if (refreshed) XFlush(display);
+    return next_due < 0 ? -1 : (int)((next_due - now + 999999) / 1000000);
+}
+
+// Never renders: a candidate the picker lists is not viewable, so there is nothing to name
+int window_thumbnail(Window win, Pixmap *pixmap, int *width, int *height) {
+    Thumbnail *t = thumbnails_active ? find_thumbnail(win) : NULL;
+    if (!t || !t->rendered) return 0;
+    *pixmap = t->thumb;
+    *width = t->thumb_w;
+    *height = t->thumb_h;
+    return 1;
+}
+#endif
+
+// Re-reads _NET_CLIENT_LIST and rebuilds the table in list order, fetching only new windows
+int sync_client_list(void) {
+    Atom actual_type;
+    int actual_format;
+    unsigned long nitems;
+    unsigned char *prop = NULL;
+
+    client_list_dirty = 0;
+
+    if (!get_full_window_property(root, atom_net_client_list, CLIENT_LIST_FETCH_LONGS,
+                                  XA_WINDOW, &actual_type, &actual_format, &nitems, &prop)) {
+        log_msg("ERROR: Cannot get _NET_CLIENT_LIST");
+        return 0;
+    }
+
+    // The next table is built beside the current one, which also compacts its string arena
+    static WindowTable next;
+    Window *client_list = (Window *)prop;
+    int count = (int)nitems;
+    Window *new_ids = malloc(sizeof(*new_ids) * (size_t)(count > 0 ? count : 1));
+    int *new_slots = malloc(sizeof(*new_slots) * (size_t)(count > 0 ? count : 1));
+    if (!new_ids || !new_slots || !table_reserve(&next, count)) {
+        log_msg("ERROR: Out of memory for %d windows", count);
+        free(new_ids);
+        free(new_slots);
+        XFree(prop);
+        return 0;
+    }
+
+    table_clear(&next);
+    int added = 0;
+    int guess = 0;  // the list rarely reorders, so the next window is usually the one after
+    for (int i = 0; i < count; i++) {
+        Window win = client_list[i];
+        int idx = guess < windows.count && windows.ids[guess] == win ? guess : find_window_index(win);
+        if (idx >= 0) {
+            guess = idx + 1;
+            if (table_append_row(&next, &windows, idx) < 0) break;
+            continue;
+        }
+
+        // Select before reading so no change between the fetch and the subscription is lost
+        XSelectInput(display, win, PropertyChangeMask);
+        int slot = table_append(&next, win);
+        if (slot < 0) break;
+        new_ids[added] = win;
+        new_slots[added] = slot;
+        added++;
+    }
+
+    if (added > 0) {
+        WindowInfo *fetched = malloc(sizeof(*fetched) * (size_t)added);
+        int *has_class = malloc(sizeof(*has_class) * (size_t)added);
+        if (fetched && has_class) {
+            fetch_window_infos(new_ids, added, fetched, has_class, FETCH_ALL, 0, -1);
+            for (int i = 0; i < added; i++) {
+                table_set_info(&next, new_slots[i], &fetched[i]);
+                log_msg("  Tracking: [%lu] desktop=%ld %s - %s",
+                        (unsigned long)fetched[i].id,
+                        fetched[i].desktop,
+                        fetched[i].wm_class,
+                        fetched[i].title);
+            }
+        }
+        free(fetched);
+        free(has_class);
+    }
+
+    int removed = windows.count + added - next.count;
+    table_swap(&windows, &next);
+    window_table_changed = 1;
+    class_index_dirty = 1;
+    note_active_window();
+#ifdef WINLEAP_THUMBNAILS
+    sync_thumbnails();
+#endif
+
+    free(new_ids);
+    free(new_slots);
+    XFree(prop);
+    log_msg("Client list synced: %d windows (+%d, -%d)", windows.count, added, removed);
+    return 1;
+}
+
+int fill_socket_address(struct sockaddr_un *addr, const char *socket_path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr->sun_path)) return 0;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", socket_path);
+    return 1;
+}
+
+int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+// Compositor backends. Under sway and Hyprland there is no root window to read, so the same
+// window table is filled over the compositor's IPC socket instead: a full dump when a process
+// starts, then, in the daemon, the compositor's event stream keeps it current the way
+// PropertyNotify does on X11. Ids are sway container ids and Hyprland window addresses;
+// desktops are sway workspace container ids and Hyprland workspace ids.
+typedef struct {
+    WindowInfo *items;
+    int count;
+    int capacity;
+} InfoList;
+
+typedef struct {
+    const char *name;
+    int (*dump)(InfoList *out);  // every window; also sets the cached desktop and active window
+    int (*subscribe)(void);      // connects the event stream, returns its fd or -1
+    size_t (*parse_events)(char *buf, size_t len);  // handles whole events, returns bytes used
+    int (*focus)(Window id);
+    // The instance picker: binds the selector keys of the first count candidates, which come
+    // back on the event stream, and labels the candidates. open returns 0 after reporting why
+    // it cannot.
+    int (*picker_open)(const Config *config, const int *indices, int count);
+    void (*picker_close)(const Config *config, int count);
+} Compositor;
+
+static const Compositor *compositor = NULL;  // NULL on X11
+static int compositor_event_fd = -1;
+static char *compositor_events = NULL;  // event stream bytes not yet parsed
+static size_t compositor_events_len = 0;
+static size_t compositor_events_cap = 0;
+static int compositor_resync_needed = 0;  // an event left a window's desktop or title unknown
+static int compositor_lost = 0;
+static int compositor_picking = 0;     // a picker's mode or submap is active
+static int compositor_picker_key = 0;  // the selector key it reported, -1 when it was left
+
+// Names the picker shares with the compositor config: the sway mode or Hyprland submap, the
+// command or event data its key bindings carry, and the sway marks labelling candidates
+#define PICKER_MODE "winleap"
+#define PICKER_BINDING "winleap-pick"
+#define PICKER_MARK "winleap:"
+#define PICKER_NOTIFY_MS 60000
+static Window *closed_windows = NULL;  // rows dropped between requests, like a client list sync
+static int closed_count = 0;
+static int closed_capacity = 0;
+
+static int info_list_push(InfoList *list, const WindowInfo *info) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : INITIAL_WINDOW_CAPACITY;
+        WindowInfo *grown = realloc(list->items, sizeof(*grown) * (size_t)capacity);
+        if (!grown) return 0;
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = *info;
+    return 1;
+}
+
+// Just enough JSON to read IPC replies in place: a value is addressed by a pointer to its
+// first character and skipped over, never copied into a tree
+static const char *json_ws(const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+    return p;
+}
+
+static const char *json_skip_string(const char *p) {
+    for (p++; *p && *p != '"'; p++) {
+        if (*p == '\\' && p[1]) p++;
+    }
+    return *p == '"' ? p + 1 : NULL;
+}
+
+// Past one value of any type, NULL on malformed input
+static const char *json_skip(const char *p) {
+    p = json_ws(p);
+    if (*p == '"') return json_skip_string(p);
+    if (*p == '{' || *p == '[') {
+        int depth = 0;
+        while (*p) {
+            if (*p == '"') {
+                p = json_skip_string(p);
+                if (!p) return NULL;
+                continue;
+            }
+            if (*p == '{' || *p == '[') {
+                depth++;
+            } else if ((*p == '}' || *p == ']') && --depth == 0) {
+                return p + 1;
+            }
+            p++;
+        }
+        return NULL;
+    }
+    const char *start = p;
+    while (*p && !strchr(",}] \t\r\n", *p)) p++;
+    return p > start ? p : NULL;
+}
+
+// The value of `key` among the object's own members, or NULL
+static const char *json_member(const char *object, const char *key) {
+    if (!object) return NULL;
+    const char *p = json_ws(object);
+    if (*p != '{') return NULL;
+    size_t key_len = strlen(key);
+    p = json_ws(p + 1);
+    while (*p == '"') {
+        const char *end = json_skip_string(p);
+        if (!end) return NULL;
+        int match = (size_t)(end - p - 2) == key_len && memcmp(p + 1, key, key_len) == 0;
+        p = json_ws(end);
+        if (*p != ':') return NULL;
+        const char *value = json_ws(p + 1);
+        if (match) return value;
+        p = json_skip(value);
+        if (!p) return NULL;
+        p = json_ws(p);
+        if (*p != ',') return NULL;
+        p = json_ws(p + 1);
+    }
+    return NULL;
+}
+
+static const char *json_array_first(const char *array) {
+    if (!array) return NULL;
+    const char *p = json_ws(array);
+    if (*p != '[') return NULL;
+    p = json_ws(p + 1);
+    return *p && *p != ']' ? p : NULL;
+}
+
+static const char *json_array_next(const char *element) {
+    const char *p = json_skip(element);
+    if (!p) return NULL;
+    p = json_ws(p);
+    return *p == ',' ? json_ws(p + 1) : NULL;
+}
+
+static size_t utf8_encode(unsigned cp, char *out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xc0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3f));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xe0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        out[2] = (char)(0x80 | (cp & 0x3f));
+        return 3;
+    }
+    out[0] = (char)(0xf0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+    out[3] = (char)(0x80 | (cp & 0x3f));
+    return 4;
+}
+
+static unsigned json_hex4(const char *p) {
+    unsigned cp = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = isdigit((unsigned char)p[i]) ? p[i] - '0' :
+                    isxdigit((unsigned char)p[i]) ? tolower((unsigned char)p[i]) - 'a' + 10 : -1;
+        if (digit < 0) return 0xfffd;
+        cp = cp * 16 + (unsigned)digit;
+    }
+    return cp;
+}
+
+// Decodes a string value, truncated to fit; 0 (and "") when the value is not a string
+static int json_string(const char *value, char *out, size_t size) {
+    out[0] = '\0';
+    if (!value || *value != '"' || size == 0) return 0;
+    size_t n = 0;
+    for (const char *p = value + 1; *p && *p != '"'; p++) {
+        char bytes[4];
+        size_t len = 1;
+        bytes[0] = *p;
+        if (*p == '\\') {
+            p++;
+            switch (*p) {
+            case 'n': bytes[0] = '\n'; break;
+            case 't': bytes[0] = '\t'; break;
+            case 'r': bytes[0] = '\r'; break;
+            case 'b': bytes[0] = '\b'; break;
+            case 'f': bytes[0] = '\f'; break;
+            case 'u': {
+                unsigned cp = strnlen(p + 1, 4) == 4 ? json_hex4(p + 1) : 0xfffd;
+                p += strnlen(p + 1, 4);
+                if (cp >= 0xd800 && cp < 0xdc00 && p[1] == '\\' && p[2] == 'u' && strnlen(p + 3, 4) == 4) {
+                    unsigned low = json_hex4(p + 3);
+                    if (low >= 0xdc00 && low < 0xe000) {
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                        p += 6;
+                    }
+                }
+                len = utf8_encode(cp, bytes);
+                break;
+            }
+            case '\0': p--; continue;
+            default: bytes[0] = *p; break;
+            }
+        }
+        if (n + len >= size) break;
+        memcpy(out + n, bytes, len);
+        n += len;
+    }
+    out[n] = '\0';
+    return 1;
+}
+
+static int json_long(const char *value, long long *out) {
+    if (!value) return 0;
+    char *end = NULL;
+    long long v = strtoll(value, &end, 10);
+    if (end == value) return 0;
+    *out = v;
+    return 1;
+}
+
+static int json_true(const char *value) {
+    return value && strncmp(value, "true", 4) == 0;
+}
+
+static int ipc_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (!path || !fill_socket_address(&addr, path)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int read_exact(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+// Event stream updates. Rows are only appended or changed in place while a request may hold
+// indices; closed windows are blanked, so they match nothing, and dropped between requests.
+static void compositor_window_opened(const WindowInfo *info) {
+    int idx = find_window_index(info->id);
+    if (idx < 0) {
+        idx = table_append_info(&windows, info);
+    } else if (!table_set_info(&windows, idx, info)) {
+        idx = -1;
+    }
+    if (idx < 0) {
+        compositor_resync_needed = 1;
+        return;
+    }
+    class_index_dirty = 1;
+    window_table_changed = 1;
+    // The new window's focus event may have come first
+    note_active_window();
+    log_msg("  Tracking: [%lu] desktop=%ld %s - %s", (unsigned long)info->id, info->desktop,
+            info->wm_class, info->title);
+}
+
+static void compositor_window_closed(Window id) {
+    int idx = find_window_index(id);
+    if (idx < 0) return;
+    if (closed_count == closed_capacity) {
+        int capacity = closed_capacity ? closed_capacity * 2 : 16;
+        Window *grown = realloc(closed_windows, sizeof(*grown) * (size_t)capacity);
+        if (!grown) {
+            compositor_resync_needed = 1;
+            return;
+        }
+        closed_windows = grown;
+        closed_capacity = capacity;
+    }
+    closed_windows[closed_count++] = id;
+    table_set_class(&windows, idx, "");
+    table_set_instance(&windows, idx, "");
+    table_set_title(&windows, idx, "");
+    class_index_dirty = 1;
+    window_table_changed = 1;
+    log_msg("  Closed: [%lu]", (unsigned long)id);
+}
+
+static void compositor_window_focused(Window id) {
+    cached_active_window = id;
+    note_active_window();
+    window_table_changed = 1;
+}
+
+static void compositor_window_retitled(Window id, const char *title) {
+    int idx = find_window_index(id);
+    if (idx < 0) return;
+    table_set_title(&windows, idx, title);
+    windows.loaded[idx] |= FETCH_TITLE;
+    window_table_changed = 1;
+}
+
+static void compositor_window_moved(Window id, long desktop) {
+    int idx = find_window_index(id);
+    if (idx < 0) return;
+    long old_desktop = windows.desktops[idx];
+    windows.desktops[idx] = desktop;
+    if (desktop != old_desktop) move_desktop_bucket(idx, old_desktop);
+    window_table_changed = 1;
+    log_msg("Desktop changed: [%lu] -> %ld", (unsigned long)id, desktop);
+}
+
+// A picker binding fired; keys arrive as keysym names ("q", "semicolon"), like the config takes
+static void compositor_picker_pressed(const char *keysym_name) {
+    if (!compositor_picking) return;
+    KeySym keysym = XStringToKeysym(keysym_name);
+    if (keysym == NoSymbol || keysym >= 128 || !isprint((int)keysym)) {
+        log_msg("Ignored picker key '%s'", keysym_name);
+        return;
+    }
+    compositor_picker_key = tolower((int)keysym);
+}
+
+static void compositor_desktop_focused(long desktop) {
+    cached_current_desktop = desktop;
+    window_table_changed = 1;
+    log_msg("Current desktop changed: %ld", desktop);
+}
+
+// sway speaks the i3 IPC protocol: "i3-ipc", then payload length and type as native u32s.
+// Replies come back in order on a connection; events, with the high type bit set, only on a
+// connection that subscribed.
+#define I3_IPC_MAGIC "i3-ipc"
+#define I3_IPC_HEADER_LEN 14
+#define I3_RUN_COMMAND 0u
+#define I3_SUBSCRIBE 2u
+#define I3_GET_TREE 4u
+#define I3_EVENT_WORKSPACE 0x80000000u
+#define I3_EVENT_MODE 0x80000002u
+#define I3_EVENT_WINDOW 0x80000003u
+#define I3_EVENT_BINDING 0x80000005u
+
+static int sway_fd = -1;  // command connection, kept open across requests
+
+// Returns the reply payload, NUL-terminated, for the caller to free()
+static char *sway_message(int fd, uint32_t type, const char *payload) {
+    uint32_t len = (uint32_t)strlen(payload);
+    char header[I3_IPC_HEADER_LEN];
+    memcpy(header, I3_IPC_MAGIC, 6);
+    memcpy(header + 6, &len, 4);
+    memcpy(header + 10, &type, 4);
+    trace_round_trips++;
+    if (!write_all(fd, header, sizeof(header)) || !write_all(fd, payload, len)) return NULL;
+
+    if (!read_exact(fd, header, sizeof(header)) || memcmp(header, I3_IPC_MAGIC, 6) != 0) return NULL;
+    uint32_t reply_len;
+    memcpy(&reply_len, header + 6, 4);
+    char *reply = malloc((size_t)reply_len + 1);
+    if (!reply || !read_exact(fd, reply, reply_len)) {
+        free(reply);
+        return NULL;
+    }
+    reply[reply_len] = '\0';
+    return reply;
+}
+
+static char *sway_request(uint32_t type, const char *payload) {
+    // A failed send usually means sway restarted; reconnect once
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (sway_fd < 0) sway_fd = ipc_connect(getenv("SWAYSOCK"));
+        if (sway_fd < 0) return NULL;
+        char *reply = sway_message(sway_fd, type, payload);
+        if (reply) return reply;
+        close(sway_fd);
+        sway_fd = -1;
+    }
+    return NULL;
+}
+
+// Native windows have an app_id; Xwayland ones carry their WM_CLASS in window_properties
+static int sway_is_view(const char *node) {
+    char type[16];
+    json_string(json_member(node, "type"), type, sizeof(type));
+    if (strcmp(type, "con") != 0 && strcmp(type, "floating_con") != 0) return 0;
+    const char *props = json_member(node, "window_properties");
+    if (props && *props == '{') return 1;
+    const char *app_id = json_member(node, "app_id");
+    return app_id && *app_id == '"';
+}
+
+static void sway_window_info(const char *node, long workspace, WindowInfo *info) {
+    long long id = 0;
+    json_long(json_member(node, "id"), &id);
+    reset_window_info(info, (Window)id);
+    const char *props = json_member(node, "window_properties");
+    json_string(json_member(props, "class"), info->wm_class, sizeof(info->wm_class));
+    json_string(json_member(props, "instance"), info->instance, sizeof(info->instance));
+    if (!info->wm_class[0]) json_string(json_member(node, "app_id"), info->wm_class, sizeof(info->wm_class));
+    if (!info->instance[0]) snprintf(info->instance, sizeof(info->instance), "%s", info->wm_class);
+    json_string(json_member(node, "name"), info->title, sizeof(info->title));
+    info->desktop = workspace;
+    info->loaded = FETCH_ALL;
+}
+
+static int sway_walk(const char *node, long workspace, InfoList *out) {
+    char type[16];
+    json_string(json_member(node, "type"), type, sizeof(type));
+    long long id = 0;
+    json_long(json_member(node, "id"), &id);
+    if (strcmp(type, "workspace") == 0) workspace = (long)id;
+
+    int view = sway_is_view(node);
+    if (json_true(json_member(node, "focused"))) {
+        // An empty workspace is focused itself and has no active window
+        cached_current_desktop = workspace;
+        cached_active_window = view ? (Window)id : 0;
+    }
+    if (view) {
+        WindowInfo info;
+        sway_window_info(node, workspace, &info);
+        if (!info_list_push(out, &info)) return 0;
+    }
+
+    static const char *const children[] = { "nodes", "floating_nodes" };
+    for (int c = 0; c < 2; c++) {
+        for (const char *child = json_array_first(json_member(node, children[c])); child;
+             child = json_array_next(child)) {
+            if (!sway_walk(child, workspace, out)) return 0;
+        }
+    }
+    return 1;
+}
+
+static int sway_dump(InfoList *out) {
+    char *tree = sway_request(I3_GET_TREE, "");
+    if (!tree) return 0;
+    cached_current_desktop = -1;
+    cached_active_window = 0;
+    int ok = sway_walk(tree, -1, out);
+    free(tree);
+    return ok;
+}
+
+static int sway_subscribe(void) {
+    int fd = ipc_connect(getenv("SWAYSOCK"));
+    if (fd < 0) return -1;
+    char *reply = sway_message(fd, I3_SUBSCRIBE, "[\"window\",\"workspace\",\"mode\",\"binding\"]");
+    int ok = reply && json_true(json_member(reply, "success"));
+    free(reply);
+    if (!ok) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void sway_event(uint32_t type, const char *payload) {
+    metrics.events++;
+    metrics_dirty = 1;
+    char change[32];
+    json_string(json_member(payload, "change"), change, sizeof(change));
+
+    if (type == I3_EVENT_WORKSPACE) {
+        const char *current = json_member(payload, "current");
+        long long id;
+        if (strcmp(change, "focus") != 0 || !json_long(json_member(current, "id"), &id)) return;
+        compositor_desktop_focused((long)id);
+        if (json_true(json_member(current, "focused"))) compositor_window_focused(0);
+        return;
+    }
+    if (type == I3_EVENT_MODE) {
+        // Escape in the picker mode, or anything else that leaves it, cancels the picker
+        if (compositor_picking && strcmp(change, PICKER_MODE) != 0) compositor_picker_key = -1;
+        return;
+    }
+    if (type == I3_EVENT_BINDING) {
+        const char *binding = json_member(payload, "binding");
+        char command[64], symbol[32];
+        json_string(json_member(binding, "command"), command, sizeof(command));
+        if (strcmp(change, "run") != 0 || strcmp(command, "nop " PICKER_BINDING) != 0) return;
+        if (json_string(json_member(binding, "symbol"), symbol, sizeof(symbol))) compositor_picker_pressed(symbol);
+        return;
+    }
+    if (type != I3_EVENT_WINDOW) return;
+
+    const char *container = json_member(payload, "container");
+    long long id;
+    if (!json_long(json_member(container, "id"), &id)) return;
+    if (strcmp(change, "new") == 0) {
+        // Window events do not name the workspace; new windows open on the focused one unless an
+        // assign rule moves them, so confirm it with the next dump
+        WindowInfo info;
+        sway_window_info(container, cached_current_desktop, &info);
+        compositor_window_opened(&info);
+        compositor_resync_needed = 1;
+    } else if (strcmp(change, "close") == 0) {
+        compositor_window_closed((Window)id);
+    } else if (strcmp(change, "focus") == 0) {
+        compositor_window_focused((Window)id);
+    } else if (strcmp(change, "title") == 0) {
+        // Xwayland windows may only now have a class; a title event carries the whole container
+        int idx = find_window_index((Window)id);
+        if (idx < 0) return;
+        WindowInfo info;
+        sway_window_info(container, windows.desktops[idx], &info);
+        if (strcmp(info.wm_class, window_class(idx)) != 0 || strcmp(info.instance, window_instance(idx)) != 0) {
+            table_set_info(&windows, idx, &info);
+            class_index_dirty = 1;
+            window_table_changed = 1;
+        } else {
+            compositor_window_retitled((Window)id, info.title);
+        }
+    } else if (strcmp(change, "move") == 0) {
+        compositor_resync_needed = 1;
+    }
+}
+
+static size_t sway_parse_events(char *buf, size_t len) {
+    size_t used = 0;
+    while (len - used >= I3_IPC_HEADER_LEN) {
+        char *header = buf + used;
+        if (memcmp(header, I3_IPC_MAGIC, 6) != 0) {
+            compositor_lost = 1;
+            return len;
+        }
+        uint32_t payload_len, type;
+        memcpy(&payload_len, header + 6, 4);
+        memcpy(&type, header + 10, 4);
+        if (len - used - I3_IPC_HEADER_LEN < payload_len) break;
+
+        // The buffer keeps a spare byte, so the payload can be terminated in place
+        char *payload = header + I3_IPC_HEADER_LEN;
+        char saved = payload[payload_len];
+        payload[payload_len] = '\0';
+        sway_event(type, payload);
+        payload[payload_len] = saved;
+        used += I3_IPC_HEADER_LEN + payload_len;
+    }
+    return used;
+}
+
+static int sway_command(const char *command) {
+    char *reply = sway_request(I3_RUN_COMMAND, command);
+    int ok = reply && json_true(json_member(json_array_first(reply), "success"));
+    free(reply);
+    return ok;
+}
+
+static int sway_focus(Window id) {
+    char command[64];
+    snprintf(command, sizeof(command), "[con_id=%lu] focus", (unsigned long)id);
+    return sway_command(command);
+}
+
+// sway only defines modes while reading its config, so the picker mode comes from there (see
+// the README); a mark on each candidate shows its key in the title bar
+static int sway_picker_open(const Config *config, const int *indices, int count) {
+    if (!sway_command("mode " PICKER_MODE)) {
+        fprintf(err_stream, "sway has no \"%s\" mode for choosing between windows; see the README\n", PICKER_MODE);
+        log_msg("ERROR: sway refused mode %s", PICKER_MODE);
+        return 0;
+    }
+    char command[64];
+    for (int i = 0; i < count; i++) {
+        snprintf(command, sizeof(command), "[con_id=%lu] mark --add " PICKER_MARK "%c",
+                 (unsigned long)windows.ids[indices[i]], config->instance_keys[i]);
+        sway_command(command);
+    }
+    return 1;
+}
+
+static void sway_picker_close(const Config *config, int count) {
+    char command[64];
+    for (int i = 0; i < count; i++) {
+        snprintf(command, sizeof(command), "unmark " PICKER_MARK "%c", config->instance_keys[i]);
+        sway_command(command);
+    }
+    sway_command("mode default");
+}
+
+static const Compositor sway_compositor = {
+    "sway", sway_dump, sway_subscribe, sway_parse_events, sway_focus, sway_picker_open, sway_picker_close,
+};
+
+// Hyprland: requests go to .socket.sock, one per connection, and events arrive on
+// .socket2.sock as "name>>data" lines
+static int hypr_socket_path(char *out, size_t size, const char *name) {
+    const char *signature = getenv("HYPRLAND_INSTANCE_SIGNATURE");
+    if (!signature || !*signature) return 0;
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) {
+        snprintf(out, size, "%s/hypr/%s/%s", runtime, signature, name);
+        if (access(out, F_OK) == 0) return 1;
+    }
+    // Hyprland before 0.40 kept its sockets under /tmp
+    snprintf(out, size, "/tmp/hypr/%s/%s", signature, name);
+    return 1;
+}
+
+// Returns the whole reply, NUL-terminated, for the caller to free()
+static char *hypr_request(const char *command) {
+    char path[MAX_PATH_LEN];
+    if (!hypr_socket_path(path, sizeof(path), ".socket.sock")) return NULL;
+    int fd = ipc_connect(path);
+    if (fd < 0) return NULL;
+    trace_round_trips++;
+    if (!write_all(fd, command, strlen(command))) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t len = 0;
+    size_t cap = 4096;
+    char *reply = malloc(cap);
+    while (reply) {
+        if (len + 1 == cap) {
+            char *grown = realloc(reply, cap * 2);
+            if (!grown) {
+                free(reply);
+                reply = NULL;
+                break;
+            }
+            reply = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, reply + len, cap - len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += (size_t)n;
+    }
+    close(fd);
+    if (reply) reply[len] = '\0';
+    return reply;
+}
+
+// Window events name workspaces, which are tracked by id; names seen so far map back to ids
+#define MAX_HYPR_WORKSPACES 64
+
+typedef struct {
+    long id;
+    char name[64];
+} HyprWorkspace;
+
+static HyprWorkspace hypr_workspaces[MAX_HYPR_WORKSPACES];
+static int hypr_workspace_count = 0;
+static int hypr_title_events_v2 = 0;  // windowtitlev2 seen: plain windowtitle can be ignored
+static int hypr_picker_bound = 0;     // the picker submap's binds are defined
+
+static void hypr_note_workspace(long id, const char *name) {
+    int i = 0;
+    while (i < hypr_workspace_count && hypr_workspaces[i].id != id) i++;
+    if (i == hypr_workspace_count) {
+        if (i == MAX_HYPR_WORKSPACES) return;
+        hypr_workspace_count++;
+    }
+    hypr_workspaces[i].id = id;
+    snprintf(hypr_workspaces[i].name, sizeof(hypr_workspaces[i].name), "%s", name);
+}
+
+static long hypr_workspace_id(const char *name) {
+    for (int i = 0; i < hypr_workspace_count; i++) {
+        if (strcmp(hypr_workspaces[i].name, name) == 0) return hypr_workspaces[i].id;
+    }
+    return -1;
+}
+
+static int hypr_window_info(const char *client, WindowInfo *info) {
+    char address[32];
+    if (!json_string(json_member(client, "address"), address, sizeof(address))) return 0;
+    reset_window_info(info, (Window)strtoull(address, NULL, 16));
+    json_string(json_member(client, "class"), info->wm_class, sizeof(info->wm_class));
+    if (!info->wm_class[0]) json_string(json_member(client, "initialClass"), info->wm_class, sizeof(info->wm_class));
+    snprintf(info->instance, sizeof(info->instance), "%s", info->wm_class);
+    json_string(json_member(client, "title"), info->title, sizeof(info->title));
+
+    const char *workspace = json_member(client, "workspace");
+    long long id = -1;
+    json_long(json_member(workspace, "id"), &id);
+    char name[64];
+    if (json_string(json_member(workspace, "name"), name, sizeof(name))) hypr_note_workspace((long)id, name);
+    info->desktop = (long)id;
+    info->loaded = FETCH_ALL;
+    return 1;
+}
+
+static int hypr_dump(InfoList *out) {
+    char *clients = hypr_request("j/clients");
+    char *workspace = clients ? hypr_request("j/activeworkspace") : NULL;
+    char *active = workspace ? hypr_request("j/activewindow") : NULL;
+    int ok = active != NULL;
+
+    for (const char *client = json_array_first(clients); ok && client; client = json_array_next(client)) {
+        const char *mapped = json_member(client, "mapped");
+        if (mapped && !json_true(mapped)) continue;
+        WindowInfo info;
+        if (hypr_window_info(client, &info)) ok = info_list_push(out, &info);
+    }
+    if (ok) {
+        long long id = -1;
+        json_long(json_member(workspace, "id"), &id);
+        cached_current_desktop = (long)id;
+        char address[32];
+        json_string(json_member(active, "address"), address, sizeof(address));
+        cached_active_window = (Window)strtoull(address, NULL, 16);
+    }
+    free(clients);
+    free(workspace);
+    free(active);
+    return ok;
+}
+
+static int hypr_subscribe(void) {
+    char path[MAX_PATH_LEN];
+    return hypr_socket_path(path, sizeof(path), ".socket2.sock") ? ipc_connect(path) : -1;
+}
+
+// Splits on the first n - 1 commas only: the last field, a title, may contain commas itself
+static int hypr_fields(char *data, char **fields, int n) {
+    for (int i = 0; i < n; i++) {
+        fields[i] = data;
+        if (i == n - 1) break;
+        char *comma = strchr(data, ',');
+        if (!comma) return 0;
+        *comma = '\0';
+        data = comma + 1;
+    }
+    return 1;
+}
+
+static void hypr_event(char *line) {
+    char *data = strstr(line, ">>");
+    if (!data) return;
+    *data = '\0';
+    data += 2;
+    metrics.events++;
+    metrics_dirty = 1;
+    char *f[4];
+
+    if (strcmp(line, "openwindow") == 0 && hypr_fields(data, f, 4)) {
+        WindowInfo info;
+        reset_window_info(&info, (Window)strtoull(f[0], NULL, 16));
+        snprintf(info.wm_class, sizeof(info.wm_class), "%s", f[2]);
+        snprintf(info.instance, sizeof(info.instance), "%s", f[2]);
+        snprintf(info.title, sizeof(info.title), "%s", f[3]);
+        info.desktop = hypr_workspace_id(f[1]);
+        info.loaded = FETCH_ALL;
+        if (info.desktop < 0) compositor_resync_needed = 1;
+        compositor_window_opened(&info);
+    } else if (strcmp(line, "closewindow") == 0) {
+        compositor_window_closed((Window)strtoull(data, NULL, 16));
+    } else if (strcmp(line, "activewindowv2") == 0) {
+        compositor_window_focused((Window)strtoull(data, NULL, 16));
+    } else if (strcmp(line, "windowtitlev2") == 0 && hypr_fields(data, f, 2)) {
+        hypr_title_events_v2 = 1;
+        compositor_window_retitled((Window)strtoull(f[0], NULL, 16), f[1]);
+    } else if (strcmp(line, "windowtitle") == 0 && !hypr_title_events_v2) {
+        compositor_resync_needed = 1;
+    } else if ((strcmp(line, "workspacev2") == 0 || strcmp(line, "createworkspacev2") == 0 ||
+                strcmp(line, "renameworkspace") == 0) && hypr_fields(data, f, 2)) {
+        hypr_note_workspace(strtol(f[0], NULL, 10), f[1]);
+        if (line[0] == 'w') compositor_desktop_focused(strtol(f[0], NULL, 10));
+    } else if (strcmp(line, "focusedmonv2") == 0 && hypr_fields(data, f, 2)) {
+        compositor_desktop_focused(strtol(f[1], NULL, 10));
+    } else if (strcmp(line, "movewindowv2") == 0 && hypr_fields(data, f, 3)) {
+        hypr_note_workspace(strtol(f[1], NULL, 10), f[2]);
+        compositor_window_moved((Window)strtoull(f[0], NULL, 16), strtol(f[1], NULL, 10));
+    } else if (strcmp(line, "custom") == 0 && strncmp(data, PICKER_BINDING " ", strlen(PICKER_BINDING) + 1) == 0) {
+        compositor_picker_pressed(data + strlen(PICKER_BINDING) + 1);
+    } else if (strcmp(line, "submap") == 0) {
+        // Escape in the picker submap, or anything else that leaves it, cancels the picker
+        if (compositor_picking && strcmp(data, PICKER_MODE) != 0) compositor_picker_key = -1;
+    } else if (strcmp(line, "configreloaded") == 0) {
+        hypr_picker_bound = 0;
+    }
+}
+
+static size_t hypr_parse_events(char *buf, size_t len) {
+    size_t used = 0;
+    char *newline;
+    while ((newline = memchr(buf + used, '\n', len - used)) != NULL) {
+        *newline = '\0';
+        hypr_event(buf + used);
+        used = (size_t)(newline - buf) + 1;
+    }
+    return used;
+}
+
+static int hypr_ok(const char *command) {
+    char *reply = hypr_request(command);
+    int ok = reply && strncmp(reply, "ok", 2) == 0;
+    free(reply);
+    return ok;
+}
+
+static int hypr_focus(Window id) {
+    char command[64];
+    snprintf(command, sizeof(command), "dispatch focuswindow address:0x%lx", (unsigned long)id);
+    return hypr_ok(command);
+}
+
+// Binds added with keyword last until the config is reloaded, and adding them again would
+// double them, so a picker submap left by an earlier process is reused
+static int hypr_picker_defined(void) {
+    char *binds = hypr_request("j/binds");
+    int found = 0;
+    for (const char *bind = json_array_first(binds); bind && !found; bind = json_array_next(bind)) {
+        char submap[sizeof(PICKER_MODE) + 1];
+        json_string(json_member(bind, "submap"), submap, sizeof(submap));
+        found = strcmp(submap, PICKER_MODE) == 0;
+    }
+    free(binds);
+    return found;
+}
+
+// Each selector key in the submap emits a custom event naming itself; Escape resets the submap
+static int hypr_define_picker(const Config *config) {
+    char batch[8192];
+    size_t len = (size_t)snprintf(batch, sizeof(batch), "[[BATCH]]keyword submap %s;", PICKER_MODE);
+    for (const char *key = config->instance_keys; *key && len < sizeof(batch); key++) {
+        const char *name = XKeysymToString((KeySym)(unsigned char)*key);
+        if (!name) continue;
+        len += (size_t)snprintf(batch + len, sizeof(batch) - len, "keyword bind ,%s,event,%s %s;",
+                                name, PICKER_BINDING, name);
+    }
+    if (len < sizeof(batch)) {
+        len += (size_t)snprintf(batch + len, sizeof(batch) - len, "keyword bind ,escape,submap,reset;keyword submap reset");
+    }
+    if (len >= sizeof(batch)) return 0;
+    char *reply = hypr_request(batch);
+    int ok = reply != NULL;
+    free(reply);
+    return ok;
+}
+
+// The submap holds the keyboard; a notification per candidate shows which key picks it
+static int hypr_picker_open(const Config *config, const int *indices, int count) {
+    if (!hypr_picker_bound) hypr_picker_bound = hypr_picker_defined() || hypr_define_picker(config);
+    if (!hypr_picker_bound || !hypr_ok("dispatch submap " PICKER_MODE)) {
+        fprintf(err_stream, "Hyprland did not enter the \"%s\" submap for choosing between windows\n", PICKER_MODE);
+        log_msg("ERROR: cannot enter Hyprland submap %s", PICKER_MODE);
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        int idx = indices[i];
+        char command[32 + MAX_CLASS_LEN + MAX_TITLE_LEN];
+        snprintf(command, sizeof(command), "notify -1 %d 0 %c  %s: %s", PICKER_NOTIFY_MS,
+                 toupper((unsigned char)config->instance_keys[i]), window_class(idx), window_title(idx));
+        hypr_ok(command);
+    }
+    return 1;
+}
+
+static void hypr_picker_close(const Config *config, int count) {
+    (void)config;
+    char command[64];
+    snprintf(command, sizeof(command), "[[BATCH]]dispatch submap reset;dismissnotify %d", count);
+    free(hypr_request(command));
+}
+
+static const Compositor hyprland_compositor = {
+    "hyprland", hypr_dump, hypr_subscribe, hypr_parse_events, hypr_focus, hypr_picker_open, hypr_picker_close,
+};
+
+// Returns 0 when a configured compositor cannot be reached from this environment
+int select_backend(int configured) {
+    if (configured == BACKEND_AUTO) {
+        configured = getenv("SWAYSOCK") ? BACKEND_SWAY :
+                     getenv("HYPRLAND_INSTANCE_SIGNATURE") ? BACKEND_HYPRLAND : BACKEND_X11;
+    }
+    if (configured == BACKEND_SWAY && !getenv("SWAYSOCK")) {
+        fprintf(stderr, "backend=sway, but SWAYSOCK is not set\n");
+        return 0;
+    }
+    if (configured == BACKEND_HYPRLAND && !getenv("HYPRLAND_INSTANCE_SIGNATURE")) {
+        fprintf(stderr, "backend=hyprland, but HYPRLAND_INSTANCE_SIGNATURE is not set\n");
+        return 0;
+    }
+    compositor = configured == BACKEND_SWAY ? &sway_compositor :
+                 configured == BACKEND_HYPRLAND ? &hyprland_compositor : NULL;
+    return 1;
+}
+
+// A full dump, merged so windows already in the table keep their focus history
+int compositor_sync(void) {
+    InfoList dump = {0};
+    if (!compositor->dump(&dump)) {
+        log_msg("ERROR: %s window dump failed", compositor->name);
+        free(dump.items);
+        return 0;
+    }
+
+    static WindowTable next;
+    table_clear(&next);
+    for (int i = 0; i < dump.count; i++) {
+        int idx = find_window_index(dump.items[i].id);
+        int slot = idx >= 0 ? table_append_row(&next, &windows, idx) : table_append(&next, dump.items[i].id);
+        if (slot < 0 || !table_set_info(&next, slot, &dump.items[i])) break;
+    }
+    table_swap(&windows, &next);
+    closed_count = 0;
+    compositor_resync_needed = 0;
+    window_table_changed = 1;
+    class_index_dirty = 1;
+    note_active_window();
+    log_msg("%s sync: %d windows, desktop %ld, active %lu", compositor->name, windows.count,
+            cached_current_desktop, (unsigned long)cached_active_window);
+    free(dump.items);
+    return 1;
+}
+
+int compositor_subscribe(void) {
+    if (compositor_event_fd >= 0) return 1;
+    int fd = compositor->subscribe();
+    if (fd < 0) {
+        log_msg("ERROR: cannot subscribe to %s events", compositor->name);
+        return 0;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    compositor_event_fd = fd;
+    return 1;
+}
+
+// Applies every complete event the compositor has sent so far; never blocks
+void read_compositor_events(void) {
+    if (compositor_event_fd < 0) return;
+    while (1) {
+        if (compositor_events_cap - compositor_events_len < 4096 + 1) {
+            size_t cap = compositor_events_cap ? compositor_events_cap * 2 : 16384;
+            char *grown = realloc(compositor_events, cap);
+            if (!grown) break;
+            compositor_events = grown;
+            compositor_events_cap = cap;
+        }
+        ssize_t n = read(compositor_event_fd, compositor_events + compositor_events_len,
+                         compositor_events_cap - compositor_events_len - 1);
+        if (n > 0) {
+            compositor_events_len += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0) compositor_lost = 1;
+        break;
+    }
+    if (compositor_events_len == 0) return;
+
+    size_t used = compositor->parse_events(compositor_events, compositor_events_len);
+    memmove(compositor_events, compositor_events + used, compositor_events_len - used);
+    compositor_events_len -= used;
+}
+
+static void drop_closed_windows(void) {
+    static WindowTable next;
+    table_clear(&next);
+    for (int i = 0; i < windows.count; i++) {
+        int closed = 0;
+        for (int c = 0; c < closed_count && !closed; c++) closed = closed_windows[c] == windows.ids[i];
+        if (!closed && table_append_row(&next, &windows, i) < 0) return;
+    }
+    table_swap(&windows, &next);
+    closed_count = 0;
+    window_table_changed = 1;
+    class_index_dirty = 1;
+}
+
+// Between requests: take in events, then resolve anything they left unknown
+void process_compositor_events(void) {
+    read_compositor_events();
+    if (compositor_resync_needed) {
+        compositor_sync();
+    } else if (closed_count > 0) {
+        drop_closed_windows();
+    }
+}
+
+int wait_for_compositor_focus(Window target, int timeout_ms) {
+    long long deadline = monotonic_ns() + (long long)timeout_ms * 1000000;
+    while (1) {
+        read_compositor_events();
+        if (cached_active_window == target) return 1;
+        long long remaining_ns = deadline - monotonic_ns();
+        if (compositor_lost || remaining_ns <= 0) return 0;
+
+        struct pollfd pfd = {compositor_event_fd, POLLIN, 0};
+        if (poll(&pfd, 1, (int)((remaining_ns + 999999) / 1000000)) < 0 && errno != EINTR) return 0;
+    }
+}
+
+// With a compositor every process starts from a full dump, so the table and the cached
+// desktop and active window are as current as the daemon's live table
+static inline int table_is_current(void) {
+    return window_table_live || compositor != NULL;
+}
+
+int init_window_table(void) {
+    log_section("INITIALIZING WINDOW TABLE");
+
+    if (compositor) {
+        // Subscribe first so nothing changes unseen between the dump and the stream
+        if (!compositor_subscribe() || !compositor_sync()) return 0;
+        window_table_live = 1;
+        return 1;
+    }
+
+    select_root_events(PropertyChangeMask);
+    table_clear(&windows);
+    cached_current_desktop = get_current_desktop();
+    if (!get_active_window(&cached_active_window)) {
+        cached_active_window = 0;
+    }
+    if (!sync_client_list()) {
+        return 0;
+    }
+
+    window_table_live = 1;
+    return 1;
+}
+
+void handle_window_table_event(const XEvent *event) {
+#ifdef WINLEAP_THUMBNAILS
+    if (handle_thumbnail_event(event)) return;
+#endif
+    if (!window_table_live || event->type != PropertyNotify) return;
+    metrics.events++;
+    metrics_dirty = 1;
+
+    const XPropertyEvent *pe = &event->xproperty;
+
+    if (pe->window == root) {
+        if (pe->atom == atom_net_client_list) {
+            // Deferred so indices stay stable while a request is in flight
+            client_list_dirty = 1;
+        } else if (pe->atom == atom_net_current_desktop) {
+            cached_current_desktop = get_current_desktop();
+            window_table_changed = 1;
+            log_msg("Current desktop changed: %ld", cached_current_desktop);
+        } else if (pe->atom == atom_net_active_window) {
+            if (!get_active_window(&cached_active_window)) {
+                cached_active_window = 0;
+            }
+            note_active_window();
+            window_table_changed = 1;
+        }
+        return;
+    }
+
+    int idx = find_window_index(pe->window);
+    if (idx < 0) return;
+    window_table_changed = 1;
+
+    if (pe->atom == atom_wm_class) {
+        // A window listed before it had a class was stored without its other properties
+        WindowInfo info;
+        if (!load_window_info(pe->window, &info, FETCH_ALL, 0, -1)) {
+            info.wm_class[0] = '\0';
+        }
+        table_set_info(&windows, idx, &info);
+        class_index_dirty = 1;
+        log_msg("Class changed: [%lu] %s", (unsigned long)pe->window, window_class(idx));
+    } else if (pe->atom == atom_net_wm_name || pe->atom == XA_WM_NAME) {
+        char title[MAX_TITLE_LEN];
+        get_window_title(pe->window, title, sizeof(title));
+        table_set_title(&windows, idx, title);
+        windows.loaded[idx] |= FETCH_TITLE;
+    } else if (pe->atom == atom_net_wm_desktop) {
+        long old_desktop = windows.desktops[idx];
+        windows.desktops[idx] = get_window_desktop(pe->window);
+        windows.loaded[idx] |= FETCH_DESKTOP;
+        if (windows.desktops[idx] != old_desktop) move_desktop_bucket(idx, old_desktop);
+        log_msg("Desktop changed: [%lu] -> %ld", (unsigned long)pe->window, windows.desktops[idx]);
+    }
+}
+
+// Shared window table: the daemon mirrors its table into $XDG_RUNTIME_DIR/winleap/<display>.table.
+// Readers map the file and copy a snapshot under a seqlock: seq is odd while a write is in
+// progress, and a snapshot is consistent when seq was even and unchanged around the copy.
+#define SHARED_TABLE_MAGIC 0x42544c57u  // "WLTB"
+#define SHARED_TABLE_VERSION 2
+
+typedef struct {
+    uint64_t id;
+    int64_t desktop;
+    char wm_class[MAX_CLASS_LEN];
+    char instance[MAX_CLASS_LEN];  // WM_CLASS instance half, for instance: rules in --list
+    char title[MAX_TITLE_LEN];
+} SharedWindow;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+    uint32_t capacity;
+    int32_t pid;
+    uint32_t count;
+    int64_t current_desktop;
+    uint64_t active_window;
+    SharedWindow windows[];
+} SharedTable;
+
+static SharedTable *shared_table = NULL;
+static size_t shared_table_size = 0;
+static char shared_table_path[MAX_PATH_LEN];
+
+size_t shared_table_bytes(uint32_t capacity) {
+    return sizeof(SharedTable) + sizeof(SharedWindow) * capacity;
+}
+
+static void write_shared_rows(SharedTable *table) {
+    uint32_t count = (uint32_t)windows.count;
+    if (count > table->capacity) count = table->capacity;
+    for (uint32_t i = 0; i < count; i++) {
+        SharedWindow *sw = &table->windows[i];
+        sw->id = (uint64_t)windows.ids[i];
+        sw->desktop = windows.desktops[i];
+        snprintf(sw->wm_class, sizeof(sw->wm_class), "%s", window_class((int)i));
+        snprintf(sw->instance, sizeof(sw->instance), "%s", window_instance((int)i));
+        snprintf(sw->title, sizeof(sw->title), "%s", window_title((int)i));
+    }
+    table->count = count;
+    table->current_desktop = cached_current_desktop;
+    table->active_window = (uint64_t)cached_active_window;
+}
+
+// Built under a temporary name and renamed, so readers never map a half-sized file.
+// Also how the table grows: readers that open the path afterwards see the larger file.
+static int create_shared_table(uint32_t capacity) {
+    char tmp_path[MAX_PATH_LEN + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", shared_table_path);
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "Warning: cannot create window table %s: %s\n", tmp_path, strerror(errno));
+        return 0;
+    }
+
+    size_t size = shared_table_bytes(capacity);
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Warning: cannot map window table %s: %s\n", tmp_path, strerror(errno));
+        unlink(tmp_path);
+        return 0;
+    }
+
+    SharedTable *table = map;
+    table->magic = SHARED_TABLE_MAGIC;
+    table->version = SHARED_TABLE_VERSION;
+    table->capacity = capacity;
+    table->pid = (int32_t)getpid();
+    write_shared_rows(table);
+
+    if (rename(tmp_path, shared_table_path) != 0) {
+        fprintf(stderr, "Warning: cannot publish window table %s: %s\n", shared_table_path, strerror(errno));
+        unlink(tmp_path);
+        munmap(map, size);
+        return 0;
+    }
+
+    if (shared_table) munmap(shared_table, shared_table_size);
+    shared_table = table;
+    shared_table_size = size;
+    return 1;
+}
+
+void publish_window_table(void) {
+    window_table_changed = 0;
+    if (!shared_table) return;
+
+    if ((uint32_t)windows.count > shared_table->capacity) {
+        uint32_t capacity = shared_table->capacity;
+        while (capacity < (uint32_t)windows.count) capacity *= 2;
+        create_shared_table(capacity);
+        return;
+    }
+
+    uint32_t seq = __atomic_load_n(&shared_table->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&shared_table->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    write_shared_rows(shared_table);
+
+    __atomic_store_n(&shared_table->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int open_shared_table(const char *table_path) {
+    snprintf(shared_table_path, sizeof(shared_table_path), "%s", table_path);
+    uint32_t capacity = INITIAL_WINDOW_CAPACITY;
+    while (capacity < (uint32_t)windows.count) capacity *= 2;
+    return create_shared_table(capacity);
+}
+
+// Copies a consistent snapshot into the window table; 0 when no running daemon publishes a table
+int read_shared_table(const char *table_path, long *current_desktop, Window *active_window) {
+    int fd = open(table_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SharedTable)) {
+        close(fd);
+        return 0;
+    }
+    const SharedTable *table = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) return 0;
+
+    int ok = 0;
+    if (table->magic == SHARED_TABLE_MAGIC &&
+        table->version == SHARED_TABLE_VERSION &&
+        shared_table_bytes(table->capacity) <= (size_t)st.st_size &&
+        (kill((pid_t)table->pid, 0) == 0 || errno == EPERM)) {
+        for (int attempt = 0; attempt < 1000 && !ok; attempt++) {
+            uint32_t seq = __atomic_load_n(&table->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) continue;
+
+            uint32_t count = table->count;
+            if (count > table->capacity) count = table->capacity;
+            table_clear(&windows);
+            for (uint32_t i = 0; i < count; i++) {
+                const SharedWindow *sw = &table->windows[i];
+                WindowInfo info;
+                info.id = (Window)sw->id;
+                info.desktop = (long)sw->desktop;
+                memcpy(info.wm_class, sw->wm_class, sizeof(info.wm_class));
+                memcpy(info.instance, sw->instance, sizeof(info.instance));
+                memcpy(info.title, sw->title, sizeof(info.title));
+                info.wm_class[MAX_CLASS_LEN - 1] = '\0';
+                info.instance[MAX_CLASS_LEN - 1] = '\0';
+                info.title[MAX_TITLE_LEN - 1] = '\0';
+                info.loaded = FETCH_ALL;
+                if (table_append_info(&windows, &info) < 0) break;
+            }
+            class_index_dirty = 1;
+            *current_desktop = (long)table->current_desktop;
+            *active_window = (Window)table->active_window;
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            ok = __atomic_load_n(&table->seq, __ATOMIC_RELAXED) == seq;
+        }
+    }
+
+    munmap((void *)table, (size_t)st.st_size);
+    return ok;
+}
+
+void close_shared_table(const char *table_path) {
+    if (!shared_table) return;
+    unlink(table_path);
+    munmap(shared_table, shared_table_size);
+    shared_table = NULL;
+}
+
+// Drains queued X events into the window table; only safe between requests
+void process_pending_events(void) {
+    if (compositor) process_compositor_events();
+    while (!compositor && XPending(display) > 0) {
+        XEvent event;
+        XNextEvent(display, &event);
+        if (event.type == KeyPress || event.type == KeyRelease) {
+            if (is_fresh_key_press(&event)) {
+                pending_key_event = event.xkey;
+                key_event_pending = 1;
+            }
+            continue;
+        }
+        if (event.type == MappingNotify) {
+            XRefreshKeyboardMapping(&event.xmapping);
+            if (event.xmapping.request != MappingPointer) keyboard_mapping_changed = 1;
+            continue;
+        }
+        handle_window_table_event(&event);
+    }
+    if (client_list_dirty && !compositor) {
+        sync_client_list();
+    }
+    if (window_table_changed) {
+        publish_window_table();
+    }
+    // Rebuilt here, between requests, so a jump never pays for it
+    if (class_index_dirty) {
+        rebuild_class_index();
+    }
+}
+
+int find_windows_by_class_and_scope(const char *target_class,
+                                    int current_workspace_only,
+                                    long current_desktop,
+                                    int *indices,
+                                    int max_indices) {
+    int class_id = find_class_id(target_class);
+    if (class_id < 0) return 0;
+
+    int count = 0;
+    if (current_workspace_only) {
+        if (current_desktop < 0) return 0;
+        int slot = desktop_bucket_slot(current_desktop, class_id, 0);
+        if (slot < 0) return 0;
+        for (int i = desktop_buckets[slot].head; i >= 0 && count < max_indices; i = windows.bucket_next[i]) {
+            indices[count++] = i;
+        }
+        return count;
+    }
+
+    const ClassEntry *entry = &classes[class_id];
+    for (int k = 0; k < entry->count && count < max_indices; k++) {
+        indices[count++] = class_windows[entry->first + k];
+    }
+    return count;
+}
+
+static inline int rule_matches(const MarkMatcher *m, const char *wm_class, const char *instance, const char *title) {
+    return field_matches(&m->class_match, wm_class) &&
+           field_matches(&m->instance_match, instance) &&
+           field_matches(&m->title_match, title);
+}
+
+int window_matches_mark(const Config *config, int slot, int i) {
+    const MarkMatcher *m = &config->matchers[slot];
+    uint64_t bit = m->cache_bit >= 0 ? (uint64_t)1 << m->cache_bit : 0;
+    if (windows.rule_known[i] & bit) return (windows.rule_hits[i] & bit) != 0;
+
+    int hit = rule_matches(m, window_class(i), window_instance(i), window_title(i));
+    windows.rule_known[i] |= bit;
+    windows.rule_hits[i] = hit ? windows.rule_hits[i] | bit : windows.rule_hits[i] & ~bit;
+    return hit;
+}
+
+// A literal class narrows the candidates through the class index; other rules scan the
+// table, where cached per-window results make repeat lookups a bit test
+int find_windows_by_mark(const Config *config, int slot,
+                         int current_workspace_only,
+                         long current_desktop,
+                         int *indices,
+                         int max_indices) {
+    const MarkMatcher *m = &config->matchers[slot];
+    if (m->class_match.kind == MATCH_EXACT) {
+        int count = find_windows_by_class_and_scope(config->marks[slot].wm_class, current_workspace_only,
+                                                    current_desktop, indices, max_indices);
+        if (mark_is_simple(m)) return count;
+
+        int kept = 0;
+        for (int k = 0; k < count; k++) {
+            if (window_matches_mark(config, slot, indices[k])) indices[kept++] = indices[k];
+        }
+        return kept;
+    }
+
+    int count = 0;
+    for (int i = 0; i < windows.count && count < max_indices; i++) {
+        if (!in_scope(windows.desktops[i], current_workspace_only, current_desktop)) continue;
+        if (window_matches_mark(config, slot, i)) indices[count++] = i;
+    }
+    return count;
+}
+
+// Cache bits are assigned per config, so a reload invalidates every window's results
+void forget_rule_matches(void) {
+    for (int i = 0; i < windows.count; i++) windows.rule_known[i] = 0;
+}
+
+long elapsed_ms_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+long read_current_desktop(void) {
+    return table_is_current() ? cached_current_desktop : get_current_desktop();
+}
+
+long read_active_window(void) {
+    if (table_is_current()) return (long)cached_active_window;
+    Window active = 0;
+    return get_active_window(&active) ? (long)active : 0;
+}
+
+// Waits until a PropertyNotify for `atom` on root leaves read_value() == expected. Returns 1
+// then, 0 on timeout and -3 when a hotkey supersedes req. Unrelated events still reach the
+// window table and hotkeys, so nothing is lost while waiting.
+int wait_for_root_value(const Config *config, const JumpRequest *req, Atom atom, long (*read_value)(void),
+                        long expected, int timeout_ms) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    XFlush(display);
+
+    while (1) {
+        while (XPending(display) > 0) {
+            XEvent event;
+            XNextEvent(display, &event);
+            int key = handle_waiting_key_event(config, req, &event);
+            if (key < 0) return key;
+            if (key) continue;
+            handle_window_table_event(&event);
+            if (event.type == PropertyNotify &&
+                event.xproperty.window == root &&
+                event.xproperty.atom == atom &&
+                read_value() == expected) {
+                return 1;
+            }
+        }
+
+        long remaining = timeout_ms - elapsed_ms_since(&start);
+        if (remaining <= 0) return 0;
+
+        struct pollfd pfd = {ConnectionNumber(display), POLLIN, 0};
+        if (poll(&pfd, 1, (int)remaining) < 0 && errno != EINTR) return 0;
+    }
+}
+
+// Returns -3 when a hotkey supersedes req during the desktop switch, and 0 otherwise
+int activate_window(const Config *config, const JumpRequest *req, int idx, long current_desktop) {
+    if (idx < 0 || idx >= windows.count) return 0;
+
+    Window win = windows.ids[idx];
+    if (!(windows.loaded[idx] & FETCH_DESKTOP)) {
+        windows.desktops[idx] = get_window_desktop(win);
+        windows.loaded[idx] |= FETCH_DESKTOP;
+    }
+    log_msg("ACTIVATING: [%lu] desktop=%ld %s - %s",
+            (unsigned long)win,
+            windows.desktops[idx],
+            window_class(idx),
+            window_title(idx));
+
+    long desktop = windows.desktops[idx];
+    if (desktop >= 0 && current_desktop < 0) {
+        current_desktop = read_current_desktop();
+    }
+
+    if (desktop >= 0 && desktop != current_desktop) {
+        // Subscribe before asking so the confirming PropertyNotify cannot be missed
+        select_root_events(PropertyChangeMask);
+
+        XEvent switch_event = {0};
+        switch_event.xclient.type = ClientMessage;
+        switch_event.xclient.send_event = True;
+        switch_event.xclient.message_type = atom_net_current_desktop;
+        switch_event.xclient.window = root;
+        switch_event.xclient.format = 32;
+        switch_event.xclient.data.l[0] = desktop;
+        switch_event.xclient.data.l[1] = CurrentTime;
+
+        XSendEvent(display, root, False,
+                   SubstructureRedirectMask | SubstructureNotifyMask, &switch_event);
+
+        if (config->desktop_switch_timeout_ms > 0) {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            int switched = wait_for_root_value(config, req, atom_net_current_desktop, read_current_desktop,
+                                               desktop, config->desktop_switch_timeout_ms);
+            if (switched < 0) return switched;
+            if (switched) {
+                log_msg("Desktop switch %ld -> %ld confirmed after %ld ms",
+                        current_desktop, desktop, elapsed_ms_since(&start));
+            } else {
+                log_msg("WARNING: desktop switch to %ld not confirmed within %d ms",
+                        desktop, config->desktop_switch_timeout_ms);
+            }
+        }
+    } else if (desktop >= 0) {
+        log_msg("Target already on current desktop %ld: no switch", desktop);
+    }
+
+    XEvent event = {0};
+    event.xclient.type = ClientMessage;
+    event.xclient.send_event = True;
+    event.xclient.message_type = atom_net_active_window;
+    event.xclient.window = win;
+    event.xclient.format = 32;
+    event.xclient.data.l[0] = 2;
+    event.xclient.data.l[1] = CurrentTime;
+    event.xclient.data.l[2] = 0;
+
+    XSendEvent(display, root, False,
+               SubstructureRedirectMask | SubstructureNotifyMask, &event);
+
+    XMapRaised(display, win);
+    XRaiseWindow(display, win);
+    XSetInputFocus(display, win, RevertToPointerRoot, CurrentTime);
+
+    XFlush(display);
+    return 0;
+}
+
+// Hotkeys must match with NumLock/CapsLock on as well, so each is grabbed once per lock combination
+static unsigned int numlock_mask = 0;
+
+const Hotkey *find_hotkey(const Config *config, const XKeyEvent *event) {
+    unsigned int relevant = ShiftMask | ControlMask | Mod1Mask | Mod3Mask | Mod4Mask | Mod5Mask;
+    unsigned int state = event->state & relevant & ~numlock_mask;
+
+    for (int i = 0; i < config->num_hotkeys; i++) {
+        const Hotkey *hk = &config->hotkeys[i];
+        if (hk->modifiers == state && XKeysymToKeycode(display, hk->keysym) == event->keycode) {
+            return hk;
+        }
+    }
+    return NULL;
+}
+
+void hotkey_request(const Hotkey *hk, JumpRequest *req) {
+    memset(req, 0, sizeof(*req));
+    req->number = hk->number;
+    req->current_workspace_only = hk->current_workspace_only;
+    req->current_application_mode = hk->current_application_mode;
+    req->most_recent = hk->most_recent;
+    req->back = hk->back;
+    req->search = hk->search;
+    req->start_ns = monotonic_ns();
+}
+
+// Key and keyboard-mapping events that reach a request while it waits on X. A fresh press of
+// another hotkey supersedes the request: it is kept for the daemon loop to dispatch, as
+// between requests, and -3 is returned. A repeat of req's own hotkey is dropped. Returns 1
+// for other events handled here; 0 leaves the event, including any other key press, to the caller.
+int handle_waiting_key_event(const Config *config, const JumpRequest *req, XEvent *event) {
+    if (event->type == MappingNotify) {
+        XRefreshKeyboardMapping(&event->xmapping);
+        if (event->xmapping.request != MappingPointer) keyboard_mapping_changed = 1;
+        return 1;
+    }
+    if (event->type != KeyPress && event->type != KeyRelease) return 0;
+    if (!is_fresh_key_press(event)) return 1;
+
+    const Hotkey *hk = find_hotkey(config, &event->xkey);
+    if (!hk) return 0;
+    JumpRequest hotkey_req;
+    hotkey_request(hk, &hotkey_req);
+    if (same_jump(&hotkey_req, req)) return 1;
+    pending_key_event = event->xkey;
+    key_event_pending = 1;
+    log_msg("SUPERSEDED by hotkey %s", hk->spec);
+    fprintf(err_stream, "Superseded by a newer request\n");
+    return -3;
+}
+
+// Picker hints: one small override-redirect window per candidate whose background is a
+// pre-rendered pixmap, so the server paints it on map and no Expose round trip is needed.
+// Selector glyphs are rendered once per connection and reused by every picker; the whole
+// overlay is created, mapped and raised in a single flush.
+#define HINT_FONT "-misc-fixed-bold-r-normal--18-*-*-*-*-*-iso8859-1"
+#define HINT_PAD 6
+#define MAX_HINT_LABEL_LEN 80
+
+static Display *hint_display;
+static XFontStruct *hint_font;
+static GC hint_gc;
+static unsigned long hint_fg, hint_bg;
+static int hint_w, hint_h;
+static Pixmap hint_glyphs[128];  // selector char -> rendered hint, 0 until first used
+static Window hint_windows[2 * MAX_INSTANCE_KEYS];  // a listed candidate may add a thumbnail
+static int hint_count;
+
+typedef struct {
+    int x, y;
+    int w, h;
+    int viewable;
+} HintGeometry;
+
+// TrueColor pixels are composed locally instead of costing an AllocColor round trip each
+static unsigned long hint_channel(unsigned value, unsigned long mask) {
+    if (!mask) return 0;
+    int shift = __builtin_ctzl(mask);
+    unsigned long max = mask >> shift;
+    return ((value * max + 127) / 255) << shift;
+}
+
+static unsigned long hint_pixel(unsigned r, unsigned g, unsigned b, unsigned long fallback) {
+    Visual *visual = DefaultVisual(display, DefaultScreen(display));
+    if (visual->class != TrueColor) return fallback;
+    return hint_channel(r, visual->red_mask) | hint_channel(g, visual->green_mask) |
+           hint_channel(b, visual->blue_mask);
+}
+
+static int init_hints(void) {
+    if (hint_display == display) return hint_font != NULL;
+    hint_display = display;
+    memset(hint_glyphs, 0, sizeof(hint_glyphs));
+
+    trace_round_trips++;
+    hint_font = XLoadQueryFont(display, HINT_FONT);
+    if (!hint_font) {
+        trace_round_trips++;
+        hint_font = XLoadQueryFont(display, "fixed");
+    }
+    if (!hint_font) {
+        log_msg("WARNING: no font for picker hints");
+        return 0;
+    }
+
+    int screen = DefaultScreen(display);
+    hint_fg = hint_pixel(0x1d, 0x1d, 0x1d, BlackPixel(display, screen));
+    hint_bg = hint_pixel(0xff, 0xd8, 0x4a, WhitePixel(display, screen));
+    hint_h = hint_font->ascent + hint_font->descent + 2 * HINT_PAD;
+    hint_w = hint_font->max_bounds.width + 2 * HINT_PAD;
+    if (hint_w < hint_h) hint_w = hint_h;
+    hint_gc = XCreateGC(display, root, 0, NULL);
+    XSetFont(display, hint_gc, hint_font->fid);
+    return 1;
+}
+
+static Pixmap render_hint(const char *text, int len, int width) {
+    Pixmap pixmap = XCreatePixmap(display, root, (unsigned)width, (unsigned)hint_h,
+                                  (unsigned)DefaultDepth(display, DefaultScreen(display)));
+    XSetForeground(display, hint_gc, hint_bg);
+    XFillRectangle(display, pixmap, hint_gc, 0, 0, (unsigned)width, (unsigned)hint_h);
+    XSetForeground(display, hint_gc, hint_fg);
+    XDrawRectangle(display, pixmap, hint_gc, 0, 0, (unsigned)width - 1, (unsigned)hint_h - 1);
+    int text_x = len == 1 ? (width - XTextWidth(hint_font, text, 1)) / 2 : HINT_PAD;
+    XDrawString(display, pixmap, hint_gc, text_x, HINT_PAD + hint_font->ascent, text, len);
+    return pixmap;
+}
+
+static void show_window(int x, int y, int width, int height, Pixmap background) {
+    XSetWindowAttributes attrs;
+    attrs.override_redirect = True;
+    attrs.save_under = True;
+    attrs.background_pixmap = background;
+    Window win = XCreateWindow(display, root, x, y, (unsigned)width, (unsigned)height, 0,
+                               CopyFromParent, InputOutput, CopyFromParent,
+                               CWOverrideRedirect | CWSaveUnder | CWBackPixmap, &attrs);
+    XMapRaised(display, win);
+    hint_windows[hint_count++] = win;
+}
+
+static void show_hint(int x, int y, int width, Pixmap background) {
+    show_window(x, y, width, hint_h, background);
+}
+
+#ifdef WINLEAP_XCB
+// All geometry requests go out before the first reply is read: one round trip for the lot
+static void fetch_hint_geometry(const int *indices, int count, HintGeometry *out) {
+    xcb_connection_t *conn = XGetXCBConnection(display);
+    xcb_get_window_attributes_cookie_t attr_cookies[MAX_INSTANCE_KEYS];
+    xcb_get_geometry_cookie_t geom_cookies[MAX_INSTANCE_KEYS];
+    xcb_translate_coordinates_cookie_t pos_cookies[MAX_INSTANCE_KEYS];
+    for (int i = 0; i < count; i++) {
+        xcb_window_t win = (xcb_window_t)windows.ids[indices[i]];
+        attr_cookies[i] = xcb_get_window_attributes(conn, win);
+        geom_cookies[i] = xcb_get_geometry(conn, win);
+        pos_cookies[i] = xcb_translate_coordinates(conn, win, (xcb_window_t)root, 0, 0);
+    }
+    trace_round_trips++;
+    for (int i = 0; i < count; i++) {
+        xcb_get_window_attributes_reply_t *attrs = xcb_get_window_attributes_reply(conn, attr_cookies[i], NULL);
+        xcb_get_geometry_reply_t *geom = xcb_get_geometry_reply(conn, geom_cookies[i], NULL);
+        xcb_translate_coordinates_reply_t *pos = xcb_translate_coordinates_reply(conn, pos_cookies[i], NULL);
+        out[i].viewable = attrs && geom && pos && attrs->map_state == XCB_MAP_STATE_VIEWABLE;
+        if (out[i].viewable) {
+            out[i].x = pos->dst_x;
+            out[i].y = pos->dst_y;
+            out[i].w = geom->width;
+            out[i].h = geom->height;
+        }
+        free(attrs);
+        free(geom);
+        free(pos);
+    }
+}
+#else
+static void fetch_hint_geometry(const int *indices, int count, HintGeometry *out) {
+    for (int i = 0; i < count; i++) {
+        Window win = windows.ids[indices[i]];
+        XWindowAttributes attrs;
+        Window child;
+        trace_round_trips += 2;
+        out[i].viewable = XGetWindowAttributes(display, win, &attrs) && attrs.map_state == IsViewable &&
+                          XTranslateCoordinates(display, win, root, 0, 0, &out[i].x, &out[i].y, &child);
+        if (out[i].viewable) {
+            out[i].w = attrs.width;
+            out[i].h = attrs.height;
+        }
+    }
+}
+#endif
+
+static int clamp_int(int v, int lo, int hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+// Row height of an off-screen candidate in the list: its thumbnail, if the daemon has one
+static int listed_row_height(const Config *config, int idx, Pixmap *thumb, int *thumb_w, int *thumb_h) {
+    *thumb = 0;
+    *thumb_w = 0;
+    *thumb_h = 0;
+#ifdef WINLEAP_THUMBNAILS
+    if (config->picker_thumbnails && window_thumbnail(windows.ids[idx], thumb, thumb_w, thumb_h)) {
+        return *thumb_h > hint_h ? *thumb_h : hint_h;
+    }
+#else
+    (void)config;
+    (void)idx;
+#endif
+    return hint_h;
+}
+
+// Visible candidates get their key centred on the window; the rest (other desktops,
+// minimized) are listed with their class and title, and a thumbnail when the daemon keeps
+// them, in a column in the middle of the screen
+void show_picker_hints(const Config *config, const int *indices, int count) {
+    if (!config->picker_hints || count <= 0) return;
+
+    TraceMark mark = trace_begin();
+    if (!init_hints()) return;
+    HintGeometry geometry[MAX_INSTANCE_KEYS];
+    fetch_hint_geometry(indices, count, geometry);
+
+    int screen = DefaultScreen(display);
+    int screen_w = DisplayWidth(display, screen);
+    int screen_h = DisplayHeight(display, screen);
+    int hidden = 0;
+    int list_h = 0;
+    Pixmap thumbs[MAX_INSTANCE_KEYS];
+    int thumb_w[MAX_INSTANCE_KEYS], thumb_h[MAX_INSTANCE_KEYS], row_h[MAX_INSTANCE_KEYS];
+    for (int i = 0; i < count; i++) {
+        if (geometry[i].viewable) continue;
+        hidden++;
+        row_h[i] = listed_row_height(config, indices[i], &thumbs[i], &thumb_w[i], &thumb_h[i]);
+        list_h += row_h[i] + HINT_PAD;
+    }
+    int list_y = (screen_h - list_h) / 2;
+
+    for (int i = 0; i < count; i++) {
+        unsigned char selector = (unsigned char)config->instance_keys[i];
+        if (geometry[i].viewable) {
+            if (selector >= 128) continue;
+            if (!hint_glyphs[selector]) {
+                char text = (char)toupper(selector);
+                hint_glyphs[selector] = render_hint(&text, 1, hint_w);
+            }
+            int x = clamp_int(geometry[i].x + (geometry[i].w - hint_w) / 2, 0, screen_w - hint_w);
+            int y = clamp_int(geometry[i].y + (geometry[i].h - hint_h) / 2, 0, screen_h - hint_h);
+            show_hint(x, y, hint_w, hint_glyphs[selector]);
+            continue;
+        }
+
+        int idx = indices[i];
+        if (!(windows.loaded[idx] & FETCH_TITLE)) {
+            char title[MAX_TITLE_LEN];
+            get_window_title(windows.ids[idx], title, sizeof(title));
+            table_set_title(&windows, idx, title);
+            windows.loaded[idx] |= FETCH_TITLE;
+        }
+        char label[MAX_HINT_LABEL_LEN + 1];
+        int len = snprintf(label, sizeof(label), "%c  %s: %s", toupper(selector), window_class(idx), window_title(idx));
+        if (len < 0) continue;
+        if (len > MAX_HINT_LABEL_LEN) len = MAX_HINT_LABEL_LEN;
+        int width = XTextWidth(hint_font, label, len) + 2 * HINT_PAD;
+        int thumb_space = thumbs[i] ? thumb_w[i] + HINT_PAD : 0;
+        if (width > screen_w - thumb_space) width = screen_w - thumb_space;
+        int x = (screen_w - thumb_space - width) / 2;
+        if (thumbs[i]) {
+            show_window(x, list_y, thumb_w[i], thumb_h[i], thumbs[i]);
+            x += thumb_space;
+        }
+        // The window keeps its own reference to the background, so the label can go at once
+        Pixmap pixmap = render_hint(label, len, width);
+        show_hint(x, list_y + (row_h[i] - hint_h) / 2, width, pixmap);
+        XFreePixmap(display, pixmap);
+        list_y += row_h[i] + HINT_PAD;
+    }
+    XFlush(display);
+    trace_end(&mark, "picker_hints", 0);
+    log_msg("Picker hints: %d on windows, %d listed", count - hidden, hidden);
+}
+
+void hide_picker_hints(void) {
+    for (int i = 0; i < hint_count; i++) XDestroyWindow(display, hint_windows[i]);
+    hint_count = 0;
+}
+
+static int finish_picker(int grabbed, int result) {
+    hide_picker_hints();
+    if (grabbed) {
+        XUngrabKeyboard(display, CurrentTime);
+    }
+    XFlush(display);
+    return result;
+}
+
+// Waits up to timeout_ms (-1: no limit) for X input, or compositor events. In the daemon it also watches for newer
+// requests and for the waiting client going away. Returns 0 to carry on, otherwise the
+// picker's codes: -1 cancelled, -2 error, -3 superseded.
+int wait_for_x_or_request(const JumpRequest *req, int timeout_ms) {
+    struct pollfd fds[3 + MAX_QUEUED_REQUESTS];
+    int nfds = 0;
+    int listen_slot = -1;
+    int client_slot = -1;
+    int input_fd = compositor ? compositor_event_fd : ConnectionNumber(display);
+    fds[nfds++] = (struct pollfd){ .fd = input_fd, .events = POLLIN };
+    if (daemon_listen_fd >= 0) {
+        listen_slot = nfds;
+        fds[nfds++] = (struct pollfd){ .fd = daemon_listen_fd, .events = POLLIN };
+    }
+    if (serving_client_fd >= 0) {
+        client_slot = nfds;
+        fds[nfds++] = (struct pollfd){ .fd = serving_client_fd, .events = POLLRDHUP };
+    }
+    nfds = add_pending_read_fds(fds, nfds);
+
+    // Events Xlib already read off the socket would not wake poll()
+    if (!compositor && XQLength(display) > 0) timeout_ms = 0;
+    timeout_ms = pending_read_timeout(timeout_ms);
+    if (poll(fds, (nfds_t)nfds, timeout_ms) < 0 && errno != EINTR) {
+        log_msg("ERROR: poll failed: %s", strerror(errno));
+        return -2;
+    }
+
+    if (daemon_stop_requested) {
+        log_msg("CANCELLED: daemon stopping");
+        return -1;
+    }
+    if (client_slot >= 0 && fds[client_slot].revents) {
+        log_msg("CANCELLED: client went away");
+        return -1;
+    }
+    if ((listen_slot >= 0 && (fds[listen_slot].revents & POLLIN)) || num_pending_reads > 0) {
+        accept_pending_requests();
+        if (request_superseded(req)) {
+            log_msg("SUPERSEDED by a newer request");
+            fprintf(err_stream, "Superseded by a newer request\n");
+            return -3;
+        }
+    }
+    return 0;
+}
+
+// Picker key handlers get each fresh key press that is neither Escape nor a hotkey and
+// return PICKER_CONTINUE to keep waiting, or the picker's result
+#define PICKER_CONTINUE (-4)
+typedef int (*PickerKeyHandler)(void *ctx, KeySym keysym, const char *text, int len);
+
+// Grabs the keyboard and feeds key presses to on_key until it returns a result. Returns
+// the handler's result, -1 when cancelled, -2 on error and -3 when a newer request
+// superseded this one. Nothing here sleeps: a keyboard grab held by another client (say,
+// sxhkd until the key is released) is retried on poll() timeouts, while X events keep
+// being handled and, in the daemon, new requests and the waiting client are watched.
+int run_picker_loop(const Config *config, const JumpRequest *req, PickerKeyHandler on_key, void *ctx) {
+    TraceMark grab_mark = trace_begin();
+    int grabbed = 0;
+    int retry_delay_ms = GRAB_RETRY_INITIAL_MS;
+    long long grab_deadline = monotonic_ns() + (long long)GRAB_WAIT_MS * 1000000;
+    long long next_grab = 0;
+    metrics.picker_shown++;
+    metrics_request_waited = 1;
+
+    while (1) {
+        while (XPending(display) > 0) {
+            XEvent event;
+            XNextEvent(display, &event);
+
+            // Another hotkey replaces this jump; a repeat of the one that opened the picker is ignored
+            int key = handle_waiting_key_event(config, req, &event);
+            if (key < 0) {
+                metrics.picker_superseded++;
+                return finish_picker(grabbed, key);
+            }
+            if (key) continue;
+            if (event.type != KeyPress) {
+                handle_window_table_event(&event);
+                continue;
+            }
+
+            char key_buf[32];
+            KeySym keysym;
+            int len = XLookupString(&event.xkey, key_buf, sizeof(key_buf) - 1, &keysym, NULL);
+
+            if (keysym == XK_Escape) {
+                log_msg("CANCELLED by user (ESC)");
+                metrics.picker_cancelled++;
+                return finish_picker(grabbed, -1);
+            }
+
+            key_buf[len > 0 ? len : 0] = '\0';
+            int result = on_key(ctx, keysym, key_buf, len);
+            if (result != PICKER_CONTINUE) return finish_picker(grabbed, result);
+        }
+
+        if (!grabbed && monotonic_ns() >= next_grab) {
+            trace_round_trips++;
+            int grab_result = XGrabKeyboard(display, root, True, GrabModeAsync, GrabModeAsync, CurrentTime);
+            if (grab_result == GrabSuccess) {
+                grabbed = 1;
+                trace_end(&grab_mark, "keyboard_grab", 0);
+                XFlush(display);
+                // The picker waits on a human; write the log now so it survives the process being killed
+                log_flush();
+                continue;
+            }
+            if (grab_result != AlreadyGrabbed || monotonic_ns() >= grab_deadline) {
+                log_msg("ERROR: Failed to grab keyboard (code %d)", grab_result);
+                fprintf(err_stream, "Failed to grab keyboard for instance selection\n");
+                metrics.keyboard_grab_failures++;
+                return finish_picker(0, -2);
+            }
+            next_grab = monotonic_ns() + (long long)retry_delay_ms * 1000000;
+            retry_delay_ms = retry_delay_ms * 3 / 2;
+        }
+
+        int timeout_ms = -1;
+        if (!grabbed) {
+            long long wait_ns = next_grab - monotonic_ns();
+            timeout_ms = wait_ns > 0 ? (int)((wait_ns + 999999) / 1000000) : 0;
+        }
+        int waited = wait_for_x_or_request(req, timeout_ms);
+        if (waited == -3) metrics.picker_superseded++;
+        if (waited < 0) return finish_picker(grabbed, waited);
+    }
+}
+
+typedef struct {
+    const Config *config;
+    const int *indices;
+    int count;
+} SelectorPicker;
+
+static int selector_key(void *ctx, KeySym keysym, const char *text, int len) {
+    (void)keysym;
+    const SelectorPicker *picker = ctx;
+    if (len <= 0) return PICKER_CONTINUE;
+
+    char typed = (char)tolower((unsigned char)text[0]);
+    for (int i = 0; i < picker->count; i++) {
+        if (typed == picker->config->instance_keys[i]) {
+            log_msg("SELECTED selector '%c'", typed);
+            return picker->indices[i];
+        }
+    }
+    log_msg("Ignored selector key '%c'", typed);
+    return PICKER_CONTINUE;
+}
+
+// Wayland clients cannot grab the keyboard, so the compositor holds it: the picker's sway mode
+// or Hyprland submap binds the selector keys, and their presses come back as events
+static int select_instance_compositor(const Config *config, const JumpRequest *req,
+                                      const int *matching_indices, int match_count) {
+    if (!compositor_subscribe()) {
+        fprintf(err_stream, "Cannot subscribe to %s events\n", compositor->name);
+        return -2;
+    }
+    read_compositor_events();
+    compositor_picking = 1;
+    compositor_picker_key = 0;
+    if (!compositor->picker_open(config, matching_indices, match_count)) {
+        compositor_picking = 0;
+        return -2;
+    }
+    metrics.picker_shown++;
+    metrics_request_waited = 1;
+    log_flush();
+
+    SelectorPicker picker = { config, matching_indices, match_count };
+    int result = PICKER_CONTINUE;
+    while (result == PICKER_CONTINUE) {
+        read_compositor_events();
+        if (compositor_picker_key < 0) {
+            log_msg("CANCELLED by user (left %s)", PICKER_MODE);
+            metrics.picker_cancelled++;
+            result = -1;
+        } else if (compositor_picker_key > 0) {
+            char typed = (char)compositor_picker_key;
+            compositor_picker_key = 0;
+            result = selector_key(&picker, NoSymbol, &typed, 1);
+        } else if (compositor_lost) {
+            fprintf(err_stream, "Lost connection to %s\n", compositor->name);
+            result = -2;
+        } else {
+            int waited = wait_for_x_or_request(req, -1);
+            if (waited == -3) metrics.picker_superseded++;
+            if (waited < 0) result = waited;
+        }
+    }
+    compositor_picking = 0;
+    compositor->picker_close(config, match_count);
+    return result;
+}
+
+// Returns the selected window index, or run_picker_loop()'s codes
+int select_instance_interactively(const Config *config, const JumpRequest *req,
+                                  const int *matching_indices, int match_count) {
+    if (!config || !matching_indices || match_count <= 0) {
+        return -2;
+    }
+
+    int key_count = (int)strlen(config->instance_keys);
+    if (match_count > key_count) {
+        fprintf(err_stream, "Too many windows (%d) for instance_keys length (%d)\n", match_count, key_count);
+        log_msg("ERROR: %d matches exceed %d instance keys", match_count, key_count);
+        return -2;
+    }
+
+    log_section("INSTANCE SELECT MODE");
+    for (int i = 0; i < match_count; i++) {
+        int idx = matching_indices[i];
+        char selector = config->instance_keys[i];
+        log_msg("  '%c' -> [%lu] desktop=%ld %s - %s",
+                selector,
+                (unsigned long)windows.ids[idx],
+                windows.desktops[idx],
+                window_class(idx),
+                window_title(idx));
+    }
+
+    if (compositor) return select_instance_compositor(config, req, matching_indices, match_count);
+    show_picker_hints(config, matching_indices, match_count);
+
+    SelectorPicker picker = { config, matching_indices, match_count };
+    return run_picker_loop(config, req, selector_key, &picker);
+}
+
+// --search: every window in scope is filtered by class and title as the user types. Each
+// candidate's "class title" is copied once, lowercased, into one flat haystack, so a keystroke
+// scans contiguous memory with glibc's vectorized memmem() and memchr() rather than walking the
+// table. Typing a character can only narrow the matches, so every query length keeps its
+// survivors: the next keystroke re-scores just those, and BackSpace drops back a level for free.
+#define MAX_SEARCH_QUERY 64
+#define SEARCH_ROWS 10
+#define SEARCH_WIDTH_CHARS 72
+
+typedef struct {
+    int score;
+    int pos;  // candidate position, so lower is more recently focused
+} SearchHit;
+
+typedef struct {
+    const int *indices;  // window indices, most recently focused first
+    int count;
+    const char *haystack;
+    const uint32_t *offsets;  // candidate i is haystack[offsets[i] .. offsets[i + 1] - 1)
+    char query[MAX_SEARCH_QUERY + 1];
+    int query_len;
+    SearchHit *levels[MAX_SEARCH_QUERY + 1];  // levels[n]: the hits for query[0..n)
+    int level_counts[MAX_SEARCH_QUERY + 1];
+    int top[SEARCH_ROWS];  // positions in the current level, best first
+    int top_count;
+    int selected;  // row in top[]
+    Window box;
+    int box_w, box_h;
+} SearchPicker;
+
+// Substring matches beat subsequence ones, and those at a word start or earlier in the text
+// beat later ones; a subsequence loses a point per byte skipped between query characters.
+// -1 when the query does not match at all.
+static int search_score(const char *text, size_t text_len, const char *query, size_t query_len) {
+    const char *hit = memmem(text, text_len, query, query_len);
+    if (hit) {
+        size_t at = (size_t)(hit - text);
+        int word_start = at == 0 || !isalnum((unsigned char)hit[-1]);
+        return 200000 + (word_start ? 100000 : 0) - (int)(at < 50000 ? at : 50000);
+    }
+
+    const char *p = text;
+    const char *end = text + text_len;
+    size_t gaps = 0;
+    for (size_t i = 0; i < query_len; i++) {
+        const char *next = memchr(p, query[i], (size_t)(end - p));
+        if (!next) return -1;
+        if (i > 0) gaps += (size_t)(next - p);
+        p = next + 1;
+    }
+    return 100000 - (int)(gaps < 100000 ? gaps : 100000);
+}
+
+static int search_hit_before(const SearchHit *a, const SearchHit *b) {
+    return a->score > b->score || (a->score == b->score && a->pos < b->pos);
+}
+
+// Only the rows on screen are ranked: a bounded insertion instead of sorting every survivor
+static void search_rank(SearchPicker *s) {
+    const SearchHit *hits = s->levels[s->query_len];
+    int n = s->level_counts[s->query_len];
+    s->top_count = 0;
+    s->selected = 0;
+    for (int i = 0; i < n; i++) {
+        int j = s->top_count;
+        if (j == SEARCH_ROWS) {
+            if (!search_hit_before(&hits[i], &hits[s->top[j - 1]])) continue;
+            j--;
+        } else {
+            s->top_count++;
+        }
+        while (j > 0 && search_hit_before(&hits[i], &hits[s->top[j - 1]])) {
+            s->top[j] = s->top[j - 1];
+            j--;
+        }
+        s->top[j] = i;
+    }
+}
+
+static int search_push(SearchPicker *s, char c) {
+    if (s->query_len >= MAX_SEARCH_QUERY) return 0;
+    const SearchHit *from = s->levels[s->query_len];
+    int n = s->level_counts[s->query_len];
+    SearchHit *to = malloc(sizeof(*to) * (size_t)(n > 0 ? n : 1));
+    if (!to) return 0;
+
+    s->query[s->query_len++] = c;
+    s->query[s->query_len] = '\0';
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        int pos = from[i].pos;
+        uint32_t start = s->offsets[pos];
+        int score = search_score(s->haystack + start, s->offsets[pos + 1] - start - 1,
+                                 s->query, (size_t)s->query_len);
+        if (score >= 0) to[kept++] = (SearchHit){ score, pos };
+    }
+    s->levels[s->query_len] = to;
+    s->level_counts[s->query_len] = kept;
+    return 1;
+}
+
+static void search_pop(SearchPicker *s) {
+    if (s->query_len == 0) return;
+    free(s->levels[s->query_len]);
+    s->levels[s->query_len] = NULL;
+    s->query[--s->query_len] = '\0';
+}
+
+static void draw_search(SearchPicker *s) {
+    int screen = DefaultScreen(display);
+    Pixmap pixmap = XCreatePixmap(display, root, (unsigned)s->box_w, (unsigned)s->box_h,
+                                  (unsigned)DefaultDepth(display, screen));
+    XSetForeground(display, hint_gc, hint_bg);
+    XFillRectangle(display, pixmap, hint_gc, 0, 0, (unsigned)s->box_w, (unsigned)s->box_h);
+    XSetForeground(display, hint_gc, hint_fg);
+    XDrawRectangle(display, pixmap, hint_gc, 0, 0, (unsigned)s->box_w - 1, (unsigned)s->box_h - 1);
+    XDrawLine(display, pixmap, hint_gc, 0, hint_h - 1, s->box_w, hint_h - 1);
+
+    int baseline = HINT_PAD + hint_font->ascent;
+    char line[MAX_HINT_LABEL_LEN + 1];
+    int len = snprintf(line, sizeof(line), "%d/%d", s->level_counts[s->query_len], s->count);
+    int count_w = XTextWidth(hint_font, line, len);
+    XDrawString(display, pixmap, hint_gc, s->box_w - HINT_PAD - count_w, baseline, line, len);
+    len = snprintf(line, sizeof(line), "> %s_", s->query);
+    XDrawString(display, pixmap, hint_gc, HINT_PAD, baseline, line, len < MAX_HINT_LABEL_LEN ? len : MAX_HINT_LABEL_LEN);
+
+    const SearchHit *hits = s->levels[s->query_len];
+    for (int r = 0; r < s->top_count; r++) {
+        int idx = s->indices[hits[s->top[r]].pos];
+        int y = (r + 1) * hint_h;
+        if (r == s->selected) {
+            XFillRectangle(display, pixmap, hint_gc, 0, y, (unsigned)s->box_w, (unsigned)hint_h);
+            XSetForeground(display, hint_gc, hint_bg);
+        }
+        len = snprintf(line, sizeof(line), "%s: %s", window_class(idx), window_title(idx));
+        if (len > MAX_HINT_LABEL_LEN) len = MAX_HINT_LABEL_LEN;
+        if (len > 0) XDrawString(display, pixmap, hint_gc, HINT_PAD, y + baseline, line, len);
+        XSetForeground(display, hint_gc, hint_fg);
+    }
+
+    if (!s->box) {
+        int x = (DisplayWidth(display, screen) - s->box_w) / 2;
+        int y = (DisplayHeight(display, screen) - s->box_h) / 3;
+        show_window(x, y, s->box_w, s->box_h, pixmap);
+        s->box = hint_windows[hint_count - 1];
+    } else {
+        XSetWindowBackgroundPixmap(display, s->box, pixmap);
+        XClearWindow(display, s->box);
+    }
+    XFreePixmap(display, pixmap);
+    XFlush(display);
+}
+
+static int search_key(void *ctx, KeySym keysym, const char *text, int len) {
+    SearchPicker *s = ctx;
+    switch (keysym) {
+    case XK_Return:
+    case XK_KP_Enter:
+        if (s->top_count == 0) return PICKER_CONTINUE;
+        log_msg("SELECTED search result %d for '%s'", s->selected, s->query);
+        return s->indices[s->levels[s->query_len][s->top[s->selected]].pos];
+    case XK_Down:
+    case XK_Tab:
+        if (s->selected + 1 >= s->top_count) return PICKER_CONTINUE;
+        s->selected++;
+        draw_search(s);
+        return PICKER_CONTINUE;
+    case XK_Up:
+    case XK_ISO_Left_Tab:
+        if (s->selected == 0) return PICKER_CONTINUE;
+        s->selected--;
+        draw_search(s);
+        return PICKER_CONTINUE;
+    case XK_BackSpace:
+        if (s->query_len == 0) return PICKER_CONTINUE;
+        search_pop(s);
+        break;
+    default:
+        if (len != 1 || !isprint((unsigned char)text[0])) return PICKER_CONTINUE;
+        if (!search_push(s, (char)tolower((unsigned char)text[0]))) return PICKER_CONTINUE;
+        break;
+    }
+
+    search_rank(s);
+    draw_search(s);
+    log_msg("Search '%s': %d of %d", s->query, s->level_counts[s->query_len], s->count);
+    return PICKER_CONTINUE;
+}
+
+// Returns the chosen window index, or run_picker_loop()'s codes
+int select_by_search(const Config *config, const JumpRequest *req, const int *indices, int count) {
+    TraceMark mark = trace_begin();
+    if (!init_hints()) {
+        fprintf(err_stream, "No font for the search box\n");
+        return -2;
+    }
+
+    size_t haystack_len = 0;
+    for (int i = 0; i < count; i++) {
+        haystack_len += strlen(window_class(indices[i])) + strlen(window_title(indices[i])) + 2;
+    }
+    char *haystack = malloc(haystack_len > 0 ? haystack_len : 1);
+    uint32_t *offsets = malloc(sizeof(*offsets) * (size_t)(count + 1));
+    SearchPicker s = { .indices = indices, .count = count, .haystack = haystack, .offsets = offsets };
+    s.levels[0] = malloc(sizeof(*s.levels[0]) * (size_t)count);
+    if (!haystack || !offsets || !s.levels[0] || haystack_len > UINT32_MAX) {
+        fprintf(err_stream, "Out of memory\n");
+        free(haystack);
+        free(offsets);
+        free(s.levels[0]);
+        return -2;
+    }
+
+    char *p = haystack;
+    for (int i = 0; i < count; i++) {
+        offsets[i] = (uint32_t)(p - haystack);
+        for (const char *c = window_class(indices[i]); *c; c++) *p++ = (char)tolower((unsigned char)*c);
+        *p++ = ' ';
+        for (const char *c = window_title(indices[i]); *c; c++) *p++ = (char)tolower((unsigned char)*c);
+        *p++ = '\0';
+        s.levels[0][i] = (SearchHit){ 0, i };
+    }
+    offsets[count] = (uint32_t)(p - haystack);
+    s.level_counts[0] = count;
+    trace_end(&mark, "search_index", 0);
+
+    int screen_w = DisplayWidth(display, DefaultScreen(display));
+    s.box_w = hint_font->max_bounds.width * SEARCH_WIDTH_CHARS + 2 * HINT_PAD;
+    if (s.box_w > screen_w) s.box_w = screen_w;
+    s.box_h = (SEARCH_ROWS + 1) * hint_h;
+    log_section("SEARCH MODE");
+    log_msg("Searching %d windows (%zu bytes)", count, haystack_len);
+    search_rank(&s);
+    draw_search(&s);
+
+    int result = run_picker_loop(config, req, search_key, &s);
+    for (int i = 0; i <= s.query_len; i++) free(s.levels[i]);
+    free(haystack);
+    free(offsets);
+    return result;
+}
+
+// Activates windows[target_idx] and, with --confirm, waits for the WM to report it focused
+int activate_target(const Config *config, const JumpRequest *req, int target_idx, long current_desktop) {
+    int confirm = req->confirm || config->confirm_activation;
+    Window target = windows.ids[target_idx];
+    if (confirm) {
+        // Subscribe before activating so the confirming event cannot be missed
+        if (compositor) {
+            compositor_subscribe();
+        } else {
+            select_root_events(PropertyChangeMask);
+        }
+    }
+    int already_active = confirm && read_active_window() == (long)target;
+
+    TraceMark mark = trace_begin();
+    if (compositor) {
+        log_msg("ACTIVATING: [%lu] desktop=%ld %s - %s", (unsigned long)target, windows.desktops[target_idx],
+                window_class(target_idx), window_title(target_idx));
+        if (!compositor->focus(target)) {
+            fprintf(err_stream, "%s did not focus window %lu\n", compositor->name, (unsigned long)target);
+            log_msg("ERROR: %s focus command failed for %lu", compositor->name, (unsigned long)target);
+            return 2;
+        }
+    } else if (activate_window(config, req, target_idx, current_desktop) < 0) {
+        return 1;
+    }
+    trace_end(&mark, "activate", 0);
+
+    if (confirm) {
+        mark = trace_begin();
+        int confirmed = already_active ||
+                        (compositor ? wait_for_compositor_focus(target, config->activation_timeout_ms) :
+                         wait_for_root_value(config, req, atom_net_active_window, read_active_window,
+                                             (long)target, config->activation_timeout_ms));
+        trace_end(&mark, "confirm", 0);
+        if (confirmed < 0) return 1;
+        if (!confirmed) {
+            fprintf(err_stream, "Activation of window %lu not confirmed within %d ms\n",
+                    (unsigned long)target, config->activation_timeout_ms);
+            log_msg("ERROR: active window is %ld, expected %lu after %d ms",
+                    read_active_window(), (unsigned long)target, config->activation_timeout_ms);
+            return EXIT_ACTIVATION_TIMEOUT;
+        }
+
+        long long latency_ns = monotonic_ns() - req->start_ns;
+        if (!metrics_request_waited) hist_record(&metrics.confirm_latency, latency_ns);
+        double latency_ms = (double)latency_ns / 1e6;
+        fprintf(out_stream, "confirmed wid=%lu latency_ms=%.3f\n", (unsigned long)target, latency_ms);
+        log_msg("SUCCESS: Focus confirmed on %lu, %.3f ms after invocation", (unsigned long)target, latency_ms);
+        return 0;
+    }
+
+    log_msg("SUCCESS: Window activated");
+    return 0;
+}
+
+extern char **environ;
+
+// The child gets its own session and default signal handling, so it neither dies with
+// winleap's process group nor inherits the daemon's ignored SIGPIPE
+int spawn_command(const char *command, pid_t *pid) {
+    posix_spawnattr_t attr;
+    sigset_t defaults, empty;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    sigaddset(&defaults, SIGCHLD);
+    sigemptyset(&empty);
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    char *argv[] = { "sh", "-c", (char *)command, NULL };
+    int err = posix_spawn(pid, "/bin/sh", NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    return err;
+}
+
+static int compare_window_ids(const void *a, const void *b) {
+    Window x = *(const Window *)a;
+    Window y = *(const Window *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Windows that showed up after the launch, already selected for PropertyNotify
+typedef struct {
+    const Window *known;  // sorted client list from before the launch
+    unsigned long known_count;
+    Window *seen;
+    int seen_count;
+    int seen_capacity;
+} LaunchWatch;
+
+static int launch_watch_seen(const LaunchWatch *watch, Window win) {
+    for (int i = 0; i < watch->seen_count; i++) {
+        if (watch->seen[i] == win) return 1;
+    }
+    return 0;
+}
+
+// A window is only a candidate once; later class or title changes re-check it through
+// PropertyNotify, since many clients set their title after mapping
+static int check_launched_window(const Config *config, int mark_slot, LaunchWatch *watch,
+                                 Window win, int recheck, WindowInfo *info) {
+    if (bsearch(&win, watch->known, watch->known_count, sizeof(Window), compare_window_ids)) return 0;
+    if (recheck != launch_watch_seen(watch, win)) return 0;
+    if (!recheck) {
+        if (watch->seen_count == watch->seen_capacity) {
+            int capacity = watch->seen_capacity ? watch->seen_capacity * 2 : 16;
+            Window *seen = realloc(watch->seen, sizeof(*seen) * (size_t)capacity);
+            if (!seen) return 0;
+            watch->seen = seen;
+            watch->seen_capacity = capacity;
+        }
+        watch->seen[watch->seen_count++] = win;
+        XSelectInput(display, win, PropertyChangeMask);
+    }
+
+    if (!load_window_info(win, info, FETCH_ALL, 0, -1)) return 0;
+    int hit = rule_matches(&config->matchers[mark_slot], info->wm_class, info->instance, info->title);
+    log_msg("Launch candidate [%lu] %s (%s) - %s: %s", (unsigned long)win, info->wm_class,
+            info->instance, info->title, hit ? "match" : "no match");
+    return hit;
+}
+
+// Compositor variant of launch_and_focus(): windows reported on the event stream after the
+// spawn are the candidates, rechecked as title and class updates arrive
+int launch_and_focus_compositor(const Config *config, const JumpRequest *req, int mark_slot, const char *command) {
+    TraceMark mark = trace_begin();
+    if (!compositor_subscribe()) {
+        fprintf(err_stream, "Cannot subscribe to %s events\n", compositor->name);
+        return 2;
+    }
+    read_compositor_events();
+    int first_new = windows.count;
+
+    signal(SIGCHLD, SIG_IGN);
+    pid_t pid;
+    int err = spawn_command(command, &pid);
+    trace_end(&mark, "launch", 0);
+    if (err != 0) {
+        fprintf(err_stream, "Failed to launch '%s': %s\n", command, strerror(err));
+        log_msg("ERROR: posix_spawn failed for '%s': %s", command, strerror(err));
+        return 1;
+    }
+    log_msg("LAUNCHED pid=%d: %s", (int)pid, command);
+    metrics.launches++;
+    metrics_request_waited = 1;
+    if (config->launch_timeout_ms == 0) return 0;
+
+    mark = trace_begin();
+    long long deadline = monotonic_ns() + (long long)config->launch_timeout_ms * 1000000;
+    int found = -1;
+    int result = 0;
+    while (1) {
+        read_compositor_events();
+        for (int i = first_new; i < windows.count && found < 0; i++) {
+            if (window_matches_mark(config, mark_slot, i)) found = i;
+        }
+        if (found >= 0) break;
+
+        long long remaining_ns = deadline - monotonic_ns();
+        if (compositor_lost) {
+            fprintf(err_stream, "Lost connection to %s\n", compositor->name);
+            result = 2;
+            break;
+        }
+        if (remaining_ns <= 0) {
+            fprintf(err_stream, "No window for mark %d appeared within %d ms of launching '%s'\n",
+                    req->number, config->launch_timeout_ms, command);
+            log_msg("ERROR: launch of '%s' mapped no matching window in %d ms", command,
+                    config->launch_timeout_ms);
+            result = EXIT_ACTIVATION_TIMEOUT;
+            break;
+        }
+        int waited = wait_for_x_or_request(req, (int)((remaining_ns + 999999) / 1000000));
+        if (waited < 0) {
+            result = waited == -2 ? 2 : 1;
+            break;
+        }
+    }
+    trace_end(&mark, "launch_wait", found >= 0 ? (unsigned long)windows.ids[found] : 0);
+    return found >= 0 ? activate_target(config, req, found, -1) : result;
+}
+
+// exec.<mark>: the mark has no window, so run its command and focus the first new window that
+// satisfies the rule. Root events are selected and the client list is read before the spawn,
+// so a window that maps right away is not missed. The wait is a poll() on the X connection
+// that ends on MapNotify or a _NET_CLIENT_LIST change, the timeout, or (in the daemon) a newer
+// request.
+int launch_and_focus(const Config *config, const JumpRequest *req, int mark_slot, const char *command) {
+    if (compositor) return launch_and_focus_compositor(config, req, mark_slot, command);
+
+    TraceMark mark = trace_begin();
+    select_root_events(SubstructureNotifyMask | PropertyChangeMask);
+
+    Atom actual_type;
+    int actual_format;
+    unsigned long nitems = 0;
+    unsigned char *prop = NULL;
+    LaunchWatch watch = {0};
+    if (get_full_window_property(root, atom_net_client_list, CLIENT_LIST_FETCH_LONGS,
+                                 XA_WINDOW, &actual_type, &actual_format, &nitems, &prop)) {
+        qsort(prop, nitems, sizeof(Window), compare_window_ids);
+        watch.known = (const Window *)prop;
+        watch.known_count = nitems;
+    }
+
+    // winleap never waits for its children; let the kernel reap the shell
+    signal(SIGCHLD, SIG_IGN);
+    pid_t pid;
+    int err = spawn_command(command, &pid);
+    trace_end(&mark, "launch", 0);
+    if (err != 0) {
+        fprintf(err_stream, "Failed to launch '%s': %s\n", command, strerror(err));
+        log_msg("ERROR: posix_spawn failed for '%s': %s", command, strerror(err));
+        release_root_events(SubstructureNotifyMask);
+        if (prop) XFree(prop);
+        return 1;
+    }
+    log_msg("LAUNCHED pid=%d: %s", (int)pid, command);
+    metrics.launches++;
+    metrics_request_waited = 1;
+
+    if (config->launch_timeout_ms == 0) {
+        release_root_events(SubstructureNotifyMask);
+        if (prop) XFree(prop);
+        return 0;
+    }
+
+    mark = trace_begin();
+    long long deadline = monotonic_ns() + (long long)config->launch_timeout_ms * 1000000;
+    WindowInfo info;
+    Window found = 0;
+    int result = 0;
+    int superseded = 0;
+    while (!found) {
+        while (!found && !superseded && XPending(display) > 0) {
+            XEvent event;
+            XNextEvent(display, &event);
+            int key = handle_waiting_key_event(config, req, &event);
+            superseded = key < 0;
+            if (key) continue;
+            handle_window_table_event(&event);
+
+            if (event.type == MapNotify && event.xmap.event == root) {
+                // Reparenting WMs map a frame here, which has no WM_CLASS; the client list catches those
+                if (!event.xmap.override_redirect &&
+                    check_launched_window(config, mark_slot, &watch, event.xmap.window, 0, &info)) {
+                    found = event.xmap.window;
+                }
+            } else if (event.type == PropertyNotify && event.xproperty.window == root) {
+                if (event.xproperty.atom != atom_net_client_list) continue;
+                unsigned long count = 0;
+                unsigned char *list = NULL;
+                if (!get_full_window_property(root, atom_net_client_list, CLIENT_LIST_FETCH_LONGS,
+                                              XA_WINDOW, &actual_type, &actual_format, &count, &list)) {
+                    continue;
+                }
+                const Window *ids = (const Window *)list;
+                for (unsigned long k = 0; k < count && !found; k++) {
+                    if (check_launched_window(config, mark_slot, &watch, ids[k], 0, &info)) found = ids[k];
+                }
+                XFree(list);
+            } else if (event.type == PropertyNotify &&
+                       (event.xproperty.atom == atom_wm_class ||
+                        event.xproperty.atom == atom_net_wm_name ||
+                        event.xproperty.atom == XA_WM_NAME)) {
+                if (check_launched_window(config, mark_slot, &watch, event.xproperty.window, 1, &info)) {
+                    found = event.xproperty.window;
+                }
+            }
+        }
+        if (found) break;
+        if (superseded) {
+            result = 1;
+            break;
+        }
+
+        long long remaining_ns = deadline - monotonic_ns();
+        if (remaining_ns <= 0) {
+            fprintf(err_stream, "No window for mark %d appeared within %d ms of launching '%s'\n",
+                    req->number, config->launch_timeout_ms, command);
+            log_msg("ERROR: launch of '%s' mapped no matching window in %d ms", command,
+                    config->launch_timeout_ms);
+            result = EXIT_ACTIVATION_TIMEOUT;
+            break;
+        }
+        int waited = wait_for_x_or_request(req, (int)((remaining_ns + 999999) / 1000000));
+        if (waited < 0) {
+            result = waited == -2 ? 2 : 1;
+            break;
+        }
+    }
+    trace_end(&mark, "launch_wait", (unsigned long)found);
+
+    release_root_events(SubstructureNotifyMask);
+    free(watch.seen);
+    if (prop) XFree(prop);
+    if (!found) return result;
+
+    // The new window is usually not listed yet in a live table; the next sync keeps this row
+    int idx = find_window_index(found);
+    if (idx < 0) {
+        idx = table_append_info(&windows, &info);
+        if (idx < 0) {
+            fprintf(err_stream, "Out of memory\n");
+            return 2;
+        }
+        class_index_dirty = 1;
+        window_table_changed = 1;
+    }
+    return activate_target(config, req, idx, -1);
+}
+
+// Stable insertion sort, most recently focused first; never-focused windows keep list order.
+// The active window always has the newest stamp but is the least likely target, so it goes
+// last, like in find_previous_window().
+void order_by_recency(int *indices, int count) {
+    for (int i = 1; i < count; i++) {
+        int idx = indices[i];
+        int j = i;
+        while (j > 0 && windows.focus_seq[indices[j - 1]] < windows.focus_seq[idx]) {
+            indices[j] = indices[j - 1];
+            j--;
+        }
+        indices[j] = idx;
+    }
+    if (count > 1 && cached_active_window && windows.ids[indices[0]] == cached_active_window) {
+        int active = indices[0];
+        memmove(indices, indices + 1, sizeof(*indices) * (size_t)(count - 1));
+        indices[count - 1] = active;
+    }
+}
+
+// The most recently focused window other than the active one, or -1
+int find_previous_window(int current_workspace_only, long current_desktop) {
+    int best = -1;
+    for (int i = 0; i < windows.count; i++) {
+        if (windows.ids[i] == cached_active_window || windows.focus_seq[i] == 0) continue;
+        if (current_workspace_only && !in_scope(windows.desktops[i], 1, current_desktop)) continue;
+        if (best < 0 || windows.focus_seq[i] > windows.focus_seq[best]) best = i;
+    }
+    return best;
+}
+
+// --back: focus history only exists in the daemon, where the table is live
+int run_back(const Config *config, const JumpRequest *req) {
+    if (!window_table_live) {
+        fprintf(err_stream, "No focus history; --back needs a running winleap daemon\n");
+        log_msg("ERROR: --back without a live window table");
+        return 1;
+    }
+
+    long current_desktop = req->current_workspace_only ? cached_current_desktop : -1;
+    int target_idx = find_previous_window(req->current_workspace_only, current_desktop);
+    if (target_idx < 0) {
+        fprintf(err_stream, "No previously focused window%s\n",
+                req->current_workspace_only ? " (current workspace)" : "");
+        log_msg("No previous window in focus history");
+        return 1;
+    }
+    log_msg("Back to [%lu] %s - %s", (unsigned long)windows.ids[target_idx],
+            window_class(target_idx), window_title(target_idx));
+    return activate_target(config, req, target_idx, current_desktop);
+}
+
+// --search: the candidates are every window in scope except the active one
+int run_search(const Config *config, const JumpRequest *req) {
+    if (compositor) {
+        fprintf(err_stream, "--search needs X11: the search box is an X window\n");
+        log_msg("ERROR: --search on %s", compositor->name);
+        return 1;
+    }
+
+    TraceMark mark = trace_begin();
+    long current_desktop = -1;
+    if (req->current_workspace_only) {
+        current_desktop = window_table_live ? cached_current_desktop : get_current_desktop();
+        log_msg("Current desktop: %ld", current_desktop);
+    }
+    if (window_table_live && windows.count > 0) {
+        log_msg("Using live window table (%d windows)", windows.count);
+    } else if (window_table_live || !discover_windows(FETCH_ALL, req->current_workspace_only, current_desktop)) {
+        fprintf(err_stream, "Failed to discover windows\n");
+        log_msg("ERROR: discover_windows failed");
+        return 2;
+    }
+    trace_end(&mark, "discover_windows", 0);
+
+    int *candidates = malloc(sizeof(*candidates) * (size_t)(windows.count > 0 ? windows.count : 1));
+    if (!candidates) {
+        fprintf(err_stream, "Out of memory\n");
+        return 2;
+    }
+    Window active_window = cached_active_window;
+    if (!window_table_live && !get_active_window(&active_window)) active_window = 0;
+    int count = 0;
+    for (int i = 0; i < windows.count; i++) {
+        if (!in_scope(windows.desktops[i], req->current_workspace_only, current_desktop)) continue;
+        if (windows.ids[i] == active_window) continue;
+        candidates[count++] = i;
+    }
+    if (count == 0) {
+        fprintf(err_stream, "No windows to search%s\n", req->current_workspace_only ? " (current workspace)" : "");
+        log_msg("No windows in scope for search");
+        free(candidates);
+        return 1;
+    }
+    order_by_recency(candidates, count);
+
+    mark = trace_begin();
+    int target_idx = select_by_search(config, req, candidates, count);
+    trace_end(&mark, "picker", 0);
+    free(candidates);
+    if (target_idx == -1 || target_idx == -3) return 1;
+    if (target_idx < 0) return 2;
+
+    log_msg("Search target: [%lu] %s - %s", (unsigned long)windows.ids[target_idx],
+            window_class(target_idx), window_title(target_idx));
+    return activate_target(config, req, target_idx, current_desktop);
+}
+
+int run_jump(const Config *config, const JumpRequest *req) {
+    if (req->back) return run_back(config, req);
+    if (req->search) return run_search(config, req);
+
+    TraceMark mark = trace_begin();
+    char active_class[MAX_CLASS_LEN] = {0};
+    char rule_text[MAX_RULE_TEXT_LEN];
+    const char *target_class = NULL;
+    int mark_slot = -1;
+    int current_workspace_only = req->current_workspace_only;
+    int instance_number = req->number;
+    if (req->current_application_mode) {
+        Window active_window = 0;
+        if (table_is_current()) {
+            active_window = cached_active_window;
+        } else if (!get_active_window(&active_window)) {
+            active_window = 0;
+        }
+        if (active_window == 0) {
+            fprintf(err_stream, "No active window found for --current-application mode\n");
+            log_msg("ERROR: Cannot resolve active window");
+            return 1;
+        }
+
+        int active_idx = table_is_current() ? find_window_index(active_window) : -1;
+        if (active_idx >= 0 && window_class(active_idx)[0]) {
+            snprintf(active_class, sizeof(active_class), "%s", window_class(active_idx));
+        } else if (compositor || !get_wm_class(active_window, active_class, sizeof(active_class))) {
+            fprintf(err_stream, "Failed to read WM_CLASS of active window\n");
+            log_msg("ERROR: Cannot read WM_CLASS for active window %lu", (unsigned long)active_window);
+            return 1;
+        }
+        target_class = active_class;
+        log_msg("Active window: %lu", (unsigned long)active_window);
+        log_msg("Target WM_CLASS from active window: %s", target_class);
+        log_msg("Requested app instance index: %d", instance_number);
+    } else {
+        int mark_num = req->number;
+        mark_slot = find_mark_slot(config, mark_num);
+        if (mark_slot < 0) {
+            fprintf(err_stream, "No mapping found for mark %d\n", mark_num);
+            log_msg("ERROR: No mapping found for mark %d", mark_num);
+            return 1;
+        }
+        format_mark_rule(&config->marks[mark_slot], rule_text, sizeof(rule_text));
+        target_class = rule_text;
+        log_msg("Target %s: %s", mark_is_simple(&config->matchers[mark_slot]) ? "WM_CLASS" : "rule",
+                target_class);
+    }
+    trace_end(&mark, "resolve_target", 0);
+
+    mark = trace_begin();
+    long current_desktop = -1;
+    if (current_workspace_only) {
+        current_desktop = table_is_current() ? cached_current_desktop : get_current_desktop();
+        log_msg("Current desktop: %ld", current_desktop);
+    }
+
+    // Titles only feed the debug log; the target's desktop is read at activation if needed
+    unsigned fetch = debug_enabled ? FETCH_ALL : 0;
+    if (mark_slot >= 0 && config->matchers[mark_slot].title_match.kind != MATCH_ANY) fetch |= FETCH_TITLE;
+
+    if (table_is_current() && windows.count > 0) {
+        log_msg("Using live window table (%d windows)", windows.count);
+    } else if (table_is_current() || !discover_windows(fetch, current_workspace_only, current_desktop)) {
+        fprintf(err_stream, "Failed to discover windows\n");
+        log_msg("ERROR: discover_windows failed");
+        return 2;
+    }
+    trace_end(&mark, "discover_windows", 0);
+
+    mark = trace_begin();
+    static int *matching_indices = NULL;
+    static int matching_capacity = 0;
+    if (matching_capacity < windows.count) {
+        int *grown = realloc(matching_indices, sizeof(*grown) * (size_t)windows.count);
+        if (!grown) {
+            fprintf(err_stream, "Out of memory\n");
+            return 2;
+        }
+        matching_indices = grown;
+        matching_capacity = windows.count;
+    }
+    int match_count = mark_slot >= 0 ?
+                      find_windows_by_mark(config, mark_slot, current_workspace_only, current_desktop,
+                                           matching_indices, matching_capacity) :
+                      find_windows_by_class_and_scope(target_class, current_workspace_only, current_desktop,
+                                                      matching_indices, matching_capacity);
+    trace_end(&mark, "match", 0);
+
+    if (match_count == 0) {
+        const char *command = mark_slot >= 0 ? find_launch_command(config, req->number) : NULL;
+        if (command) {
+            log_msg("No matches for '%s'; launching exec.%d", target_class, req->number);
+            return launch_and_focus(config, req, mark_slot, command);
+        }
+        fprintf(err_stream, "No windows found for: %s%s\n",
+                target_class,
+                current_workspace_only ? " (current workspace)" : "");
+        log_msg("No matches for class '%s' in scope", target_class);
+        return 1;
+    }
+
+    log_section("MATCHING WINDOWS");
+    for (int i = 0; i < match_count; i++) {
+        int idx = matching_indices[i];
+        log_msg("  [%d] wid=%lu desktop=%ld class=%s title=%s",
+                i,
+                (unsigned long)windows.ids[idx],
+                windows.desktops[idx],
+                window_class(idx),
+                window_title(idx));
+    }
+
+    int target_idx = -1;
+
+    if (req->current_application_mode) {
+        int target_pos = instance_number - 1;
+        if (target_pos < 0 || target_pos >= match_count) {
+            fprintf(err_stream, "Requested instance %d, but found %d matching windows for %s%s\n",
+                    instance_number,
+                    match_count,
+                    target_class,
+                    current_workspace_only ? " (current workspace)" : "");
+            log_msg("ERROR: Requested instance %d but only %d matches", instance_number, match_count);
+            return 1;
+        }
+        target_idx = matching_indices[target_pos];
+        log_msg("Current-application mode: selecting instance position %d directly", target_pos);
+    } else if (match_count == 1) {
+        target_idx = matching_indices[0];
+        log_msg("Single instance: immediate activation");
+    } else if (req->most_recent) {
+        order_by_recency(matching_indices, match_count);
+        target_idx = matching_indices[0];
+        log_msg("Most recent of %d instances: immediate activation", match_count);
+    } else {
+        log_msg("Multiple instances (%d): entering instance-select mode", match_count);
+        if (config->picker_recent_first) order_by_recency(matching_indices, match_count);
+        mark = trace_begin();
+        target_idx = select_instance_interactively(config, req, matching_indices, match_count);
+        trace_end(&mark, "picker", 0);
+
+        if (target_idx == -1 || target_idx == -3) {
+            return 1;
+        }
+        if (target_idx < 0) {
+            return 2;
+        }
+    }
+
+    return activate_target(config, req, target_idx, current_workspace_only ? current_desktop : -1);
+}
+
+int format_request(char *out, size_t out_size, const JumpRequest *req) {
+    int n = snprintf(out, out_size, "jump number=%d workspace=%d application=%d recent=%d back=%d search=%d debug=%d confirm=%d trace=%d start_ns=%lld\n",
+                     req->number,
+                     req->current_workspace_only,
+                     req->current_application_mode,
+                     req->most_recent,
+                     req->back,
+                     req->search,
+                     req->debug,
+                     req->confirm,
+                     req->trace,
+                     req->start_ns);
+    return n > 0 && (size_t)n < out_size;
+}
+
+int parse_request(char *line, JumpRequest *req) {
+    if (!line || !req) return 0;
+    memset(req, 0, sizeof(*req));
+
+    char *saveptr = NULL;
+    char *token = strtok_r(line, " \t\r\n", &saveptr);
+    if (!token || strcmp(token, "jump") != 0) return 0;
+
+    while ((token = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL) {
+        char *eq = strchr(token, '=');
+        if (!eq) return 0;
+        *eq = '\0';
+
+        char *endptr = NULL;
+        long long value = strtoll(eq + 1, &endptr, 10);
+        if (endptr == eq + 1 || *endptr != '\0' || value < 0) return 0;
+
+        if (strcmp(token, "start_ns") == 0) {
+            req->start_ns = value;
+            continue;
+        }
+        if (value > INT_MAX) return 0;
+
+        if (strcmp(token, "number") == 0) {
+            req->number = (int)value;
+        } else if (strcmp(token, "workspace") == 0) {
+            req->current_workspace_only = value != 0;
+        } else if (strcmp(token, "application") == 0) {
+            req->current_application_mode = value != 0;
+        } else if (strcmp(token, "recent") == 0) {
+            req->most_recent = value != 0;
+        } else if (strcmp(token, "back") == 0) {
+            req->back = value != 0;
+        } else if (strcmp(token, "search") == 0) {
+            req->search = value != 0;
+        } else if (strcmp(token, "debug") == 0) {
+            req->debug = value != 0;
+        } else if (strcmp(token, "confirm") == 0) {
+            req->confirm = value != 0;
+        } else if (strcmp(token, "trace") == 0) {
+            req->trace = value != 0;
+        }
+        // Unknown keys are ignored so newer clients can talk to older daemons
+    }
+
+    if (req->start_ns == 0) {
+        req->start_ns = monotonic_ns();
+    }
+    return req->number > 0 || req->back || req->search;
+}
+
+// Sends one request line and relays the reply. Returns the daemon's exit code, or -1 when
+// no daemon is reachable.
+int send_daemon_line(const char *socket_path, const char *request) {
+    struct sockaddr_un addr;
+    if (!fill_socket_address(&addr, socket_path)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (!write_all(fd, request, strlen(request))) {
+        close(fd);
+        return -1;
+    }
+
+    FILE *reply = fdopen(fd, "r");
+    if (!reply) {
+        close(fd);
+        return -1;
+    }
+
+    // Reply lines: "out <text>", "err <text>", terminated by "exit <code>"
+    int exit_code = -1;
+    char *line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, reply) > 0) {
+        if (strncmp(line, "out ", 4) == 0) {
+            fputs(line + 4, stdout);
+        } else if (strncmp(line, "err ", 4) == 0) {
+            fputs(line + 4, stderr);
+        } else if (strncmp(line, "exit ", 5) == 0) {
+            exit_code = atoi(line + 5);
+            break;
+        }
+    }
+    free(line);
+    fclose(reply);
+
+    if (exit_code < 0) {
+        fprintf(stderr, "winleap daemon closed the connection without a reply\n");
+        return 2;
+    }
+    return exit_code;
+}
+
+int send_daemon_request(const char *socket_path, const JumpRequest *req) {
+    char request[MAX_REQUEST_LEN];
+    if (!format_request(request, sizeof(request), req)) return -1;
+    return send_daemon_line(socket_path, request);
+}
+
+int send_reply_stream(int fd, const char *prefix, const char *buf, size_t len) {
+    size_t start = 0;
+    while (start < len) {
+        const char *nl = memchr(buf + start, '\n', len - start);
+        size_t line_len = nl ? (size_t)(nl - (buf + start)) : len - start;
+        if (!write_all(fd, prefix, strlen(prefix)) ||
+            !write_all(fd, buf + start, line_len) ||
+            !write_all(fd, "\n", 1)) {
+            return 0;
+        }
+        start += line_len + 1;
+    }
+    return 1;
+}
+
+static void handle_stop_signal(int sig) {
+    (void)sig;
+    daemon_stop_requested = 1;
+}
+
+static int hotkey_grab_failed = 0;
+
+// Windows vanish between listing and querying; the default handler would kill the daemon
+static int daemon_x_error_handler(Display *dpy, XErrorEvent *event) {
+    if (event->request_code == X_GrabKey && event->error_code == BadAccess) {
+        hotkey_grab_failed = 1;
+        return 0;
+    }
+
+    char text[128];
+    XGetErrorText(dpy, event->error_code, text, sizeof(text));
+    log_msg("X error: %s (request %d, resource %lu)",
+            text, event->request_code, (unsigned long)event->resourceid);
+    return 0;
+}
+
+int open_daemon_socket(const char *socket_path) {
+    struct sockaddr_un addr;
+    if (!fill_socket_address(&addr, socket_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+
+    if (!ensure_parent_dir(socket_path)) {
+        fprintf(stderr, "Cannot create runtime directory for: %s\n", socket_path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    // A socket that still accepts connections belongs to a live daemon
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "winleap daemon already running on %s\n", socket_path);
+        close(fd);
+        return -1;
+    }
+    unlink(socket_path);
+
+    mode_t old_umask = umask(0077);
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_umask);
+    if (bound != 0 || listen(fd, 16) != 0) {
+        perror("Failed to bind daemon socket");
+        close(fd);
+        return -1;
+    }
+
+    // Connections are drained into the request queue until accept() runs dry
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+const char *jump_mode_name(const JumpRequest *req) {
+    if (req->back) return "back";
+    if (req->search) return "search";
+    if (req->current_application_mode) return "current-application";
+    return req->most_recent ? "mark (most recent)" : "mark";
+}
+
+// Runs one jump inside the daemon, for socket clients and hotkeys alike
+int serve_jump(const Config *config, const JumpRequest *req, const char *source,
+               int daemon_debug, const char *debug_path) {
+    debug_enabled = daemon_debug || config->debug || req->debug;
+    if (debug_enabled) open_debug_log(debug_path);
+
+    log_section(source);
+    log_msg("Number requested: %d", req->number);
+    log_msg("Mode: %s", jump_mode_name(req));
+    log_msg("Scope: %s", req->current_workspace_only ? "current workspace" : "global");
+
+    metrics_request_waited = 0;
+    int exit_code = run_jump(config, req);
+    metrics_record_jump(req, exit_code);
+    if (req->trace || config->trace) {
+        trace_emit(err_stream, req->start_ns);
+    }
+
+    debug_enabled = daemon_debug || config->debug;
+    return exit_code;
+}
+
+// Reads what has arrived without blocking. Returns 1 once the line is complete (newline,
+// full buffer or the client closed its end), 0 to wait for more and -1 for a dead connection.
+int read_request_line(PendingRead *pending) {
+    while (pending->len < sizeof(pending->line) - 1) {
+        ssize_t n = recv(pending->fd, pending->line + pending->len, sizeof(pending->line) - 1 - pending->len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) {
+            pending->line[pending->len] = '\0';
+            return pending->len > 0 ? 1 : -1;
+        }
+        pending->len += (size_t)n;
+        if (memchr(pending->line, '\n', pending->len)) break;
+    }
+    pending->line[pending->len] = '\0';
+    return 1;
+}
+
+int add_pending_read_fds(struct pollfd *fds, int nfds) {
+    for (int i = 0; i < num_pending_reads; i++) {
+        fds[nfds++] = (struct pollfd){ .fd = pending_reads[i].fd, .events = POLLIN };
+    }
+    return nfds;
+}
+
+// Shortens a poll() timeout so the oldest unfinished request line expires on time
+int pending_read_timeout(int timeout_ms) {
+    if (num_pending_reads == 0) return timeout_ms;
+    long long now = monotonic_ns();
+    for (int i = 0; i < num_pending_reads; i++) {
+        long long left_ms = (pending_reads[i].deadline_ns - now + 999999) / 1000000;
+        if (left_ms < 0) left_ms = 0;
+        if (timeout_ms < 0 || left_ms < timeout_ms) timeout_ms = (int)left_ms;
+    }
+    return timeout_ms;
+}
+
+void send_stats_reply(int fd) {
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&buf, &len);
+    if (!out) {
+        write_all(fd, "exit 2\n", 7);
+        return;
+    }
+    print_metrics(out);
+    fclose(out);
+    if (!send_reply_stream(fd, "out ", buf, len) || !write_all(fd, "exit 0\n", 7)) {
+        log_msg("WARNING: client went away before stats were sent");
+    }
+    free(buf);
+}
+
+// Accepts new connections, then moves every connection whose line is complete into the
+// request queue. Connections and lines arrive in any order; nothing here waits for either.
+int accept_pending_requests(void) {
+    while (queued_requests + num_pending_reads < MAX_QUEUED_REQUESTS) {
+        int fd = accept4(daemon_listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        PendingRead *pending = &pending_reads[num_pending_reads++];
+        pending->fd = fd;
+        pending->len = 0;
+        pending->deadline_ns = monotonic_ns() + (long long)REQUEST_READ_TIMEOUT_MS * 1000000;
+    }
+
+    int accepted = 0;
+    long long now = monotonic_ns();
+    for (int i = 0; i < num_pending_reads;) {
+        PendingRead *pending = &pending_reads[i];
+        int state = read_request_line(pending);
+        if (state == 0 && now < pending->deadline_ns) {
+            i++;
+            continue;
+        }
+
+        int fd = pending->fd;
+        char line[MAX_REQUEST_LEN];
+        memcpy(line, pending->line, pending->len + 1);
+        *pending = pending_reads[--num_pending_reads];
+
+        if (state < 0) {
+            close(fd);
+            continue;
+        }
+        // Replies are written in one go, as before the line arrived in pieces
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        if (state == 0) {
+            log_msg("WARNING: no request line within %d ms", REQUEST_READ_TIMEOUT_MS);
+            metrics.invalid_requests++;
+            write_all(fd, "err Incomplete daemon request\nexit 1\n", 37);
+            close(fd);
+            continue;
+        }
+        // Answered right away, so reading the stats never waits behind or supersedes a jump
+        if (strcmp(line, "stats\n") == 0) {
+            send_stats_reply(fd);
+            close(fd);
+            continue;
+        }
+
+        QueuedRequest *queued = &request_queue[queued_requests++];
+        queued->fd = fd;
+        queued->valid = parse_request(line, &queued->req);
+        accepted++;
+    }
+    return accepted;
+}
+
+// Serves the oldest queued request. Identical requests queued right behind it (key
+// auto-repeat, a double tap) get the same reply instead of a jump of their own.
+void serve_queued_request(const Config *config, int daemon_debug, const char *debug_path) {
+    TraceMark mark = trace_begin();
+    process_pending_events();
+    trace_reset();
+    trace_end(&mark, "daemon_event_drain", 0);
+
+    QueuedRequest head = request_queue[0];
+    char *out_buf = NULL;
+    char *err_buf = NULL;
+    size_t out_len = 0;
+    size_t err_len = 0;
+    out_stream = open_memstream(&out_buf, &out_len);
+    err_stream = open_memstream(&err_buf, &err_len);
+    if (!out_stream || !err_stream) {
+        if (out_stream) fclose(out_stream);
+        if (err_stream) fclose(err_stream);
+        out_stream = stdout;
+        err_stream = stderr;
+        close(head.fd);
+        queued_requests--;
+        memmove(request_queue, request_queue + 1, sizeof(*request_queue) * (size_t)queued_requests);
+        return;
+    }
+
+    int exit_code;
+    if (!head.valid) {
+        fprintf(err_stream, "Invalid daemon request\n");
+        metrics.invalid_requests++;
+        exit_code = 1;
+    } else {
+        serving_client_fd = head.fd;
+        picker_queue_start = 1;
+        exit_code = serve_jump(config, &head.req, "WINLEAP REQUEST", daemon_debug, debug_path);
+        serving_client_fd = -1;
+    }
+
+    fclose(out_stream);
+    fclose(err_stream);
+    out_stream = stdout;
+    err_stream = stderr;
+
+    int served = 1;
+    while (head.valid && served < queued_requests && request_queue[served].valid &&
+           same_jump(&request_queue[served].req, &head.req)) {
+        served++;
+    }
+    if (served > 1) log_msg("Coalesced %d identical requests", served);
+    metrics.coalesced_requests += (uint64_t)(served - 1);
+
+    char exit_line[32];
+    snprintf(exit_line, sizeof(exit_line), "exit %d\n", exit_code);
+    for (int i = 0; i < served; i++) {
+        int fd = request_queue[i].fd;
+        if (!send_reply_stream(fd, "out ", out_buf, out_len) ||
+            !send_reply_stream(fd, "err ", err_buf, err_len) ||
+            !write_all(fd, exit_line, strlen(exit_line))) {
+            log_msg("WARNING: client went away before reply was sent");
+        }
+        close(fd);
+    }
+    queued_requests -= served;
+    memmove(request_queue, request_queue + served, sizeof(*request_queue) * (size_t)queued_requests);
+
+    free(out_buf);
+    free(err_buf);
+}
+
+unsigned int find_numlock_mask(void) {
+    unsigned int mask = 0;
+    KeyCode numlock = XKeysymToKeycode(display, XK_Num_Lock);
+    XModifierKeymap *map = XGetModifierMapping(display);
+    if (!map) return 0;
+
+    for (int mod = 0; mod < 8; mod++) {
+        for (int k = 0; k < map->max_keypermod; k++) {
+            if (numlock && map->modifiermap[mod * map->max_keypermod + k] == numlock) {
+                mask = 1u << mod;
+            }
+        }
+    }
+    XFreeModifiermap(map);
+    return mask;
+}
+
+void grab_hotkeys(const Config *config) {
+    if (compositor) {
+        // Compositors keep key bindings to themselves; bind the winleap commands there instead
+        if (config->num_hotkeys > 0) {
+            fprintf(stderr, "Warning: hotkey.* needs X11; bind winleap in %s instead\n", compositor->name);
+        }
+        return;
+    }
+    XUngrabKey(display, AnyKey, AnyModifier, root);
+    if (config->num_hotkeys == 0) return;
+
+    numlock_mask = find_numlock_mask();
+    unsigned int lock_masks[] = {0, LockMask, numlock_mask, LockMask | numlock_mask};
+    int lock_count = numlock_mask ? 4 : 2;
+
+    for (int i = 0; i < config->num_hotkeys; i++) {
+        const Hotkey *hk = &config->hotkeys[i];
+        KeyCode code = XKeysymToKeycode(display, hk->keysym);
+        if (code == 0) {
+            fprintf(stderr, "Warning: hotkey %s has no key on this keyboard\n", hk->spec);
+            continue;
+        }
+
+        hotkey_grab_failed = 0;
+        for (int l = 0; l < lock_count; l++) {
+            XGrabKey(display, code, hk->modifiers | lock_masks[l], root, True, GrabModeAsync, GrabModeAsync);
+        }
+        XSync(display, False);
+
+        if (hotkey_grab_failed) {
+            fprintf(stderr, "Warning: hotkey %s is already grabbed by another client\n", hk->spec);
+            metrics.hotkey_grab_failures++;
+            log_msg("WARNING: hotkey %s already grabbed", hk->spec);
+        } else if (hk->back || hk->search) {
+            log_msg("Hotkey %s -> %s", hk->spec,
+                    hk->back ? "back" : (hk->current_workspace_only ? "workspace.search" : "search"));
+        } else {
+            log_msg("Hotkey %s -> %s%d", hk->spec,
+                    hk->current_application_mode ? "application." :
+                    hk->most_recent ? "recent." :
+                    (hk->current_workspace_only ? "workspace." : ""),
+                    hk->number);
+        }
+    }
+}
+
+void dispatch_hotkey(const Config *config, const XKeyEvent *event, int daemon_debug, const char *debug_path) {
+    const Hotkey *hk = find_hotkey(config, event);
+    if (!hk) return;
 
-    Atom actual_type;
-    int actual_format;
-    unsigned long nitems, bytes_after;
-    unsigned char *prop = NULL;
+    JumpRequest req;
+    hotkey_request(hk, &req);
 
-    if (XGetWindowProperty(display, root, atom_net_client_list, 0, 1024, False,
-                           XA_WINDOW, &actual_type, &actual_format,
-                           &nitems, &bytes_after, &prop) != Success || !prop) {
-        log_msg("ERROR: Cannot get _NET_CLIENT_LIST");
-        return 0;
-    }
+    // Socket requests already queued are older than this key press
+    picker_queue_start = queued_requests;
+    trace_reset();
+    metrics.hotkey_jumps++;
+    serve_jump(config, &req, "WINLEAP HOTKEY", daemon_debug, debug_path);
+    fflush(stdout);
+    fflush(stderr);
+}
 
-    Window *client_list = (Window *)prop;
-    num_windows = 0;
+// Watches the config's directory rather than the file itself: editors usually save by writing
+// a temporary file and renaming it over the original, which drops a watch on the old inode
+int watch_config_dir(const char *config_path) {
+    char dir[MAX_PATH_LEN];
+    snprintf(dir, sizeof(dir), "%s", config_path);
+    char *slash = strrchr(dir, '/');
+    if (!slash) {
+        snprintf(dir, sizeof(dir), ".");
+    } else if (slash == dir) {
+        dir[1] = '\0';
+    } else {
+        *slash = '\0';
+    }
 
-    for (unsigned long i = 0; i < nitems && num_windows < MAX_WINDOWS; i++) {
-        Window win = client_list[i];
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) return -1;
+    if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-        if (!get_wm_class(win, windows[num_windows].wm_class, MAX_CLASS_LEN)) {
-            continue;
+// Drains the inotify queue; a burst of events for the same save yields one reload
+int config_file_changed(int watch_fd, const char *config_path) {
+    const char *name = strrchr(config_path, '/');
+    name = name ? name + 1 : config_path;
+
+    int changed = 0;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(watch_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (event->len > 0 && strcmp(event->name, name) == 0) changed = 1;
+            p += sizeof(*event) + event->len;
         }
+    }
+    return changed;
+}
 
-        get_window_title(win, windows[num_windows].title, MAX_TITLE_LEN);
-        windows[num_windows].id = win;
-        windows[num_windows].desktop = get_window_desktop(win);
-
-        log_msg("  Found: [%lu] desktop=%ld %s - %s",
-                (unsigned long)win,
-                windows[num_windows].desktop,
-                windows[num_windows].wm_class,
-                windows[num_windows].title);
+// Once started, tracking stays on for the daemon's lifetime; turning the option off only hides them
+void start_thumbnails(const Config *config) {
+    if (!config->picker_thumbnails || compositor) return;
+#ifdef WINLEAP_THUMBNAILS
+    if (!init_thumbnails()) fprintf(stderr, "Thumbnails unavailable: the X server lacks Composite, Damage or Render\n");
+#else
+    log_msg("WARNING: picker_thumbnails needs a build with -DWINLEAP_THUMBNAILS");
+#endif
+}
 
-        num_windows++;
+// The new config replaces the old one between requests, and only if it parses
+void reload_config(Config *config, int daemon_debug, const char *config_path, const char *debug_path) {
+    Config fresh;
+    if (!load_config(config_path, &fresh)) {
+        fprintf(stderr, "Config reload failed, keeping the previous config: %s\n", config_path);
+        log_msg("ERROR: Config reload failed, keeping the previous config");
+        return;
     }
 
-    XFree(prop);
-    log_msg("Total windows: %d", num_windows);
-    return num_windows;
+    // A moved textfile would otherwise leave the old one behind with frozen values
+    if (config->metrics_textfile[0] && strcmp(config->metrics_textfile, fresh.metrics_textfile) != 0) {
+        unlink(config->metrics_textfile);
+    }
+    free_config(config);
+    *config = fresh;
+    forget_rule_matches();
+    metrics.config_reloads++;
+    metrics_dirty = 1;
+    debug_enabled = daemon_debug || config->debug;
+    if (debug_enabled) open_debug_log(debug_path);
+    log_section("CONFIG RELOADED");
+    log_msg("Marks: %d, hotkeys: %d, instance keys: %s",
+            config->num_marks, config->num_hotkeys, config->instance_keys);
+    grab_hotkeys(config);
+    start_thumbnails(config);
 }
 
-int find_windows_by_class_and_scope(const char *target_class,
-                                    int current_workspace_only,
-                                    long current_desktop,
-                                    int *indices,
-                                    int max_indices) {
-    int count = 0;
-
-    for (int i = 0; i < num_windows && count < max_indices; i++) {
-        if (strcasecmp(windows[i].wm_class, target_class) != 0) {
-            continue;
-        }
+// Rewrites metrics_textfile after a change, at most once per METRICS_WRITE_INTERVAL_MS.
+// Returns the poll() timeout that brings the daemon back for a write held off, or -1.
+int flush_metrics_textfile(const Config *config) {
+    static long long written_ns = 0;
+    if (!config->metrics_textfile[0] || !metrics_dirty) return -1;
 
-        if (current_workspace_only) {
-            if (current_desktop < 0) {
-                continue;
-            }
-            if (windows[i].desktop != current_desktop) {
-                continue;
-            }
-        }
+    long long now = monotonic_ns();
+    long long due = written_ns + (long long)METRICS_WRITE_INTERVAL_MS * 1000000;
+    if (written_ns && now < due) return (int)((due - now + 999999) / 1000000);
 
-        indices[count++] = i;
+    if (!write_metrics_textfile(config->metrics_textfile)) {
+        log_msg("WARNING: cannot write %s: %s", config->metrics_textfile, strerror(errno));
     }
-
-    return count;
+    written_ns = now;
+    metrics_dirty = 0;
+    return -1;
 }
 
-void activate_window(int idx) {
-    if (idx < 0 || idx >= num_windows) return;
+int run_daemon(Config *config, int daemon_debug, const char *config_path, const char *debug_path) {
+    metrics.start_ns = monotonic_ns();
+    char socket_path[MAX_PATH_LEN];
+    resolve_runtime_path(socket_path, sizeof(socket_path), ".sock");
 
-    Window win = windows[idx].id;
-    log_msg("ACTIVATING: [%lu] desktop=%ld %s - %s",
-            (unsigned long)win,
-            windows[idx].desktop,
-            windows[idx].wm_class,
-            windows[idx].title);
+    if (!compositor) {
+        display = XOpenDisplay(NULL);
+        if (!display) {
+            fprintf(stderr, "Cannot open display\n");
+            return 2;
+        }
+    }
 
-    long desktop = windows[idx].desktop;
-    if (desktop >= 0) {
-        XEvent switch_event = {0};
-        switch_event.xclient.type = ClientMessage;
-        switch_event.xclient.send_event = True;
-        switch_event.xclient.message_type = atom_net_current_desktop;
-        switch_event.xclient.window = root;
-        switch_event.xclient.format = 32;
-        switch_event.xclient.data.l[0] = desktop;
-        switch_event.xclient.data.l[1] = CurrentTime;
+    int listen_fd = open_daemon_socket(socket_path);
+    if (listen_fd < 0) {
+        if (display) XCloseDisplay(display);
+        return 2;
+    }
 
-        XSendEvent(display, root, False,
-                   SubstructureRedirectMask | SubstructureNotifyMask, &switch_event);
-        XFlush(display);
-        usleep(50000);
+    daemon_listen_fd = listen_fd;
+    if (display) {
+        root = DefaultRootWindow(display);
+        init_atoms();
+        XSetErrorHandler(daemon_x_error_handler);
+        // Held hotkeys then repeat as bare presses, which is_fresh_key_press() drops
+        XkbSetDetectableAutoRepeat(display, True, NULL);
     }
 
-    XEvent event = {0};
-    event.xclient.type = ClientMessage;
-    event.xclient.send_event = True;
-    event.xclient.message_type = atom_net_active_window;
-    event.xclient.window = win;
-    event.xclient.format = 32;
-    event.xclient.data.l[0] = 2;
-    event.xclient.data.l[1] = CurrentTime;
-    event.xclient.data.l[2] = 0;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
 
-    XSendEvent(display, root, False,
-               SubstructureRedirectMask | SubstructureNotifyMask, &event);
+    debug_enabled = daemon_debug || config->debug;
+    if (debug_enabled) open_debug_log(debug_path);
 
-    XMapRaised(display, win);
-    XRaiseWindow(display, win);
-    XSetInputFocus(display, win, RevertToPointerRoot, CurrentTime);
+    log_section("WINLEAP DAEMON STARTED");
+    log_msg("Config path: %s", config_path);
+    log_msg("Socket path: %s", socket_path);
+    log_msg("Instance keys: %s", config->instance_keys);
+    log_msg("Backend: %s", compositor ? compositor->name : "x11");
 
-    XFlush(display);
-}
+    if (!init_window_table()) {
+        fprintf(stderr, "Failed to discover windows\n");
+        close(listen_fd);
+        unlink(socket_path);
+        if (display) XCloseDisplay(display);
+        return 2;
+    }
+    grab_hotkeys(config);
+    start_thumbnails(config);
 
-int grab_keyboard(void) {
-    int grab_result = GrabSuccess;
-    int max_retries = 10;
-    int retry_delay_us = 10000;
+    char table_path[MAX_PATH_LEN];
+    resolve_runtime_path(table_path, sizeof(table_path), ".table");
+    open_shared_table(table_path);
 
-    for (int i = 0; i < max_retries; i++) {
-        grab_result = XGrabKeyboard(display, root, True, GrabModeAsync, GrabModeAsync, CurrentTime);
+    int watch_fd = watch_config_dir(config_path);
+    if (watch_fd < 0) {
+        log_msg("WARNING: cannot watch %s for changes: %s", config_path, strerror(errno));
+    }
 
-        if (grab_result == GrabSuccess) {
-            return 1;
+    struct pollfd fds[3 + MAX_QUEUED_REQUESTS];
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = compositor ? compositor_event_fd : ConnectionNumber(display);
+    fds[1].events = POLLIN;
+    fds[2].fd = watch_fd;
+    fds[2].events = POLLIN;
+
+    int exit_code = 0;
+    while (!daemon_stop_requested) {
+        // Xlib may already hold queued events that poll() cannot see
+        process_pending_events();
+        if (keyboard_mapping_changed) {
+            keyboard_mapping_changed = 0;
+            grab_hotkeys(config);
         }
-
-        if (grab_result == AlreadyGrabbed && i < max_retries - 1) {
-            usleep(retry_delay_us);
-            retry_delay_us = retry_delay_us * 3 / 2;
+        if (key_event_pending) {
+            key_event_pending = 0;
+            dispatch_hotkey(config, &pending_key_event, daemon_debug, debug_path);
             continue;
         }
+        if (queued_requests > 0) {
+            serve_queued_request(config, daemon_debug, debug_path);
+            continue;
+        }
+        if (compositor_lost) {
+            fprintf(stderr, "Lost connection to %s\n", compositor->name);
+            exit_code = 2;
+            break;
+        }
+        int thumbnail_timeout_ms = -1;
+#ifdef WINLEAP_THUMBNAILS
+        thumbnail_timeout_ms = refresh_stale_thumbnails();
+#endif
+        // A client-list sync or thumbnail refresh above can leave newly read events in Xlib's queue
+        if (display && XQLength(display) > 0) continue;
+        // Write the debug log and metrics while idle, after any reply has gone out
+        log_flush();
+        int timeout_ms = pending_read_timeout(flush_metrics_textfile(config));
+        if (thumbnail_timeout_ms >= 0 && (timeout_ms < 0 || thumbnail_timeout_ms < timeout_ms)) {
+            timeout_ms = thumbnail_timeout_ms;
+        }
+        int nfds = add_pending_read_fds(fds, 3);
+
+        // A negative fd is skipped by poll(), so a failed watch just never fires
+        if (poll(fds, (nfds_t)nfds, timeout_ms) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            exit_code = 2;
+            break;
+        }
 
-        break;
+        if (fds[1].revents & (POLLHUP | POLLERR)) {
+            fprintf(stderr, "Lost connection to %s\n", compositor ? compositor->name : "display");
+            exit_code = 2;
+            break;
+        }
+
+        if ((fds[2].revents & POLLIN) && config_file_changed(watch_fd, config_path)) {
+            reload_config(config, daemon_debug, config_path, debug_path);
+        }
+
+        if ((fds[0].revents & POLLIN) || num_pending_reads > 0) {
+            accept_pending_requests();
+        }
     }
 
-    log_msg("ERROR: Failed to grab keyboard (code %d)", grab_result);
-    return 0;
+    log_msg("Daemon stopping");
+    if (watch_fd >= 0) close(watch_fd);
+    for (int i = 0; i < queued_requests; i++) close(request_queue[i].fd);
+    queued_requests = 0;
+    for (int i = 0; i < num_pending_reads; i++) close(pending_reads[i].fd);
+    num_pending_reads = 0;
+    close_shared_table(table_path);
+    if (config->metrics_textfile[0]) unlink(config->metrics_textfile);
+    close(listen_fd);
+    unlink(socket_path);
+    if (compositor_event_fd >= 0) close(compositor_event_fd);
+    if (display) XCloseDisplay(display);
+    return exit_code;
 }
 
-int select_instance_interactively(const Config *config, const int *matching_indices, int match_count) {
-    if (!config || !matching_indices || match_count <= 0) {
-        return -2;
+// The first mark whose rule matches the window, in config order
+const char *find_mark_label(const Config *config, int idx, char *buf, size_t size) {
+    for (int i = 0; i < config->num_marks; i++) {
+        if (window_matches_mark(config, i, idx)) {
+            snprintf(buf, size, "%d", config->marks[i].number);
+            return buf;
+        }
     }
+    return "-";
+}
 
-    int key_count = (int)strlen(config->instance_keys);
-    if (match_count > key_count) {
-        fprintf(stderr, "Too many windows (%d) for instance_keys length (%d)\n", match_count, key_count);
-        log_msg("ERROR: %d matches exceed %d instance keys", match_count, key_count);
-        return -2;
-    }
+// --list: one tab-separated line per window, from the daemon's shared table when available
+int run_list(const Config *config, int current_workspace_only, int no_daemon) {
+    long current_desktop = -1;
+    Window active_window = 0;
 
-    log_section("INSTANCE SELECT MODE");
-    for (int i = 0; i < match_count; i++) {
-        int idx = matching_indices[i];
-        char selector = config->instance_keys[i];
-        log_msg("  '%c' -> [%lu] desktop=%ld %s - %s",
-                selector,
-                (unsigned long)windows[idx].id,
-                windows[idx].desktop,
-                windows[idx].wm_class,
-                windows[idx].title);
-    }
+    char table_path[MAX_PATH_LEN];
+    resolve_runtime_path(table_path, sizeof(table_path), ".table");
 
-    if (!grab_keyboard()) {
-        fprintf(stderr, "Failed to grab keyboard for instance selection\n");
-        return -2;
+    if (compositor && (no_daemon || !read_shared_table(table_path, &current_desktop, &active_window))) {
+        if (!compositor_sync()) {
+            fprintf(stderr, "Failed to discover windows\n");
+            return 2;
+        }
+        current_desktop = cached_current_desktop;
+        active_window = cached_active_window;
+    } else if (no_daemon || !read_shared_table(table_path, &current_desktop, &active_window)) {
+        display = XOpenDisplay(NULL);
+        if (!display) {
+            fprintf(stderr, "Cannot open display\n");
+            return 2;
+        }
+        root = DefaultRootWindow(display);
+        init_atoms();
+        current_desktop = get_current_desktop();
+        if (!get_active_window(&active_window)) active_window = 0;
+        int ok = discover_windows(FETCH_ALL, 0, -1);
+        XCloseDisplay(display);
+        display = NULL;
+        if (!ok) {
+            fprintf(stderr, "Failed to discover windows\n");
+            return 2;
+        }
     }
 
-    XFlush(display);
+    for (int i = 0; i < windows.count; i++) {
+        if (current_workspace_only && windows.desktops[i] != current_desktop) continue;
+
+        char mark_buf[16];
+        printf("%c\t0x%08lx\t%ld\t%s\t%s\t%s\n",
+               windows.ids[i] == active_window ? '*' : '-',
+               (unsigned long)windows.ids[i],
+               windows.desktops[i],
+               find_mark_label(config, i, mark_buf, sizeof(mark_buf)),
+               window_class(i),
+               window_title(i));
+    }
+    return 0;
+}
 
-    while (1) {
-        XEvent event;
-        XNextEvent(display, &event);
+// --batch: one command per stdin line, "mark <n>", "recent <n>", "app <n>" or "back",
+// optionally followed by --current-workspace and --confirm
+int parse_batch_command(char *line, JumpRequest *req) {
+    memset(req, 0, sizeof(*req));
+
+    char *saveptr = NULL;
+    char *token = strtok_r(line, " \t", &saveptr);
+    if (!token) return 0;
+    if (strcmp(token, "app") == 0) {
+        req->current_application_mode = 1;
+    } else if (strcmp(token, "recent") == 0) {
+        req->most_recent = 1;
+    } else if (strcmp(token, "back") == 0) {
+        req->back = 1;
+    } else if (strcmp(token, "mark") != 0) {
+        return 0;
+    }
 
-        if (event.type != KeyPress) {
-            continue;
+    while ((token = strtok_r(NULL, " \t", &saveptr)) != NULL) {
+        if (strcmp(token, "--current-workspace") == 0) {
+            req->current_workspace_only = 1;
+        } else if (strcmp(token, "--confirm") == 0) {
+            req->confirm = 1;
+        } else {
+            char *endptr = NULL;
+            long value = strtol(token, &endptr, 10);
+            if (req->back || req->number || endptr == token || *endptr != '\0' || value <= 0 || value > INT_MAX) {
+                return 0;
+            }
+            req->number = (int)value;
         }
+    }
+    return req->number > 0 || req->back;
+}
 
-        char key_buf[32];
-        KeySym keysym;
-        int len = XLookupString(&event.xkey, key_buf, sizeof(key_buf) - 1, &keysym, NULL);
-
-        if (keysym == XK_Escape) {
-            XUngrabKeyboard(display, CurrentTime);
-            log_msg("CANCELLED by user (ESC)");
-            return -1;
+// Runs every command over one connection. The window table is kept live as in the daemon,
+// so later commands only pay for what changed. Each command ends with a status line on
+// stdout: "<line>\t<exit code>\t<command>".
+int run_batch(const Config *config, const JumpRequest *defaults, const char *debug_path) {
+    if (!compositor) {
+        display = XOpenDisplay(NULL);
+        if (!display) {
+            fprintf(stderr, "Cannot open display\n");
+            return 2;
         }
+        root = DefaultRootWindow(display);
+        init_atoms();
+    }
 
-        if (len <= 0) {
-            continue;
-        }
+    debug_enabled = defaults->debug || config->debug;
+    if (debug_enabled) open_debug_log(debug_path);
+    log_section("WINLEAP BATCH STARTED");
 
-        key_buf[len] = '\0';
-        char typed = (char)tolower((unsigned char)key_buf[0]);
+    if (!init_window_table()) {
+        fprintf(stderr, "Failed to discover windows\n");
+        if (display) XCloseDisplay(display);
+        log_close();
+        return 2;
+    }
 
-        for (int i = 0; i < match_count; i++) {
-            if (typed == config->instance_keys[i]) {
-                int selected = matching_indices[i];
-                XUngrabKeyboard(display, CurrentTime);
-                log_msg("SELECTED selector '%c'", typed);
-                return selected;
+    int batch_exit = 0;
+    int line_no = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, stdin) > 0) {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        const char *text = line + strspn(line, " \t");
+        if (!*text || *text == '#') continue;
+
+        char command[MAX_REQUEST_LEN];
+        snprintf(command, sizeof(command), "%s", text);
+
+        JumpRequest req;
+        int exit_code;
+        if (!parse_batch_command(line, &req)) {
+            fprintf(stderr, "Invalid batch command on line %d: %s\n", line_no, command);
+            exit_code = 1;
+        } else {
+            req.debug = defaults->debug;
+            req.confirm |= defaults->confirm;
+            req.trace = defaults->trace;
+            req.start_ns = monotonic_ns();
+
+            trace_reset();
+            // Take in whatever earlier commands changed before matching against the table
+            TraceMark mark = trace_begin();
+            if (display) {
+                trace_round_trips++;
+                XSync(display, False);
             }
+            process_pending_events();
+            trace_end(&mark, "batch_refresh", 0);
+
+            log_section("BATCH COMMAND");
+            log_msg("Line %d: %s", line_no, command);
+            exit_code = run_jump(config, &req);
+            if (req.trace || config->trace) trace_emit(stderr, req.start_ns);
         }
 
-        log_msg("Ignored selector key '%c'", typed);
+        fprintf(stdout, "%d\t%d\t%s\n", line_no, exit_code, command);
+        fflush(stdout);
+        if (exit_code != 0) batch_exit = exit_code;
     }
+    free(line);
+
+    if (display) XCloseDisplay(display);
+    log_close();
+    return batch_exit;
 }
 
 void print_usage(const char *prog, const char *config_path, const char *debug_path) {
     printf("Usage:\n");
-    printf("  %s [--config <path>] [--current-workspace] [--current-application] [--debug] <number>\n", prog);
+    printf("  %s [--config <path>] [--current-workspace] [--current-application] [--recent] [--confirm] [--trace] [--debug] [--no-daemon] <number>\n", prog);
+    printf("  %s --back [--current-workspace] [--confirm]\n", prog);
+    printf("  %s --search [--current-workspace] [--confirm] [--no-daemon]\n", prog);
+    printf("  %s --list [--current-workspace] [--no-daemon]\n", prog);
+    printf("  %s --stats\n", prog);
+    printf("  %s --daemon [--config <path>] [--debug]\n", prog);
+    printf("  %s --batch [--config <path>] [--confirm] [--trace] [--debug] < commands\n", prog);
     printf("  %s --open-debug\n", prog);
     printf("  %s --help\n\n", prog);
 
     printf("Options:\n");
     printf("  --current-workspace  Only consider windows in current workspace\n");
     printf("  --current-application  Use active window app class; <number> becomes 1-based instance index\n");
+    printf("  --recent             Several matches: jump to the most recently focused one, no picker\n");
+    printf("  --back               Jump back to the previously focused window (needs the daemon)\n");
+    printf("  --search             Type to filter all windows by class and title, Return jumps\n");
+    printf("  --confirm            Wait until focus reaches the target and print the jump latency\n");
+    printf("  --trace              Print per-phase timings and X round trips to stderr\n");
     printf("  --debug              Force debug logging on for this run\n");
+    printf("  --daemon             Run as a persistent daemon serving jump requests\n");
+    printf("                       (and grabbing hotkey.<number>=... keys from the config)\n");
+    printf("  --no-daemon          Do the jump in this process even if a daemon is running\n");
+    printf("  --list               List managed windows (from the daemon's shared table when running)\n");
+    printf("  --stats              Print the daemon's counters and latency histograms (Prometheus format)\n");
+    printf("  --batch, --stdin     Run mark/recent/app/back commands from stdin over one connection\n");
     printf("  --open-debug         Print debug log path and contents\n");
-    printf("  --config <path>      Use a specific config file\n");
+    printf("  --config <path>      Use a specific config file (bypasses the daemon)\n");
     printf("  --help               Show this help\n\n");
 
+    printf("Exit codes:\n");
+    printf("  0  jumped (or nothing to do)\n");
+    printf("  1  usage, config, no match, or cancelled selection\n");
+    printf("  2  X11 failure (display, discovery, keyboard grab)\n");
+    printf("  %d  --confirm: focus not confirmed within activation_timeout_ms\n\n", EXIT_ACTIVATION_TIMEOUT);
+
     printf("Config resolution order:\n");
     printf("  1. --config <path>\n");
     printf("  2. $XDG_CONFIG_HOME/winleap/winleap.conf\n");
@@ -769,24 +6736,67 @@ void print_usage(const char *prog, const char *config_path, const char *debug_pa
     }
 }
 
+// winleap-microbench.c includes this file with WINLEAP_NO_MAIN to time the pure functions
+#ifndef WINLEAP_NO_MAIN
 int main(int argc, char *argv[]) {
+    TraceMark total_mark = trace_begin();
+    long long start_ns = total_mark.start_ns;
     int current_workspace_only = 0;
     int current_application_mode = 0;
+    int most_recent = 0;
+    int back = 0;
+    int search = 0;
     int cli_debug = 0;
+    int cli_confirm = 0;
+    int cli_trace = 0;
     int open_debug = 0;
     int show_help = 0;
+    int daemon_mode = 0;
+    int no_daemon = 0;
+    int list_mode = 0;
+    int stats_mode = 0;
+    int batch_mode = 0;
     const char *config_override = NULL;
     const char *number_arg = NULL;
 
+    out_stream = stdout;
+    err_stream = stderr;
+
+    const char *prog_name = strrchr(argv[0], '/');
+    prog_name = prog_name ? prog_name + 1 : argv[0];
+    if (strcmp(prog_name, "winleapd") == 0) {
+        daemon_mode = 1;
+    }
+
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--current-workspace") == 0) {
             current_workspace_only = 1;
         } else if (strcmp(argv[i], "--current-application") == 0) {
             current_application_mode = 1;
+        } else if (strcmp(argv[i], "--recent") == 0) {
+            most_recent = 1;
+        } else if (strcmp(argv[i], "--back") == 0) {
+            back = 1;
+        } else if (strcmp(argv[i], "--search") == 0) {
+            search = 1;
         } else if (strcmp(argv[i], "--debug") == 0) {
             cli_debug = 1;
+        } else if (strcmp(argv[i], "--confirm") == 0) {
+            cli_confirm = 1;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            cli_trace = 1;
         } else if (strcmp(argv[i], "--open-debug") == 0) {
             open_debug = 1;
+        } else if (strcmp(argv[i], "--daemon") == 0) {
+            daemon_mode = 1;
+        } else if (strcmp(argv[i], "--no-daemon") == 0) {
+            no_daemon = 1;
+        } else if (strcmp(argv[i], "--list") == 0) {
+            list_mode = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats_mode = 1;
+        } else if (strcmp(argv[i], "--batch") == 0 || strcmp(argv[i], "--stdin") == 0) {
+            batch_mode = 1;
         } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
             show_help = 1;
         } else if (strcmp(argv[i], "--config") == 0) {
@@ -806,8 +6816,65 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (search && number_arg) {
+        fprintf(stderr, "--search takes no number: %s\n", number_arg);
+        return 1;
+    }
+
+    int requested_number = 0;
+    if (!show_help && !open_debug && !daemon_mode && !list_mode && !stats_mode && !batch_mode && number_arg) {
+        requested_number = atoi(number_arg);
+        if (requested_number <= 0) {
+            fprintf(stderr, "Invalid number: %s\n", number_arg);
+            return 1;
+        }
+    }
+
+    JumpRequest req = {
+        .number = requested_number,
+        .current_workspace_only = current_workspace_only,
+        .current_application_mode = current_application_mode,
+        .most_recent = most_recent,
+        .back = back,
+        .search = search,
+        .debug = cli_debug,
+        .confirm = cli_confirm,
+        .trace = cli_trace,
+        .start_ns = start_ns,
+    };
+
+    // Hot path: a running daemon already holds the config, so skip resolving it here
+    if ((requested_number > 0 || back || search) && !no_daemon && !config_override) {
+        char socket_path[MAX_PATH_LEN];
+        resolve_runtime_path(socket_path, sizeof(socket_path), ".sock");
+        TraceMark mark = trace_begin();
+        int daemon_result = send_daemon_request(socket_path, &req);
+        if (daemon_result >= 0) {
+            if (cli_trace) {
+                trace_end(&mark, "daemon_request", 0);
+                trace_emit(stderr, start_ns);
+            }
+            return daemon_result;
+        }
+        trace_end(&mark, "daemon_probe", 0);
+    }
+
+    // The metrics live in the daemon; there is nothing to report without one
+    if (stats_mode && !show_help) {
+        char socket_path[MAX_PATH_LEN];
+        resolve_runtime_path(socket_path, sizeof(socket_path), ".sock");
+        int daemon_result = send_daemon_line(socket_path, "stats\n");
+        if (daemon_result < 0) {
+            fprintf(stderr, "No winleap daemon is running\n");
+            return 1;
+        }
+        return daemon_result;
+    }
+
+    TraceMark mark = trace_begin();
     char config_path[MAX_PATH_LEN];
     resolve_config_path(config_path, sizeof(config_path), argv[0], config_override);
+    trace_end(&mark, "config_resolve", 0);
 
     char debug_path[MAX_PATH_LEN];
     resolve_debug_log_path(debug_path, sizeof(debug_path));
@@ -821,173 +6888,92 @@ int main(int argc, char *argv[]) {
         return print_debug_log(debug_path);
     }
 
-    if (!number_arg) {
+    if (!daemon_mode && !list_mode && !batch_mode && !back && !search && !number_arg) {
         print_usage(argv[0], config_path, debug_path);
         return 1;
     }
 
-    int requested_number = atoi(number_arg);
-    if (requested_number <= 0) {
-        fprintf(stderr, "Invalid number: %s\n", number_arg);
-        return 1;
-    }
-
+    mark = trace_begin();
     Config config;
-    if (!read_config_file(config_path, &config)) {
+    if (!load_config(config_path, &config)) {
         fprintf(stderr, "Failed to read config: %s\n", config_path);
+        if (cli_trace) trace_emit(stderr, start_ns);
         return 1;
     }
+    trace_end(&mark, "read_config", 0);
+
+    if (!select_backend(config.backend)) {
+        if (cli_trace) trace_emit(stderr, start_ns);
+        return 2;
+    }
+
+    if (daemon_mode) {
+        return run_daemon(&config, cli_debug, config_path, debug_path);
+    }
+
+    if (list_mode) {
+        return run_list(&config, current_workspace_only, no_daemon);
+    }
+
+    if (batch_mode) {
+        return run_batch(&config, &req, debug_path);
+    }
 
     debug_enabled = cli_debug || config.debug;
 
     if (debug_enabled) {
-        if (!ensure_parent_dir(debug_path)) {
-            fprintf(stderr, "Warning: cannot create debug log directory for: %s\n", debug_path);
-        }
-        logfile = fopen(debug_path, "a");
-        if (!logfile) {
-            fprintf(stderr, "Warning: cannot open debug log file: %s\n", debug_path);
-        }
+        open_debug_log(debug_path);
     }
 
     log_section("WINLEAP STARTED");
     log_msg("Number requested: %d", requested_number);
-    log_msg("Mode: %s", current_application_mode ? "current-application" : "mark");
+    log_msg("Mode: %s", jump_mode_name(&req));
     log_msg("Scope: %s", current_workspace_only ? "current workspace" : "global");
     log_msg("Debug source: %s", cli_debug ? "--debug" : (config.debug ? "config" : "disabled"));
     log_msg("Config path: %s", config_path);
     log_msg("Debug path: %s", debug_path);
     log_msg("Instance keys: %s", config.instance_keys);
 
-    display = XOpenDisplay(NULL);
-    if (!display) {
-        fprintf(stderr, "Cannot open display\n");
-        log_msg("ERROR: Cannot open display");
-        if (logfile) fclose(logfile);
-        return 2;
-    }
-
-    root = DefaultRootWindow(display);
-    init_atoms();
-
-    char active_class[MAX_CLASS_LEN] = {0};
-    const char *target_class = NULL;
-    int instance_number = requested_number;
-    if (current_application_mode) {
-        Window active_window = 0;
-        if (!get_active_window(&active_window) || active_window == 0) {
-            fprintf(stderr, "No active window found for --current-application mode\n");
-            log_msg("ERROR: Cannot resolve active window");
-            XCloseDisplay(display);
-            if (logfile) fclose(logfile);
-            return 1;
-        }
-        if (!get_wm_class(active_window, active_class, sizeof(active_class))) {
-            fprintf(stderr, "Failed to read WM_CLASS of active window\n");
-            log_msg("ERROR: Cannot read WM_CLASS for active window %lu", (unsigned long)active_window);
-            XCloseDisplay(display);
-            if (logfile) fclose(logfile);
-            return 1;
+    int trace_enabled = cli_trace || config.trace;
+
+    if (compositor) {
+        log_msg("Backend: %s", compositor->name);
+        mark = trace_begin();
+        int synced = compositor_sync();
+        trace_end(&mark, "compositor_sync", 0);
+        if (!synced) {
+            fprintf(stderr, "Cannot reach %s over IPC\n", compositor->name);
+            if (trace_enabled) trace_emit(stderr, start_ns);
+            log_close();
+            return 2;
         }
-        target_class = active_class;
-        log_msg("Active window: %lu", (unsigned long)active_window);
-        log_msg("Target WM_CLASS from active window: %s", target_class);
-        log_msg("Requested app instance index: %d", instance_number);
     } else {
-        int mark_num = requested_number;
-        target_class = find_wmclass_for_mark(&config, mark_num);
-        if (!target_class) {
-            fprintf(stderr, "No mapping found for mark %d\n", mark_num);
-            log_msg("ERROR: No mapping found for mark %d", mark_num);
-            XCloseDisplay(display);
-            if (logfile) fclose(logfile);
-            return 1;
+        mark = trace_begin();
+        trace_round_trips++;
+        display = XOpenDisplay(NULL);
+        trace_end(&mark, "x_open_display", 0);
+        if (!display) {
+            fprintf(stderr, "Cannot open display\n");
+            log_msg("ERROR: Cannot open display");
+            if (trace_enabled) trace_emit(stderr, start_ns);
+            log_close();
+            return 2;
         }
-        log_msg("Target WM_CLASS: %s", target_class);
-    }
-
-    if (!discover_windows()) {
-        fprintf(stderr, "Failed to discover windows\n");
-        log_msg("ERROR: discover_windows failed");
-        XCloseDisplay(display);
-        if (logfile) fclose(logfile);
-        return 2;
-    }
-
-    long current_desktop = -1;
-    if (current_workspace_only) {
-        current_desktop = get_current_desktop();
-        log_msg("Current desktop: %ld", current_desktop);
-    }
-
-    int matching_indices[MAX_WINDOWS];
-    int match_count = find_windows_by_class_and_scope(target_class,
-                                                      current_workspace_only,
-                                                      current_desktop,
-                                                      matching_indices,
-                                                      MAX_WINDOWS);
-
-    if (match_count == 0) {
-        fprintf(stderr, "No windows found for: %s%s\n",
-                target_class,
-                current_workspace_only ? " (current workspace)" : "");
-        log_msg("No matches for class '%s' in scope", target_class);
-        XCloseDisplay(display);
-        if (logfile) fclose(logfile);
-        return 1;
-    }
 
-    log_section("MATCHING WINDOWS");
-    for (int i = 0; i < match_count; i++) {
-        int idx = matching_indices[i];
-        log_msg("  [%d] wid=%lu desktop=%ld class=%s title=%s",
-                i,
-                (unsigned long)windows[idx].id,
-                windows[idx].desktop,
-                windows[idx].wm_class,
-                windows[idx].title);
+        root = DefaultRootWindow(display);
+        mark = trace_begin();
+        init_atoms();
+        trace_end(&mark, "init_atoms", 0);
     }
 
-    int target_idx = -1;
-
-    if (current_application_mode) {
-        int target_pos = instance_number - 1;
-        if (target_pos < 0 || target_pos >= match_count) {
-            fprintf(stderr, "Requested instance %d, but found %d matching windows for %s%s\n",
-                    instance_number,
-                    match_count,
-                    target_class,
-                    current_workspace_only ? " (current workspace)" : "");
-            log_msg("ERROR: Requested instance %d but only %d matches", instance_number, match_count);
-            XCloseDisplay(display);
-            if (logfile) fclose(logfile);
-            return 1;
-        }
-        target_idx = matching_indices[target_pos];
-        log_msg("Current-application mode: selecting instance position %d directly", target_pos);
-    } else if (match_count == 1) {
-        target_idx = matching_indices[0];
-        log_msg("Single instance: immediate activation");
-    } else {
-        log_msg("Multiple instances (%d): entering instance-select mode", match_count);
-        target_idx = select_instance_interactively(&config, matching_indices, match_count);
+    int exit_code = run_jump(&config, &req);
+    trace_end(&total_mark, "total", 0);
 
-        if (target_idx == -1) {
-            XCloseDisplay(display);
-            if (logfile) fclose(logfile);
-            return 1;
-        }
-        if (target_idx < 0) {
-            XCloseDisplay(display);
-            if (logfile) fclose(logfile);
-            return 2;
-        }
+    if (display) XCloseDisplay(display);
+    if (trace_enabled) {
+        trace_emit(stderr, start_ns);
     }
-
-    activate_window(target_idx);
-    log_msg("SUCCESS: Window activated");
-
-    XCloseDisplay(display);
-    if (logfile) fclose(logfile);
-    return 0;
+    log_close();
+    return exit_code;
 }
+#endif